@@ -0,0 +1,59 @@
+// Compares the flex and the hand written scanners on a program:
+//   lexer_bench *src_file* [threads]
+#include "mapped_file.h"
+#include "token_array.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+namespace {
+
+double lex_seconds(std::string_view text, unsigned threads,
+                   yy::scanner_t scanner, std::size_t &ntokens)
+{
+    auto start = std::chrono::steady_clock::now();
+    yy::token_array_t tokens(text, threads, scanner);
+    ntokens = 0;
+    while (tokens.next())
+        ++ntokens;
+    std::chrono::duration<double> time =
+        std::chrono::steady_clock::now() - start;
+    return time.count();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        std::cerr << "Error. Please use: " << argv[0]
+                  << " *src_file* [threads].\n";
+        return 1;
+    }
+    yy::mapped_file_t file(argv[1]);
+    if (file.fail())
+    {
+        std::cerr << "File " << argv[1] << " is not exhisting.\n";
+        return 1;
+    }
+    unsigned threads = argc == 3 ? std::stoul(argv[2]) : 1;
+    double mbytes = file.text().size() / 1e6;
+
+    for (auto [name, scanner] : {std::pair{"flex", yy::scanner_t::flex},
+                                 std::pair{"simd", yy::scanner_t::simd}})
+    {
+        std::size_t ntokens = 0;
+        double best = 0;
+        for (int i = 0; i < 5; ++i)
+        {
+            double time = lex_seconds(file.text(), threads, scanner, ntokens);
+            best = i ? std::min(best, time) : time;
+        }
+        std::cout << name << ": " << ntokens << " tokens, " << best << " s, "
+                  << mbytes / best << " MB/s, " << ntokens / best / 1e6
+                  << " Mtokens/s\n";
+    }
+    return 0;
+}
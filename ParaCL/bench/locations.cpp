@@ -0,0 +1,80 @@
+// Times the flex scanner on a generated program read from a stream, with
+// the location of every token as the driver hands it to the parser:
+//   location_bench [megabytes]
+#include "paracl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// Assignments, branches and loops with comments, over a few hundred
+// variables, as a long program has them.
+std::string make_program(std::size_t size)
+{
+    std::string text;
+    for (std::size_t i = 0; text.size() < size; ++i)
+    {
+        std::string x = "x" + std::to_string(i % 397);
+        std::string y = "y" + std::to_string(i % 89);
+        text += "// Statement " + std::to_string(i) + " of the program.\n";
+        text += x + " = (" + y + " + " + std::to_string(i * 7919 % 100000) +
+                ") * " + y + " - " + x + " % 7;\n";
+        text += "if (" + x + " >= 100 && !(" + y + " == 0)) {\n    print " +
+                x + ";\n} else\n    " + x + " = " + x + " / 2;\n";
+        text += "while (" + y + " < 10)\n    " + y + " = " + y + " + 1;\n";
+    }
+    return text;
+}
+
+double lex_seconds(const std::string &text, std::size_t &ntokens)
+{
+    std::stringstream ss(text);
+    auto start = std::chrono::steady_clock::now();
+    yy::LexerPCL lexer(&ss);
+    yy::DriverPCL driver(&lexer, "bench");
+    yy::parser::semantic_type value;
+    location_t loc;
+    ntokens = 0;
+    for (;;)
+    {
+        auto tt = driver.yylex(&value, &loc);
+        if (tt == yy::parser::token_type::IDENT)
+            value.destroy<std::string>();
+        else if (static_cast<int>(tt) == 0)
+            break;
+        ++ntokens;
+    }
+    std::chrono::duration<double> time =
+        std::chrono::steady_clock::now() - start;
+    return time.count();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc > 2)
+    {
+        std::cerr << "Error. Please use: " << argv[0] << " [megabytes].\n";
+        return 1;
+    }
+    std::size_t megabytes = argc == 2 ? std::stoul(argv[1]) : 64;
+    std::string text = make_program(megabytes << 20);
+    double mbytes = text.size() / 1e6;
+
+    std::size_t ntokens = 0;
+    double best = 0;
+    for (int i = 0; i < 5; ++i)
+    {
+        double time = lex_seconds(text, ntokens);
+        best = i ? std::min(best, time) : time;
+    }
+    std::cout << "flex: " << ntokens << " tokens, " << best << " s, "
+              << mbytes / best << " MB/s, " << ntokens / best / 1e6
+              << " Mtokens/s\n";
+    return 0;
+}
@@ -0,0 +1,114 @@
+// Compiles a program of many modules from their sources, from their
+// artifacts and with one module changed:
+//   module_bench [modules] [functions per module]
+#include "ast_representation.h"
+#include "paracl.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// Module i defines functions that loop and call each other and the
+// functions of module i - 1, which it imports.
+void write_module(const fs::path &dir, std::size_t i, std::size_t functions)
+{
+    std::ofstream os(dir / ("m" + std::to_string(i) + ".pcl"));
+    if (i)
+        os << "import \"m" << i - 1 << ".pcl\";\n";
+    for (std::size_t f = 0; f < functions; ++f)
+    {
+        std::string name = "f" + std::to_string(i) + "_" + std::to_string(f);
+        os << "func " << name << "(a, b) {\n"
+           << "    s = 0;\n"
+           << "    while (a < b) {\n"
+           << "        if (a % 3 == 0)\n"
+           << "            s = s + a * b - " << f << ";\n"
+           << "        else\n"
+           << "            s = s - (a + " << i << ") / (b + 1);\n"
+           << "        a = a + 1;\n"
+           << "    }\n";
+        if (f)
+            os << "    s = s + f" << i << "_" << f - 1 << "(a, s % 7);\n";
+        else if (i)
+            os << "    s = s + f" << i - 1 << "_" << functions - 1
+               << "(a, s % 7);\n";
+        os << "    return s;\n}\n";
+    }
+}
+
+struct result_t {
+    double seconds;
+    std::size_t compiled, read;
+};
+
+result_t compile(const fs::path &main)
+{
+    auto start = std::chrono::steady_clock::now();
+    yy::mapped_file_t file(main.string());
+    yy::token_array_t tokens(file.text(), 1);
+    AST::ast_representation_t astr;
+    yy::module_loader_t loader(astr);
+    yy::DriverPCL driver(&tokens, main.string());
+    driver.use_modules(&loader);
+    if (!driver.parse(&astr) || astr.get_ast().functions().empty())
+        throw std::runtime_error("The program does not compile");
+    std::chrono::duration<double> time =
+        std::chrono::steady_clock::now() - start;
+    return {time.count(), loader.compiled(), loader.read()};
+}
+
+void report(const char *name, const result_t &res)
+{
+    std::cout << name << ": " << res.seconds << " s, " << res.compiled
+              << " modules compiled, " << res.read << " read\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc > 3)
+    {
+        std::cerr << "Error. Please use: " << argv[0]
+                  << " [modules] [functions per module].\n";
+        return 1;
+    }
+    std::size_t modules = argc > 1 ? std::stoul(argv[1]) : 200;
+    std::size_t functions = argc > 2 ? std::stoul(argv[2]) : 20;
+
+    fs::path dir = fs::temp_directory_path() / "paracl_module_bench";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    for (std::size_t i = 0; i < modules; ++i)
+        write_module(dir, i, functions);
+    fs::path main = dir / "main.pcl";
+    {
+        std::ofstream os(main);
+        for (std::size_t i = 0; i < modules; ++i)
+            os << "import \"m" << i << ".pcl\";\n";
+        os << "print f" << modules - 1 << "_" << functions - 1
+           << "(0, 10);\n";
+    }
+
+    report("cold", compile(main));
+    result_t warm = compile(main);
+    for (int i = 0; i < 4; ++i)
+    {
+        result_t res = compile(main);
+        warm.seconds = std::min(warm.seconds, res.seconds);
+    }
+    report("warm", warm);
+    fs::path changed = dir / ("m" + std::to_string(modules / 2) + ".pcl");
+    fs::last_write_time(changed, fs::last_write_time(changed) +
+                                     std::chrono::seconds(1));
+    report("one changed", compile(main));
+    fs::remove_all(dir);
+    return 0;
+}
@@ -1,18 +1,37 @@
 #pragma once
 
+#include "affine_map.h"
 #include "concepts.h"
 #include "driver_exceptions.h"
 #include "semantic.h"
 #include "symbol_table.h"
 
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
 #include <deque>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <list>
 #include <memory>
+#include <memory_resource>
+#include <optional>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <variant>
+#include <vector>
 
 namespace AST {
 
@@ -28,17 +47,391 @@ enum class node_types {
     IFELSE,
     WHILE,
     EMPTY,
+    CACHED,
+    CLOSED_LOOP,
+    LOCAL,
+    LOCAL_ASSIGN,
+    CALL,
+    RETURN,
+    FUNCTION,
+    INDUCTION,
+    REDUCED,
+    UNROLLED_LOOP,
+};
+
+inline constexpr std::size_t node_types_count =
+    static_cast<std::size_t>(node_types::UNROLLED_LOOP) + 1;
+
+constexpr std::string_view node_type_name(node_types nt)
+{
+    constexpr std::array<std::string_view, node_types_count> names = {
+        "NUMBER",      "VARIABLE", "BIN_OP",       "UN_OP",
+        "STATEMENTS",  "WRITE",    "LVAL",         "IF",
+        "IFELSE",      "WHILE",    "EMPTY",        "CACHED",
+        "CLOSED_LOOP", "LOCAL",    "LOCAL_ASSIGN", "CALL",
+        "RETURN",      "FUNCTION", "INDUCTION",    "REDUCED",
+        "UNROLLED_LOOP"};
+    return names[static_cast<std::size_t>(nt)];
+}
+
+// What a run did, counted only when statistics are asked for.
+struct run_counters_t final {
+    std::array<std::uint64_t, node_types_count> executed{};
+    std::uint64_t reads = 0;
+    std::uint64_t writes = 0;
+};
+
+// Limits of a run. They are checked only at loop back edges and scope
+// entries, which every long run keeps passing, so a limit is noticed a
+// little late but costs next to nothing.
+struct run_budget_t final {
+    using wall_clock_t = std::chrono::steady_clock;
+    static constexpr std::uint64_t unlimited =
+        std::numeric_limits<std::uint64_t>::max();
+    // Checks between two readings of the clock.
+    static constexpr std::uint64_t clock_period = 256;
+
+    std::uint64_t max_steps = unlimited;  // loop iterations and scope entries
+    std::uint64_t max_output = unlimited; // bytes printed
+    std::uint64_t max_vars = unlimited;   // variables alive at once
+    std::optional<wall_clock_t::time_point> deadline;
+    std::uint64_t max_time_ms = unlimited;
+
+    std::uint64_t steps = 0;
+    std::uint64_t output = 0;
+
+    static std::size_t printed_size(const ipcl_val &val)
+    {
+        const int *num = std::get_if<int>(&val);
+        if (!num)
+            return 0;
+        char buf[std::numeric_limits<int>::digits10 + 2];
+        auto res = std::to_chars(std::begin(buf), std::end(buf), *num);
+        return res.ptr - buf + 1; // and the newline
+    }
+
+    void start()
+    {
+        if (max_time_ms != unlimited)
+            deadline =
+                wall_clock_t::now() + std::chrono::milliseconds(max_time_ms);
+    }
+
+    // Counts a step with vars variables alive. Returns the limit that is
+    // exceeded, if any.
+    std::optional<std::string> check(std::size_t vars)
+    {
+        if (++steps > max_steps)
+            return "Step limit of " + std::to_string(max_steps);
+        if (output > max_output)
+            return "Output limit of " + std::to_string(max_output) + " bytes";
+        if (vars > max_vars)
+            return "Variable limit of " + std::to_string(max_vars);
+        if (deadline && steps % clock_period == 0 &&
+            wall_clock_t::now() > *deadline)
+            return "Time limit of " + std::to_string(max_time_ms) + " ms";
+        return std::nullopt;
+    }
+};
+
+class ast_machine_t;
+struct ast_func_t;
+struct ast_statements_t;
+
+// When a run saves its state: every `every` loop back edges, 0 for never,
+// at the next back edge or ? once *requested is set, e.g. by a signal
+// handler, and before the first value is read by ? if before_read is set.
+// *reading is set while ? waits for input, when no request is handled until
+// the input comes. save writes the state, see checkpoint.h.
+struct run_snapshots_t final {
+    std::uint64_t every = 0;
+    std::uint64_t back_edges = 0;
+    volatile std::sig_atomic_t *requested = nullptr;
+    volatile std::sig_atomic_t *reading = nullptr;
+    bool before_read = false;
+    std::function<void(const ast_machine_t &)> save;
+
+    bool due()
+    {
+        return (every && ++back_edges % every == 0) ||
+               (requested && *requested);
+    }
+    bool due_before_read() const
+    {
+        return before_read || (requested && *requested);
+    }
+    void wait_for_input(bool waits)
+    {
+        if (reading)
+            *reading = waits;
+    }
+};
+
+// Threads that run the independent statements of a sequence at the same
+// time, see ast_machine_t::fork.
+struct run_tasks_t final {
+    unsigned threads = 1;
+};
+
+// Variables a statement reads and assigns, for running it at the same time
+// as its neighbours. The variables a scope assigns first are its own.
+struct task_t final {
+    std::unordered_set<std::string_view> reads, writes;
+    bool scope = false;
+};
+
+// Values read by ? and printed by a run, in their order. A recorded run
+// appends them, a replayed one takes what ? reads from them and checks that
+// it prints them, see trace.h.
+struct run_trace_t final {
+    bool replay = false;
+    std::vector<int> reads, writes;
+    std::size_t read = 0, written = 0;
 };
 
 struct ast_node_t {
     using node_ptr = std::shared_ptr<ast_node_t>;
-    using node_it = std::list<node_ptr>::iterator;
+    using node_it = std::pmr::list<node_ptr>::iterator;
     const node_types nt;
+    // Number of the node in a checkpoint, given when the first one is saved
+    // or loaded, 0 until then.
+    mutable std::uint32_t id = 0;
     ast_node_t(node_types n_t) : nt(n_t) {}
-    virtual ipcl_val Iprocess(symbol_table_t &) const { return {}; }
+    ipcl_val Iprocess(symbol_table_t &st, run_counters_t *counters = nullptr,
+                      run_budget_t *budget = nullptr,
+                      run_snapshots_t *snapshots = nullptr,
+                      run_tasks_t *tasks = nullptr,
+                      run_trace_t *trace = nullptr) const;
+    // Step pc of the node's evaluation: either calls a child or finishes the
+    // node with its value.
+    virtual void Istep(ast_machine_t &m, std::size_t pc) const;
     virtual ~ast_node_t() = default;
 };
 
+// Evaluates a subtree with explicit stacks instead of native recursion, so
+// nesting depth is only limited by memory. A frame holds a node and its next
+// step; evaluated children leave their values on the value stack.
+class ast_machine_t final {
+    struct frame_t {
+        const ast_node_t *node;
+        std::size_t pc;
+    };
+    // A running function call. Its variables are a slice of one stack of
+    // ints, so a call allocates nothing once the stacks have grown.
+    struct call_t {
+        const ast_func_t *fn;
+        std::size_t frame;  // of the calling node
+        std::size_t values; // height of the value stack before the arguments
+        std::size_t base;   // of the variables of the call
+        std::pmr::vector<int> args; // kept only for a memoized function
+    };
+
+    symbol_table_t &st_;
+    run_counters_t *counters_;
+    run_budget_t *budget_;
+    run_snapshots_t *snapshots_;
+    run_tasks_t *tasks_;
+    run_trace_t *trace_;
+    std::ostream *out_ = &std::cout;
+    std::pmr::vector<frame_t> frames_;
+    std::pmr::vector<ipcl_val> values_;
+    std::pmr::vector<call_t> calls_;
+    std::pmr::vector<int> locals_;
+    std::size_t base_ = 0;
+    std::uint64_t reads_ = 0; // values read by ?
+
+    friend class checkpoint_t;
+
+public:
+    // The stacks take their memory from where the variables do.
+    ast_machine_t(symbol_table_t &st, run_counters_t *counters = nullptr,
+                  run_budget_t *budget = nullptr,
+                  run_snapshots_t *snapshots = nullptr,
+                  run_tasks_t *tasks = nullptr, run_trace_t *trace = nullptr)
+        : st_(st), counters_(counters), budget_(budget), snapshots_(snapshots),
+          tasks_(tasks), trace_(trace), frames_(st.resource()),
+          values_(st.resource()), calls_(st.resource()),
+          locals_(st.resource())
+    {}
+
+    symbol_table_t &st() { return st_; }
+    // Prints to out instead of the standard output.
+    void output(std::ostream *out) { out_ = out; }
+    // Whether the run is over, e.g. one restored from the end of a program.
+    bool done() const { return frames_.empty(); }
+    // Whether the run has limits, which are checked at every iteration.
+    bool limited() const { return budget_ != nullptr; }
+
+    ipcl_val run(const ast_node_t &node)
+    {
+        frames_.push_back({&node, 0});
+        return resume();
+    }
+    // Runs the frames there are, e.g. restored from a checkpoint.
+    ipcl_val resume()
+    {
+        while (!frames_.empty())
+        {
+            frame_t &frame = frames_.back();
+            if (frame.pc == 0)
+                count(frame.node->nt);
+            frame.node->Istep(*this, frame.pc);
+        }
+        return pop();
+    }
+
+    void count(node_types nt)
+    {
+        if (counters_)
+            ++counters_->executed[static_cast<std::size_t>(nt)];
+    }
+    void count_read()
+    {
+        ++reads_;
+        if (counters_)
+            ++counters_->reads;
+    }
+    void count_write(const ipcl_val &val)
+    {
+        if (counters_)
+            ++counters_->writes;
+        if (budget_)
+            budget_->output += run_budget_t::printed_size(val);
+    }
+    int read()
+    {
+        // The ? is run again from its first step once the state is loaded,
+        // so a pending request is handled here as well.
+        if (snapshots_) [[unlikely]]
+        {
+            snapshots_->wait_for_input(true);
+            while (snapshots_->due_before_read())
+            {
+                snapshots_->before_read = false;
+                snapshots_->wait_for_input(false);
+                snapshots_->save(*this);
+                snapshots_->wait_for_input(true);
+            }
+        }
+        int val;
+        if (trace_ && trace_->replay) [[unlikely]]
+        {
+            if (trace_->read == trace_->reads.size())
+                fail("Input past the end of the trace");
+            val = trace_->reads[trace_->read++];
+        }
+        else
+        {
+            std::cin >> val;
+            if (trace_) [[unlikely]]
+                trace_->reads.push_back(val);
+        }
+        if (snapshots_) [[unlikely]]
+            snapshots_->wait_for_input(false);
+        count_read();
+        return val;
+    }
+    void print(const ipcl_val &val)
+    {
+        if (trace_) [[unlikely]]
+            trace_write(val);
+        std::visit([this](auto &&el) { *out_ << el << std::endl; }, val);
+        count_write(val);
+    }
+    // Called at loop back edges and scope entries with the offset of the
+    // loop or scope in the source.
+    void checkpoint(std::size_t offset)
+    {
+        if (budget_) [[unlikely]]
+            check_budget(offset);
+    }
+    // Called at loop back edges, the loop resuming at step pc. The state of
+    // the run is complete there, so it can be saved.
+    void back_edge(std::size_t offset, std::size_t pc)
+    {
+        checkpoint(offset);
+        if (snapshots_ && snapshots_->due()) [[unlikely]]
+        {
+            frames_.back().pc = pc;
+            snapshots_->save(*this);
+        }
+    }
+
+    // Pushes the value of the child and returns true if it is computed in
+    // place. Otherwise pushes its frame, and the current node resumes at step
+    // pc once the child's value is on top of the value stack.
+    bool call(ast_node_t::node_it child, std::size_t pc);
+    // Replaces the current node by one whose value becomes its value.
+    void tail(const ast_node_t &other) { frames_.back() = {&other, 0}; }
+    void tail(ast_node_t::node_it other) { tail(**other); }
+    void ret(ipcl_val val)
+    {
+        frames_.pop_back();
+        values_.push_back(std::move(val));
+    }
+    // Finishes the current node whose value is already on the value stack.
+    void leave() { frames_.pop_back(); }
+
+    // Variable of the running call.
+    int &local(std::size_t slot) { return locals_[base_ + slot]; }
+    // Calls fn with its n arguments on top of the value stack, the current
+    // node resumes at step pc once the call returns. A tail call replaces
+    // the running call instead, which then returns what fn returns.
+    void enter(const ast_func_t &fn, std::size_t n, std::size_t pc, bool tail,
+               std::size_t offset);
+    // Returns val from the running call.
+    void exit(int val);
+
+    void push(ipcl_val val) { values_.push_back(std::move(val)); }
+    ipcl_val pop()
+    {
+        ipcl_val val = std::move(values_.back());
+        values_.pop_back();
+        return val;
+    }
+    ipcl_val &top() { return values_.back(); }
+
+    // Stops the run on an operation without a defined result, blamed on the
+    // innermost running loop, call, assignment or print.
+    [[noreturn]] void fail(const std::string &what) const;
+
+    // Runs the statements of stmts from first on that are independent of
+    // each other at the same time, each on a copy of the variables it
+    // touches, if there are two or more. Their output and variables are
+    // then taken in program order, and the value of the last one is left on
+    // the value stack. Returns the number of statements run.
+    std::size_t fork(const ast_statements_t &stmts, std::size_t first)
+    {
+        if (!tasks_) [[likely]]
+            return 0;
+        return fork_tasks(stmts, first);
+    }
+
+private:
+    void trace_write(const ipcl_val &val);
+    std::size_t fork_tasks(const ast_statements_t &stmts, std::size_t first);
+    void check_budget(std::size_t offset);
+    // Offset of the innermost running loop, the one to blame for an
+    // exceeded limit, or offset outside of loops.
+    std::size_t loop_offset(std::size_t offset) const;
+};
+
+inline ipcl_val ast_node_t::Iprocess(symbol_table_t &st,
+                                     run_counters_t *counters,
+                                     run_budget_t *budget,
+                                     run_snapshots_t *snapshots,
+                                     run_tasks_t *tasks,
+                                     run_trace_t *trace) const
+{
+    return ast_machine_t{st, counters, budget, snapshots, tasks, trace}.run(
+        *this);
+}
+
+inline void ast_node_t::Istep(ast_machine_t &m, std::size_t) const
+{
+    m.ret({});
+}
+
 struct ast_expr_t : public ast_node_t {
     ast_expr_t(node_types n_t) : ast_node_t(n_t) {}
     virtual ~ast_expr_t() = default;
@@ -47,23 +440,30 @@ struct ast_expr_t : public ast_node_t {
 struct ast_num_t final : public ast_expr_t {
     int val;
 
-    ipcl_val Iprocess(symbol_table_t &) const override { return val; }
+    void Istep(ast_machine_t &m, std::size_t) const override { m.ret(val); }
+    ipcl_val value() const { return val; }
     ast_num_t(int vall) noexcept : ast_expr_t(node_types::NUMBER), val(vall) {}
 };
 
 struct ast_var_t : public ast_expr_t {
     std::string name;
 
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    void Istep(ast_machine_t &m, std::size_t) const override
     {
-        auto var_val = st.find(name)->second;
-        return ipcl_val{var_val};
+        m.ret(value(m));
+    }
+    ipcl_val value(ast_machine_t &m) const
+    {
+        auto it = m.st().find(name);
+        if (it == m.st().end()) [[unlikely]]
+            m.fail("Variable " + name + " is read before it is assigned");
+        return ipcl_val{it->second};
     }
     ast_var_t(std::string_view namee, symbol_table_t &st,
               node_types n_t = node_types::VARIABLE)
         : ast_expr_t(n_t), name(namee)
     {
-        if (st.find(std::string{name}) == st.cend())
+        if (!st.contains(name))
             throw ExceptsPCL::compilation_error("Undefined variable: " +
                                                 std::string(name));
     }
@@ -74,16 +474,16 @@ struct ast_var_t : public ast_expr_t {
 };
 
 struct ast_empty_op_t final : public ast_expr_t {
-    ipcl_val Iprocess(symbol_table_t &) const override { return {}; }
+    void Istep(ast_machine_t &m, std::size_t) const override { m.ret({}); }
     ast_empty_op_t() : ast_expr_t(node_types::EMPTY) {}
 };
 
 struct ast_lval_t : public ast_var_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    void Istep(ast_machine_t &m, std::size_t) const override
     {
-        IIterator res = st.add_name(name);
-        assert(res != st.end());
-        return ipcl_val{res};
+        IIterator res = m.st().add_name(name);
+        assert(res != m.st().end());
+        m.ret(ipcl_val{res});
     }
 
     ast_lval_t(std::string_view namee, symbol_table_t &st)
@@ -94,6 +494,48 @@ struct ast_lval_t : public ast_var_t {
     virtual ~ast_lval_t() = default;
 };
 
+// Variable of a function, a slot of the running call.
+struct ast_local_t final : public ast_expr_t {
+    std::string name;
+    std::size_t slot;
+
+    void Istep(ast_machine_t &m, std::size_t) const override
+    {
+        m.ret(m.local(slot));
+    }
+    ast_local_t(std::string_view namee, std::size_t slott)
+        : ast_expr_t(node_types::LOCAL), name(namee), slot(slott)
+    {}
+};
+
+// Constants and variables are evaluated in place instead of in a frame of
+// their own.
+inline bool ast_machine_t::call(ast_node_t::node_it child, std::size_t pc)
+{
+    const ast_node_t &node = **child;
+    if (node.nt == node_types::NUMBER)
+    {
+        count(node.nt);
+        push(static_cast<const ast_num_t &>(node).value());
+        return true;
+    }
+    if (node.nt == node_types::VARIABLE)
+    {
+        count(node.nt);
+        push(static_cast<const ast_var_t &>(node).value(*this));
+        return true;
+    }
+    if (node.nt == node_types::LOCAL)
+    {
+        count(node.nt);
+        push(local(static_cast<const ast_local_t &>(node).slot));
+        return true;
+    }
+    frames_.back().pc = pc;
+    frames_.push_back({&node, 0});
+    return false;
+}
+
 enum class ast_bin_ops {
     PLUS,
     MINUS,
@@ -122,87 +564,182 @@ struct ast_bin_op_t : public ast_expr_t {
         : ast_expr_t(node_types::BIN_OP), op(opp), rhs(rhss)
     {}
 
+    // The right operand is evaluated first.
+    void Istep(ast_machine_t &m, std::size_t pc) const override
+    {
+        if (pc == 0 && !m.call(rhs, 1))
+            return;
+        if (pc <= 1 && !m.call(lhs, 2))
+            return;
+        ipcl_val lhs_val = m.pop();
+        m.top() = apply(lhs_val, m.top());
+        m.leave();
+    }
+
+    virtual ipcl_val apply(const ipcl_val &lhs_val,
+                           const ipcl_val &rhs_val) const = 0;
     virtual constexpr std::string_view op_str() const = 0;
     virtual ~ast_bin_op_t() = default;
 };
 
-struct ast_plus_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+// Operator on ints that may fail the run, at its place in the source. +, -
+// and * wrap around unless overflow_check is set, / and % fail on a zero
+// divisor while zero_check is set. The range analysis clears the checks
+// that can not fail.
+struct ast_arith_op_t : public ast_bin_op_t {
+    std::size_t offset; // in the source
+    bool zero_check;
+    bool overflow_check;
+
+    ast_arith_op_t(ast_bin_ops opp, node_it lhss, node_it rhss,
+                   std::size_t offsett, bool overflow_checkk)
+        : ast_bin_op_t(opp, lhss, rhss), offset(offsett),
+          zero_check(opp == ast_bin_ops::DIVISION ||
+                     opp == ast_bin_ops::MODDIV),
+          overflow_check(overflow_checkk)
+    {}
+
+    [[noreturn]] void fail(const char *what) const
     {
-        return std::visit(
-            [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs + rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+        throw ExceptsPCL::run_error(what, offset);
+    }
+    // Called on a result that wrapped around.
+    void overflow() const
+    {
+        if (overflow_check)
+            fail("Integer overflow");
+    }
+    // lhs / rhs or lhs % rhs, defined for a rhs of -1 as well.
+    int divide(int lhs, int rhs, bool remainder) const
+    {
+        if (rhs == 0 && zero_check) [[unlikely]]
+            fail("Division by zero");
+        if (rhs == -1)
+        {
+            int res;
+            if (!remainder && __builtin_sub_overflow(0, lhs, &res))
+                overflow();
+            return remainder ? 0 : res;
+        }
+        return remainder ? lhs % rhs : lhs / rhs;
+    }
+};
+
+// The node as an arithmetic operator, if it is one.
+inline const ast_arith_op_t *as_arith(const ast_node_t &node)
+{
+    if (node.nt != node_types::BIN_OP)
+        return nullptr;
+    switch (static_cast<const ast_bin_op_t &>(node).op)
+    {
+    case ast_bin_ops::PLUS:
+    case ast_bin_ops::MINUS:
+    case ast_bin_ops::MULTIPLICATION:
+    case ast_bin_ops::DIVISION:
+    case ast_bin_ops::MODDIV:
+        return static_cast<const ast_arith_op_t *>(&node);
+    default:
+        return nullptr;
+    }
+}
+
+struct ast_plus_op final : public ast_arith_op_t {
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
+    {
+        int res;
+        if (__builtin_add_overflow(std::get<int>(lhs_val),
+                                   std::get<int>(rhs_val), &res)) [[unlikely]]
+            overflow();
+        return res;
     }
     constexpr std::string_view op_str() const override { return "+"; }
 
-    ast_plus_op(node_it lhss, node_it rhss)
-        : ast_bin_op_t(ast_bin_ops::PLUS, lhss, rhss)
+    ast_plus_op(node_it lhss, node_it rhss, std::size_t offsett = 0,
+                bool overflow_checkk = false)
+        : ast_arith_op_t(ast_bin_ops::PLUS, lhss, rhss, offsett,
+                         overflow_checkk)
     {}
 };
 
-struct ast_minus_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+struct ast_minus_op final : public ast_arith_op_t {
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
-        return std::visit(
-            [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs - rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+        int res;
+        if (__builtin_sub_overflow(std::get<int>(lhs_val),
+                                   std::get<int>(rhs_val), &res)) [[unlikely]]
+            overflow();
+        return res;
     }
     constexpr std::string_view op_str() const override { return "-"; }
 
-    ast_minus_op(node_it lhss, node_it rhss)
-        : ast_bin_op_t(ast_bin_ops::MINUS, lhss, rhss)
+    ast_minus_op(node_it lhss, node_it rhss, std::size_t offsett = 0,
+                 bool overflow_checkk = false)
+        : ast_arith_op_t(ast_bin_ops::MINUS, lhss, rhss, offsett,
+                         overflow_checkk)
     {}
 };
 
-struct ast_mul_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+struct ast_mul_op final : public ast_arith_op_t {
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
-        return std::visit(
-            [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs * rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+        int res;
+        if (__builtin_mul_overflow(std::get<int>(lhs_val),
+                                   std::get<int>(rhs_val), &res)) [[unlikely]]
+            overflow();
+        return res;
     }
     constexpr std::string_view op_str() const override { return "*"; }
 
-    ast_mul_op(node_it lhss, node_it rhss)
-        : ast_bin_op_t(ast_bin_ops::MULTIPLICATION, lhss, rhss)
+    ast_mul_op(node_it lhss, node_it rhss, std::size_t offsett = 0,
+               bool overflow_checkk = false)
+        : ast_arith_op_t(ast_bin_ops::MULTIPLICATION, lhss, rhss, offsett,
+                         overflow_checkk)
     {}
 };
 
-struct ast_div_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+struct ast_div_op final : public ast_arith_op_t {
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
-        return std::visit(
-            [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs / rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+        return divide(std::get<int>(lhs_val), std::get<int>(rhs_val), false);
     }
     constexpr std::string_view op_str() const override { return "/"; }
 
-    ast_div_op(node_it lhss, node_it rhss)
-        : ast_bin_op_t(ast_bin_ops::DIVISION, lhss, rhss)
+    ast_div_op(node_it lhss, node_it rhss, std::size_t offsett = 0,
+               bool overflow_checkk = false)
+        : ast_arith_op_t(ast_bin_ops::DIVISION, lhss, rhss, offsett,
+                         overflow_checkk)
     {}
 };
 
 struct ast_assign_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    std::size_t offset = 0; // in the source
+
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
         return std::visit(
             [](auto &&lhs, auto &&rhs) -> ipcl_val { return assign(lhs, rhs); },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+            lhs_val, rhs_val);
     }
     constexpr std::string_view op_str() const override { return "="; }
 
-    ast_assign_op(node_it lhss, node_it rhss)
-        : ast_bin_op_t(ast_bin_ops::ASSIGNMENT, lhss, rhss)
+    ast_assign_op(node_it lhss, node_it rhss, std::size_t offsett = 0)
+        : ast_bin_op_t(ast_bin_ops::ASSIGNMENT, lhss, rhss), offset(offsett)
     {}
     ast_assign_op(node_it rhss) : ast_bin_op_t(ast_bin_ops::ASSIGNMENT, rhss) {}
 };
 
 struct ast_greater_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
         return std::visit(
             [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs > rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+            lhs_val, rhs_val);
     }
     constexpr std::string_view op_str() const override { return ">"; }
 
@@ -212,11 +749,12 @@ struct ast_greater_op final : public ast_bin_op_t {
 };
 
 struct ast_less_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
         return std::visit(
             [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs < rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+            lhs_val, rhs_val);
     }
     constexpr std::string_view op_str() const override { return "<"; }
 
@@ -226,11 +764,12 @@ struct ast_less_op final : public ast_bin_op_t {
 };
 
 struct ast_greatereq_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
         return std::visit(
             [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs >= rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+            lhs_val, rhs_val);
     }
     constexpr std::string_view op_str() const override { return ">="; }
 
@@ -240,11 +779,12 @@ struct ast_greatereq_op final : public ast_bin_op_t {
 };
 
 struct ast_lesseq_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
         return std::visit(
             [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs <= rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+            lhs_val, rhs_val);
     }
     constexpr std::string_view op_str() const override { return "<="; }
 
@@ -254,11 +794,12 @@ struct ast_lesseq_op final : public ast_bin_op_t {
 };
 
 struct ast_equal_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
         return std::visit(
             [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs == rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+            lhs_val, rhs_val);
     }
     constexpr std::string_view op_str() const override { return "=="; }
 
@@ -268,11 +809,12 @@ struct ast_equal_op final : public ast_bin_op_t {
 };
 
 struct ast_notequal_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
         return std::visit(
             [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs != rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+            lhs_val, rhs_val);
     }
     constexpr std::string_view op_str() const override { return "!="; }
 
@@ -282,11 +824,12 @@ struct ast_notequal_op final : public ast_bin_op_t {
 };
 
 struct ast_logical_and_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
         return std::visit(
             [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs && rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+            lhs_val, rhs_val);
     }
     constexpr std::string_view op_str() const override { return "&&"; }
 
@@ -296,11 +839,12 @@ struct ast_logical_and_op final : public ast_bin_op_t {
 };
 
 struct ast_logical_or_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
         return std::visit(
             [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs || rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+            lhs_val, rhs_val);
     }
     constexpr std::string_view op_str() const override { return "||"; }
 
@@ -309,17 +853,19 @@ struct ast_logical_or_op final : public ast_bin_op_t {
     {}
 };
 
-struct ast_modular_division_op final : public ast_bin_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+struct ast_modular_division_op final : public ast_arith_op_t {
+    ipcl_val apply(const ipcl_val &lhs_val,
+                   const ipcl_val &rhs_val) const override
     {
-        return std::visit(
-            [](auto &&lhs, auto &&rhs) -> ipcl_val { return lhs % rhs; },
-            (*lhs)->Iprocess(st), (*rhs)->Iprocess(st));
+        return divide(std::get<int>(lhs_val), std::get<int>(rhs_val), true);
     }
     constexpr std::string_view op_str() const override { return "%"; }
 
-    ast_modular_division_op(node_it lhss, node_it rhss)
-        : ast_bin_op_t(ast_bin_ops::MODDIV, lhss, rhss)
+    ast_modular_division_op(node_it lhss, node_it rhss,
+                            std::size_t offsett = 0,
+                            bool overflow_checkk = false)
+        : ast_arith_op_t(ast_bin_ops::MODDIV, lhss, rhss, offsett,
+                         overflow_checkk)
     {}
 };
 
@@ -338,41 +884,65 @@ struct ast_un_op_t : public ast_expr_t {
         : ast_expr_t(node_types::UN_OP), op(opp), rhs(rhss)
     {}
 
+    void Istep(ast_machine_t &m, std::size_t pc) const override
+    {
+        if (pc == 0 && !m.call(rhs, 1))
+            return;
+        m.top() = apply(m.top());
+        m.leave();
+    }
+
+    virtual ipcl_val apply(const ipcl_val &rhs_val) const = 0;
     virtual constexpr std::string_view op_str() const = 0;
     virtual ~ast_un_op_t() = default;
 };
 
 struct ast_print_op final : public ast_un_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    std::size_t offset; // in the source
+
+    void Istep(ast_machine_t &m, std::size_t pc) const override
     {
-        return std::visit(
-            [](auto &&el) -> ipcl_val {
-                std::cout << el << std::endl;
-                return el;
-            },
-            (*rhs)->Iprocess(st));
+        if (pc == 0 && !m.call(rhs, 1))
+            return;
+        m.print(m.top());
+        m.leave();
     }
+    // The value is printed by the machine, to the output of its run.
+    ipcl_val apply(const ipcl_val &rhs_val) const override { return rhs_val; }
     constexpr std::string_view op_str() const override { return "print"; }
 
-    ast_print_op(node_it rhss) : ast_un_op_t(ast_un_ops::PRINT, rhss) {}
+    ast_print_op(node_it rhss, std::size_t offsett = 0)
+        : ast_un_op_t(ast_un_ops::PRINT, rhss), offset(offsett)
+    {}
 };
 
+// -x wraps around for the least int unless overflow_check is set, like an
+// arithmetic operator.
 struct ast_unminus_op final : public ast_un_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    std::size_t offset; // in the source
+    bool overflow_check;
+
+    ipcl_val apply(const ipcl_val &rhs_val) const override
     {
-        return std::visit([](auto &&el) -> ipcl_val { return -el; },
-                          (*rhs)->Iprocess(st));
+        int res;
+        if (__builtin_sub_overflow(0, std::get<int>(rhs_val), &res) &&
+            overflow_check) [[unlikely]]
+            throw ExceptsPCL::run_error("Integer overflow", offset);
+        return res;
     }
     constexpr std::string_view op_str() const override { return "-"; }
 
-    ast_unminus_op(node_it rhss) : ast_un_op_t(ast_un_ops::MINUS, rhss) {}
+    ast_unminus_op(node_it rhss, std::size_t offsett = 0,
+                   bool overflow_checkk = false)
+        : ast_un_op_t(ast_un_ops::MINUS, rhss), offset(offsett),
+          overflow_check(overflow_checkk)
+    {}
 };
 
 struct ast_unplus_op final : public ast_un_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    ipcl_val apply(const ipcl_val &rhs_val) const override
     {
-        return std::visit([](auto &&el) -> ipcl_val { return el; },
-                          (*rhs)->Iprocess(st));
+        return std::visit([](auto &&el) -> ipcl_val { return el; }, rhs_val);
     }
     constexpr std::string_view op_str() const override { return "+"; }
 
@@ -380,10 +950,9 @@ struct ast_unplus_op final : public ast_un_op_t {
 };
 
 struct ast_logical_no_op final : public ast_un_op_t {
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    ipcl_val apply(const ipcl_val &rhs_val) const override
     {
-        return std::visit([](auto &&el) -> ipcl_val { return !el; },
-                          (*rhs)->Iprocess(st));
+        return std::visit([](auto &&el) -> ipcl_val { return !el; }, rhs_val);
     }
     constexpr std::string_view op_str() const override { return "!"; }
 
@@ -391,60 +960,127 @@ struct ast_logical_no_op final : public ast_un_op_t {
 };
 
 struct ast_write_t final : public ast_expr_t {
-    ipcl_val Iprocess(symbol_table_t &) const override
+    void Istep(ast_machine_t &m, std::size_t) const override
     {
-        int tmp;
-        std::cin >> tmp;
-        return {tmp};
+        m.ret({m.read()});
     }
     ast_write_t() : ast_expr_t(node_types::WRITE) {}
 };
 
+// Value shared by all occurrences of a cached expression. It is valid while
+// epoch matches the epoch of the node that owns the cache.
+struct ast_cache_slot_t final {
+    mutable unsigned long epoch = 0;
+    mutable int val = 0;
+};
+
+// Pure expression whose value is computed once per owner epoch. The owner is
+// a loop (the expression is invariant in it) or a statement sequence (the
+// expression is common to several of its statements).
+struct ast_cached_expr_t final : public ast_expr_t {
+    node_it expr;
+    std::shared_ptr<ast_cache_slot_t> slot;
+    const unsigned long *owner_epoch;
+
+    void Istep(ast_machine_t &m, std::size_t pc) const override
+    {
+        if (pc == 0 && slot->epoch == *owner_epoch)
+        {
+            m.ret(slot->val);
+            return;
+        }
+        if (pc == 0 && !m.call(expr, 1))
+            return;
+        slot->val = std::get<int>(m.top());
+        slot->epoch = *owner_epoch;
+        m.leave();
+    }
+    ast_cached_expr_t(node_it exprr, std::shared_ptr<ast_cache_slot_t> slott,
+                      const unsigned long *owner_epochh)
+        : ast_expr_t(node_types::CACHED), expr(exprr), slot(std::move(slott)),
+          owner_epoch(owner_epochh)
+    {}
+};
+
 struct ast_statements_t : public ast_node_t {
-    using deque_t = std::deque<node_it>;
+    using deque_t = std::pmr::deque<node_it>;
+    // The sequence takes its memory from the resource of its node.
+    using allocator_type = std::pmr::polymorphic_allocator<>;
     deque_t seq;
+    mutable unsigned long epoch = 0;
+    // The statements that may run at the same time as their neighbours, by
+    // index, or none if the sequence was not analysed.
+    std::vector<std::optional<task_t>> tasks;
 
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    void Istep(ast_machine_t &m, std::size_t pc) const override
     {
-        return process_sequency(st);
+        if (step_sequency(m, pc))
+            m.leave();
     }
-    ast_statements_t() : ast_node_t(node_types::STATEMENTS) {}
-    ast_statements_t(node_it other)
-        : ast_node_t(node_types::STATEMENTS),
-          seq(std::move(static_pointer_cast<ast_statements_t>(*other)->seq))
+    explicit ast_statements_t(const allocator_type &alloc = {})
+        : ast_node_t(node_types::STATEMENTS), seq(alloc)
     {}
-    ast_statements_t(node_it expr, node_it other)
+    ast_statements_t(node_it other, const allocator_type &alloc = {})
         : ast_node_t(node_types::STATEMENTS),
-          seq(*other ? std::move(
-                           static_pointer_cast<ast_statements_t>(*other)->seq)
-                     : deque_t())
-    {
-        if (*expr)
-            seq.emplace_front(expr);
-    }
+          seq(std::move(static_pointer_cast<ast_statements_t>(*other)->seq),
+              alloc)
+    {}
 
     virtual ~ast_statements_t() = default;
 
-    ipcl_val process_sequency(symbol_table_t &st) const
+    // Step pc runs the statements from pc on, dropping the value of the
+    // previous one. Returns true once the value of the last statement is
+    // left on the value stack.
+    bool step_sequency(ast_machine_t &m, std::size_t pc) const
     {
-        ipcl_val res{};
-        for (auto &&p : seq)
+        if (pc == 0)
         {
-            res = (*p)->Iprocess(st);
+            ++epoch;
+            if (seq.empty())
+            {
+                m.push({});
+                return true;
+            }
         }
-        return res;
+        for (; pc < seq.size(); ++pc)
+        {
+            if (pc > 0)
+                m.pop();
+            if (std::size_t n = m.fork(*this, pc)) [[unlikely]]
+            {
+                pc += n - 1;
+                continue;
+            }
+            if (!m.call(seq[pc], pc + 1))
+                return false;
+        }
+        return true;
     }
 };
 
 struct ast_scope_t final : public ast_statements_t {
-    ast_scope_t(node_it stmts) : ast_statements_t(stmts) {}
+    std::size_t offset; // in the source
+
+    ast_scope_t(node_it stmts, std::size_t offsett,
+                const allocator_type &alloc = {})
+        : ast_statements_t(stmts, alloc), offset(offsett)
+    {}
+    ast_scope_t(node_it stmts, const allocator_type &alloc = {})
+        : ast_scope_t(stmts, 0, alloc)
+    {}
 
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    void Istep(ast_machine_t &m, std::size_t pc) const override
     {
-        st.emplace_scope();
-        auto res = process_sequency(st);
-        st.pop_scope();
-        return res;
+        if (pc == 0)
+        {
+            m.checkpoint(offset);
+            m.st().emplace_scope();
+        }
+        if (step_sequency(m, pc))
+        {
+            m.st().pop_scope();
+            m.leave();
+        }
     }
 };
 
@@ -452,11 +1088,14 @@ struct ast_if_t : public ast_node_t {
     node_it condition;
     node_it body;
 
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    void Istep(ast_machine_t &m, std::size_t pc) const override
     {
-        if (std::visit(ast_cond_visitor{}, (*condition)->Iprocess(st)))
-            return (*body)->Iprocess(st);
-        return {};
+        if (pc == 0 && !m.call(condition, 1))
+            return;
+        if (std::visit(ast_cond_visitor{}, m.pop()))
+            m.tail(body);
+        else
+            m.ret({});
     }
     ast_if_t(node_it cond, node_it bod, node_types n_t = node_types::IF)
         : ast_node_t(n_t), condition(cond), body(bod)
@@ -467,11 +1106,14 @@ struct ast_if_t : public ast_node_t {
 struct ast_ifelse_t final : public ast_if_t {
     node_it else_body;
 
-    ipcl_val Iprocess(symbol_table_t &st) const override
+    void Istep(ast_machine_t &m, std::size_t pc) const override
     {
-        if (std::visit(ast_cond_visitor{}, (*condition)->Iprocess(st)))
-            return (*body)->Iprocess(st);
-        return (*else_body)->Iprocess(st);
+        if (pc == 0 && !m.call(condition, 1))
+            return;
+        if (std::visit(ast_cond_visitor{}, m.pop()))
+            m.tail(body);
+        else
+            m.tail(else_body);
     }
     ast_ifelse_t(node_it ifst, node_it else_bod)
         : ast_if_t(static_pointer_cast<ast_if_t>(*ifst)->condition,
@@ -484,51 +1126,855 @@ struct ast_ifelse_t final : public ast_if_t {
 struct ast_while_t final : public ast_node_t {
     node_it condition;
     node_it body;
+    std::size_t offset; // in the source
+    mutable unsigned long epoch = 0;
+    // Optimized form of the loop, set by another thread while the loop may
+    // be running. The loop goes on as the form from its next back edge.
+    mutable std::atomic<const ast_node_t *> tier{nullptr};
+
+    // Step 1 tests the condition, step 2 keeps the value of the body that
+    // was just run. The value of the last run of the body is the loop's
+    // value.
+    void Istep(ast_machine_t &m, std::size_t pc) const override
+    {
+        if (pc == 0)
+        {
+            ++epoch;
+            m.push({});
+        }
+        for (;; pc = 2)
+        {
+            if (pc == 2)
+            {
+                m.back_edge(offset, 2);
+                ipcl_val res = m.pop();
+                m.top() = std::move(res);
+                auto *form = tier.load(std::memory_order_acquire);
+                if (form) [[unlikely]]
+                {
+                    m.pop();
+                    return m.tail(*form);
+                }
+            }
+            if (pc != 1 && !m.call(condition, 1))
+                return;
+            if (!std::visit(ast_cond_visitor{}, m.pop()))
+            {
+                m.leave();
+                return;
+            }
+            if (!m.call(body, 2))
+                return;
+        }
+    }
+    ast_while_t(node_it cond, node_it bod, std::size_t offsett = 0)
+        : ast_node_t(node_types::WHILE), condition(cond), body(bod),
+          offset(offsett)
+    {}
+};
 
-    ipcl_val Iprocess(symbol_table_t &st) const override
+inline void ast_machine_t::check_budget(std::size_t offset)
+{
+    if (auto limit = budget_->check(st_.size())) [[unlikely]]
+        throw ExceptsPCL::budget_error(*limit + " exceeded",
+                                       loop_offset(offset));
+}
+
+inline std::size_t ast_machine_t::loop_offset(std::size_t offset) const
+{
+    for (auto it = frames_.rbegin(); it != frames_.rend(); ++it)
+        if (it->node->nt == node_types::WHILE)
+            return static_cast<const ast_while_t *>(it->node)->offset;
+    return offset;
+}
+
+// Number of iterations of a loop whose induction variable goes from iv0 by
+// step while iv rel bnd, or nullopt if it would never reach the bound
+// without wrapping around.
+inline std::optional<std::uint64_t> trip_count(ast_bin_ops rel, int step,
+                                               int iv0, int bnd)
+{
+    std::int64_t from = iv0, to = bnd, c = step, trips = 0;
+    switch (rel)
     {
-        ipcl_val res;
-        while (std::visit(ast_cond_visitor{}, (*condition)->Iprocess(st)))
-            res = (*body)->Iprocess(st);
-        return res;
+    case ast_bin_ops::LESS:
+        if (from >= to)
+            return 0;
+        if (c < 0)
+            return std::nullopt;
+        trips = (to - from + c - 1) / c;
+        break;
+    case ast_bin_ops::LESSEQ:
+        if (from > to)
+            return 0;
+        if (c < 0)
+            return std::nullopt;
+        trips = (to - from) / c + 1;
+        break;
+    case ast_bin_ops::GREATER:
+        if (from <= to)
+            return 0;
+        if (c > 0)
+            return std::nullopt;
+        trips = (from - to - c - 1) / -c;
+        break;
+    case ast_bin_ops::GREATEREQ:
+        if (from < to)
+            return 0;
+        if (c > 0)
+            return std::nullopt;
+        trips = (from - to) / -c + 1;
+        break;
+    case ast_bin_ops::NOTEQUAL:
+        if ((to - from) % c != 0 || (to - from) / c < 0)
+            return std::nullopt;
+        trips = (to - from) / c;
+        break;
+    default:
+        return std::nullopt;
+    }
+    std::int64_t last = from + trips * c;
+    if (last < std::numeric_limits<int>::min() ||
+        last > std::numeric_limits<int>::max())
+        return std::nullopt;
+    return trips;
+}
+
+// Loop whose body is a sequence of affine assignments and whose condition
+// compares an induction variable with a loop invariant bound. All its
+// iterations are applied at once as a power of the body's affine map; the
+// original loop runs instead when the trip count can not be found.
+struct ast_closed_loop_t final : public ast_node_t {
+    struct var_t {
+        std::string_view name;
+        bool temp; // written before it is read in the body
+    };
+
+    node_it loop;
+    node_it bound;
+    ast_bin_ops rel; // induction variable rel bound
+    std::size_t iv;
+    int step;
+    bool scoped_body;
+    std::vector<var_t> vars;
+    affine_map_t body;
+
+    void Istep(ast_machine_t &m, std::size_t pc) const override
+    {
+        if (pc == 0 && !m.call(bound, 1))
+            return;
+        if (apply(m.st(), std::get<int>(m.pop())))
+            m.ret({});
+        else
+            m.tail(loop);
+    }
+
+    // Applies all iterations at once. Returns false if the loop has to run.
+    bool apply(symbol_table_t &st, int bnd) const
+    {
+        auto iv_it = st.find(vars[iv].name);
+        if (iv_it == st.end())
+            return false;
+        auto trips = trip_count(rel, step, iv_it->second, bnd);
+        if (!trips)
+            return false;
+        if (*trips == 0)
+            return true;
+
+        affine_map_t::vector_t x(vars.size() + 1);
+        std::vector<IIterator> its(vars.size(), st.end());
+        x.back() = 1;
+        for (std::size_t i = 0; i < vars.size(); ++i)
+        {
+            its[i] = st.find(vars[i].name);
+            if (its[i] == st.end())
+            {
+                if (!vars[i].temp)
+                    return false;
+                if (!scoped_body)
+                    its[i] = st.add_name(vars[i].name);
+                continue;
+            }
+            x[i] = static_cast<std::uint32_t>(its[i]->second);
+        }
+        x = body.pow(*trips).apply(x);
+        for (std::size_t i = 0; i < vars.size(); ++i)
+            if (its[i] != st.end())
+                its[i]->second = static_cast<int>(x[i]);
+        return true;
+    }
+
+    ast_closed_loop_t(node_it loopp, node_it boundd, ast_bin_ops rell,
+                      std::size_t ivv, int stepp, bool scoped_bodyy,
+                      std::vector<var_t> varss, affine_map_t bodyy)
+        : ast_node_t(node_types::CLOSED_LOOP), loop(loopp), bound(boundd),
+          rel(rell), iv(ivv), step(stepp), scoped_body(scoped_bodyy),
+          vars(std::move(varss)), body(std::move(bodyy))
+    {}
+};
+
+// Running value of the product of an induction variable and a loop
+// invariant coefficient, kept up to date by the steps of the variable
+// instead of being computed again. It is valid while epoch matches the
+// epoch of the loop.
+struct ast_reduction_slot_t final {
+    const unsigned long *owner_epoch;
+    mutable unsigned long epoch = 0;
+    mutable int val = 0;
+    mutable int coef = 0;
+};
+
+inline int add_wrapping(int lhs, int rhs)
+{
+    return static_cast<int>(static_cast<unsigned>(lhs) +
+                            static_cast<unsigned>(rhs));
+}
+
+// Assignment x = x + step in one node, which also steps the running values
+// of the products of x. The children are the assignment's, kept for the
+// passes and the dumps.
+struct ast_induction_t final : public ast_expr_t {
+    node_it lhs, rhs;
+    std::string_view name;
+    int step;
+    std::size_t offset; // in the source
+    std::vector<std::shared_ptr<ast_reduction_slot_t>> slots;
+
+    void Istep(ast_machine_t &m, std::size_t) const override
+    {
+        auto it = m.st().find(name);
+        if (it == m.st().end()) [[unlikely]]
+            m.fail("Variable " + std::string{name} +
+                   " is read before it is assigned");
+        int val = it->second = add_wrapping(it->second, step);
+        for (auto &&slot : slots)
+            if (slot->epoch == *slot->owner_epoch)
+                slot->val = add_wrapping(
+                    slot->val, static_cast<int>(static_cast<unsigned>(step) *
+                                                slot->coef));
+        m.ret(val);
+    }
+    ast_induction_t(node_it lhss, node_it rhss, int stepp,
+                    std::size_t offsett)
+        : ast_expr_t(node_types::INDUCTION), lhs(lhss), rhs(rhss),
+          name(static_cast<const ast_lval_t &>(**lhss).name), step(stepp),
+          offset(offsett)
+    {}
+};
+
+// Product of an induction variable and a loop invariant coefficient. It is
+// computed on its first use after the loop is entered, the steps of the
+// variable keep it up to date from then on.
+struct ast_reduced_expr_t final : public ast_expr_t {
+    node_it expr;
+    node_it coef;
+    std::shared_ptr<ast_reduction_slot_t> slot;
+
+    void Istep(ast_machine_t &m, std::size_t pc) const override
+    {
+        if (pc == 0 && slot->epoch == *slot->owner_epoch)
+        {
+            m.ret(slot->val);
+            return;
+        }
+        if (pc == 0 && !m.call(expr, 1))
+            return;
+        if (pc <= 1 && !m.call(coef, 2))
+            return;
+        slot->coef = std::get<int>(m.pop());
+        slot->val = std::get<int>(m.top());
+        slot->epoch = *slot->owner_epoch;
+        m.leave();
+    }
+    ast_reduced_expr_t(node_it exprr, node_it coeff,
+                       std::shared_ptr<ast_reduction_slot_t> slott)
+        : ast_expr_t(node_types::REDUCED), expr(exprr), coef(coeff),
+          slot(std::move(slott))
+    {}
+};
+
+// Loop whose condition compares an induction variable with a loop invariant
+// bound and whose body ends with the only step of the variable. While the
+// trip count is at least factor, the body runs factor times for every test
+// of the bound. The loop itself runs the remaining iterations, and all of
+// them in a run with limits, so that a limit stops it where it would.
+struct ast_unrolled_loop_t final : public ast_node_t {
+    node_it loop;
+    node_it bound;
+    ast_bin_ops rel; // induction variable rel bound
+    std::string_view iv;
+    int step;
+    std::size_t factor;
+
+    // Step 1 tests the bound, steps 2 to factor + 1 follow the copies of the
+    // body and step factor + 2 evaluates the bound again.
+    void Istep(ast_machine_t &m, std::size_t pc) const override
+    {
+        auto &whilest = static_cast<const ast_while_t &>(**loop);
+        if (pc == 0)
+        {
+            if (m.limited())
+            {
+                m.tail(loop);
+                return;
+            }
+            ++whilest.epoch;
+            pc = factor + 2;
+        }
+        for (;; pc = factor + 2)
+        {
+            if (pc == factor + 2 && !m.call(bound, 1))
+                return;
+            if (pc == factor + 2 || pc == 1)
+            {
+                if (!unrolls(m.st(), std::get<int>(m.pop())))
+                {
+                    m.tail(loop);
+                    return;
+                }
+                pc = 1;
+            }
+            else
+                m.pop();
+            for (; pc <= factor; ++pc)
+            {
+                if (!m.call(whilest.body, pc + 1))
+                    return;
+                m.pop();
+            }
+            m.back_edge(whilest.offset, factor + 2);
+        }
+    }
+
+    // Whether the next factor iterations all run.
+    bool unrolls(symbol_table_t &st, int bnd) const
+    {
+        auto it = st.find(iv);
+        if (it == st.end())
+            return false;
+        auto trips = trip_count(rel, step, it->second, bnd);
+        return trips && *trips >= factor;
+    }
+
+    ast_unrolled_loop_t(node_it loopp, node_it boundd, ast_bin_ops rell,
+                        std::string_view ivv, int stepp, std::size_t factorr)
+        : ast_node_t(node_types::UNROLLED_LOOP), loop(loopp), bound(boundd),
+          rel(rell), iv(ivv), step(stepp), factor(factorr)
+    {}
+};
+
+// Assignment to a variable of a function.
+struct ast_local_assign_t final : public ast_expr_t {
+    node_it lhs, rhs;
+    std::size_t slot;
+
+    void Istep(ast_machine_t &m, std::size_t pc) const override
+    {
+        if (pc == 0 && !m.call(rhs, 1))
+            return;
+        m.local(slot) = std::get<int>(m.top());
+        m.leave();
+    }
+    ast_local_assign_t(node_it lhss, node_it rhss)
+        : ast_expr_t(node_types::LOCAL_ASSIGN), lhs(lhss), rhs(rhss),
+          slot(static_cast<const ast_local_t &>(**lhss).slot)
+    {}
+};
+
+// Function of the program. It sees its parameters and the variables it
+// assigns, which take the first and the following slots of its frame, and
+// returns the value of a return statement or else of its body. A pure
+// function neither prints nor reads input and only calls pure functions:
+// it can be memoized on its arguments.
+struct ast_func_t final : public ast_node_t {
+    struct args_hash_t final {
+        std::size_t operator()(const std::pmr::vector<int> &args) const
+        {
+            std::size_t h = args.size();
+            for (int arg : args)
+                h = (h ^ static_cast<unsigned>(arg)) * 0x100000001b3;
+            return h;
+        }
+    };
+    using memo_t =
+        std::pmr::unordered_map<std::pmr::vector<int>, int, args_hash_t>;
+    // Results kept at most, later calls are computed every time.
+    static constexpr std::size_t memo_capacity = 1 << 20;
+
+    std::string name;
+    std::size_t params;
+    std::size_t slots;
+    node_it body;
+    bool pure = false;
+    mutable std::optional<memo_t> memo;
+
+    ast_func_t(std::string_view namee, std::size_t paramss)
+        : ast_node_t(node_types::FUNCTION), name(namee), params(paramss),
+          slots(paramss)
+    {}
+};
+
+struct ast_call_t final : public ast_expr_t {
+    const ast_func_t *fn;
+    std::vector<node_it> args;
+    std::size_t offset; // in the source
+    bool tail = false;  // the value of a return statement
+
+    // Steps up to the number of arguments evaluate them, the next one
+    // enters the function and the last one returns the value of its body.
+    void Istep(ast_machine_t &m, std::size_t pc) const override
+    {
+        for (; pc < args.size(); ++pc)
+            if (!m.call(args[pc], pc + 1))
+                return;
+        if (pc == args.size())
+            m.enter(*fn, args.size(), pc + 1, tail, offset);
+        else
+            m.exit(std::get<int>(m.pop()));
+    }
+    ast_call_t(const ast_func_t *fnn, std::vector<node_it> argss,
+               std::size_t offsett)
+        : ast_expr_t(node_types::CALL), fn(fnn), args(std::move(argss)),
+          offset(offsett)
+    {}
+};
+
+struct ast_return_t final : public ast_node_t {
+    node_it expr;
+
+    void Istep(ast_machine_t &m, std::size_t pc) const override
+    {
+        if (pc == 0 && !m.call(expr, 1))
+            return;
+        m.exit(std::get<int>(m.pop()));
     }
-    ast_while_t(node_it cond, node_it bod)
-        : ast_node_t(node_types::WHILE), condition(cond), body(bod)
+    ast_return_t(node_it exprr) : ast_node_t(node_types::RETURN), expr(exprr)
     {}
 };
 
+inline void ast_machine_t::enter(const ast_func_t &fn, std::size_t n,
+                                 std::size_t pc, bool tail,
+                                 std::size_t offset)
+{
+    checkpoint(offset);
+    std::size_t values = values_.size() - n;
+    std::pmr::vector<int> args(locals_.get_allocator());
+    if (fn.memo)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            args.push_back(std::get<int>(values_[values + i]));
+        if (auto it = fn.memo->find(args); it != fn.memo->end())
+        {
+            values_.resize(values);
+            ret(it->second);
+            return;
+        }
+    }
+
+    std::size_t base = locals_.size();
+    frame_t caller{frames_.back().node, pc};
+    // The arguments of a memoized call are its key, so it is not replaced.
+    if (tail && !calls_.empty() && !fn.memo && !calls_.back().fn->memo)
+    {
+        call_t &running = calls_.back();
+        base = running.base;
+        running.fn = &fn;
+        frames_.resize(running.frame);
+        frames_.push_back(caller);
+    }
+    else
+    {
+        frames_.back() = caller;
+        calls_.push_back({&fn, frames_.size() - 1, values, base,
+                          std::move(args)});
+    }
+    base_ = base;
+    locals_.resize(base);
+    locals_.resize(base + fn.slots);
+    for (std::size_t i = 0; i < n; ++i)
+        locals_[base + i] = std::get<int>(values_[values + i]);
+    values_.resize(calls_.back().values);
+    frames_.push_back({fn.body->get(), 0});
+}
+
+inline void ast_machine_t::exit(int val)
+{
+    call_t &call = calls_.back();
+    if (call.fn->memo && call.fn->memo->size() < ast_func_t::memo_capacity)
+        call.fn->memo->emplace(std::move(call.args), val);
+    frames_.resize(call.frame + 1);
+    values_.resize(call.values);
+    locals_.resize(call.base);
+    calls_.pop_back();
+    base_ = calls_.empty() ? 0 : calls_.back().base;
+    ret(val);
+}
+
+inline void ast_machine_t::fail(const std::string &what) const
+{
+    for (auto it = frames_.rbegin(); it != frames_.rend(); ++it)
+    {
+        const ast_node_t &node = *it->node;
+        switch (node.nt)
+        {
+        case node_types::WHILE:
+            throw ExceptsPCL::run_error(
+                what, static_cast<const ast_while_t &>(node).offset);
+        case node_types::CALL:
+            throw ExceptsPCL::run_error(
+                what, static_cast<const ast_call_t &>(node).offset);
+        case node_types::INDUCTION:
+            throw ExceptsPCL::run_error(
+                what, static_cast<const ast_induction_t &>(node).offset);
+        case node_types::BIN_OP:
+            if (static_cast<const ast_bin_op_t &>(node).op ==
+                ast_bin_ops::ASSIGNMENT)
+                throw ExceptsPCL::run_error(
+                    what, static_cast<const ast_assign_op &>(node).offset);
+            break;
+        case node_types::UN_OP:
+            if (static_cast<const ast_un_op_t &>(node).op == ast_un_ops::PRINT)
+                throw ExceptsPCL::run_error(
+                    what, static_cast<const ast_print_op &>(node).offset);
+            break;
+        default:
+            break;
+        }
+    }
+    throw ExceptsPCL::run_error(what);
+}
+
+inline void ast_machine_t::trace_write(const ipcl_val &val)
+{
+    // Anything but a number fails to print.
+    auto *num = std::get_if<int>(&val);
+    if (!num)
+        return;
+    if (!trace_->replay)
+        return trace_->writes.push_back(*num);
+    if (trace_->written == trace_->writes.size())
+        fail("Output past the end of the trace");
+    if (int recorded = trace_->writes[trace_->written++]; *num != recorded)
+        fail("Printed " + std::to_string(*num) + " where the trace has " +
+             std::to_string(recorded));
+}
+
+inline std::size_t ast_machine_t::fork_tasks(const ast_statements_t &stmts,
+                                             std::size_t first)
+{
+    // Limits, snapshots and traces take the steps of the run in its order.
+    if (budget_ || snapshots_ || trace_ || stmts.tasks.empty() ||
+        !stmts.tasks[first])
+        return 0;
+    using names_t = std::unordered_set<std::string_view>;
+    auto touches = [](const task_t &task, std::string_view name) {
+        return task.reads.contains(name) || task.writes.contains(name);
+    };
+    // A statement is independent of the others if it changes no variable
+    // they touch and touches none they change. Only the variables of a
+    // scope that are there before it are changed for the others.
+    std::vector<const task_t *> group;
+    std::vector<names_t> changes;
+    for (std::size_t i = first; i < stmts.tasks.size() && stmts.tasks[i]; ++i)
+    {
+        const task_t &task = *stmts.tasks[i];
+        names_t changed;
+        for (auto &&name : task.writes)
+            if (!task.scope || st_.contains(name))
+                changed.insert(name);
+        bool independent = true;
+        for (std::size_t j = 0; j < group.size() && independent; ++j)
+        {
+            for (auto &&name : changed)
+                independent &= !touches(*group[j], name);
+            for (auto &&name : changes[j])
+                independent &= !touches(task, name);
+        }
+        if (!independent)
+            break;
+        group.push_back(&task);
+        changes.push_back(std::move(changed));
+    }
+    if (group.size() < 2)
+        return 0;
+
+    struct run_t {
+        symbol_table_t st;
+        symbol_table_t::counters_t seeded;
+        std::ostringstream out;
+        std::optional<run_counters_t> counters;
+        ipcl_val val;
+        std::exception_ptr error;
+    };
+    std::vector<run_t> runs;
+    runs.reserve(group.size());
+    for (std::size_t i = 0; i < group.size(); ++i)
+    {
+        run_t &run = runs.emplace_back(symbol_table_t{st_.resource()});
+        run.st.emplace_scope();
+        for (auto *names : {&group[i]->reads, &group[i]->writes})
+            for (auto &&name : *names)
+                if (auto it = st_.find(name); it != st_.end())
+                    run.st.add_name(name)->second = it->second;
+        run.seeded = run.st.counters();
+        if (counters_)
+            run.counters.emplace();
+    }
+    std::atomic<std::size_t> next = 0;
+    auto work = [&] {
+        for (std::size_t i; (i = next++) < runs.size();)
+        {
+            run_t &run = runs[i];
+            try
+            {
+                ast_machine_t m{run.st, run.counters ? &*run.counters
+                                                     : nullptr};
+                m.out_ = &run.out;
+                run.val = m.run(**stmts.seq[first + i]);
+            }
+            catch (...)
+            {
+                run.error = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    std::size_t nthreads = std::min<std::size_t>(tasks_->threads, runs.size());
+    for (std::size_t i = 1; i < nthreads; ++i)
+        threads.emplace_back(work);
+    work();
+    for (auto &&thread : threads)
+        thread.join();
+
+    // What follows a failed statement never ran.
+    for (std::size_t i = 0; i < runs.size(); ++i)
+    {
+        run_t &run = runs[i];
+        *out_ << run.out.str() << std::flush;
+        if (run.error)
+            std::rethrow_exception(run.error);
+        for (auto &&name : changes[i])
+            if (auto it = run.st.find(name); it != run.st.end())
+                st_.add_name(name)->second = it->second;
+        if (counters_)
+        {
+            for (std::size_t nt = 0; nt < node_types_count; ++nt)
+                counters_->executed[nt] += run.counters->executed[nt];
+            counters_->reads += run.counters->reads;
+            counters_->writes += run.counters->writes;
+        }
+        st_.count(run.st.counters(), run.seeded);
+    }
+    // Iterators point into the variables of the statement's own run.
+    int *val = std::get_if<int>(&runs.back().val);
+    push(val ? *val : 0);
+    return runs.size();
+}
+
 class IIast_t {
 public:
     virtual const ast_node_t &root() const = 0;
-    virtual int execute(symbol_table_t &) const = 0;
+    // Functions of the program, in the order they are defined.
+    virtual const std::vector<ast_node_t::node_it> &functions() const = 0;
+    // Whether the node is a child of several nodes.
+    virtual bool shared(const ast_node_t &node) const = 0;
+    virtual int execute(symbol_table_t &, run_counters_t *counters = nullptr,
+                        run_budget_t *budget = nullptr,
+                        run_snapshots_t *snapshots = nullptr,
+                        run_tasks_t *tasks = nullptr,
+                        run_trace_t *trace = nullptr) const = 0;
     virtual ~IIast_t() = default;
 };
 
 class ast_t final : public IIast_t {
 public:
-    using node_it = std::list<std::shared_ptr<ast_node_t>>::iterator;
+    using node_it = std::pmr::list<std::shared_ptr<ast_node_t>>::iterator;
     using node_ptr = typename std::shared_ptr<ast_node_t>;
 
 private:
+    // Identity of a shareable node: its type, operator or value, name and
+    // children, which are shared nodes themselves. An operator that may fail
+    // the run is located, so it is shared only at the same place.
+    struct share_key_t final {
+        node_types nt;
+        int op = 0;
+        const ast_node_t *lhs = nullptr, *rhs = nullptr;
+        std::string_view name;
+        std::size_t offset = 0;
+
+        bool operator==(const share_key_t &) const = default;
+    };
+    struct key_hash_t final {
+        std::size_t operator()(const share_key_t &key) const
+        {
+            std::size_t h = std::hash<std::string_view>{}(key.name);
+            for (std::size_t v :
+                 {static_cast<std::size_t>(key.nt),
+                  static_cast<std::size_t>(key.op),
+                  reinterpret_cast<std::size_t>(key.lhs),
+                  reinterpret_cast<std::size_t>(key.rhs), key.offset})
+                h = (h ^ v) * 0x100000001b3;
+            return h;
+        }
+    };
+
     node_it root_;
-    std::list<node_ptr> nodes_;
+    std::vector<node_it> functions_;
+    // Nodes and the tables that share them take their memory from one
+    // resource.
+    std::pmr::memory_resource *mr_;
+    std::pmr::list<node_ptr> nodes_;
+    std::array<std::size_t, node_types_count> made_{};
+    std::pmr::unordered_map<share_key_t, node_it, key_hash_t> shared_;
+    // Times every shared node was handed out.
+    std::pmr::unordered_map<const ast_node_t *, std::size_t> uses_;
+
+    template <typename T>
+    static constexpr bool shareable_v =
+        std::is_same_v<T, ast_num_t> || std::is_same_v<T, ast_var_t> ||
+        std::is_base_of_v<ast_bin_op_t, T> || std::is_base_of_v<ast_un_op_t, T>;
+
+    // Key of a node without side effects whose children are shared.
+    std::optional<share_key_t> key(const ast_node_t &node) const
+    {
+        auto is_shared = [this](node_it child) {
+            return uses_.contains(child->get());
+        };
+        switch (node.nt)
+        {
+        case node_types::NUMBER:
+            return share_key_t{node.nt,
+                               static_cast<const ast_num_t &>(node).val};
+        case node_types::VARIABLE:
+            return share_key_t{node.nt, 0, nullptr, nullptr,
+                               static_cast<const ast_var_t &>(node).name};
+        case node_types::BIN_OP:
+        {
+            auto &bin = static_cast<const ast_bin_op_t &>(node);
+            if (bin.op == ast_bin_ops::ASSIGNMENT || !is_shared(bin.lhs) ||
+                !is_shared(bin.rhs))
+                return std::nullopt;
+            share_key_t res{node.nt, static_cast<int>(bin.op),
+                            bin.lhs->get(), bin.rhs->get()};
+            auto *arith = as_arith(node);
+            if (arith && (arith->zero_check || arith->overflow_check))
+                res.offset = arith->offset;
+            return res;
+        }
+        case node_types::UN_OP:
+        {
+            auto &un = static_cast<const ast_un_op_t &>(node);
+            if (un.op == ast_un_ops::PRINT || !is_shared(un.rhs))
+                return std::nullopt;
+            share_key_t res{node.nt, static_cast<int>(un.op), nullptr,
+                            un.rhs->get()};
+            if (un.op == ast_un_ops::MINUS)
+            {
+                auto &minus = static_cast<const ast_unminus_op &>(un);
+                if (minus.overflow_check)
+                    res.offset = minus.offset;
+            }
+            return res;
+        }
+        default:
+            return std::nullopt;
+        }
+    }
+
+    template <typename T, class... Args> node_it add(Args &&... args)
+    {
+        return add(std::allocate_shared<T>(
+            std::pmr::polymorphic_allocator<T>(mr_),
+            std::forward<Args>(args)...));
+    }
+    node_it add(node_ptr node)
+    {
+        nodes_.push_back(std::move(node));
+        ++made_[static_cast<std::size_t>(nodes_.back()->nt)];
+        return std::prev(nodes_.end());
+    }
 
 public:
-    ast_t() noexcept {}
+    explicit ast_t(
+        std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+        : mr_(mr), nodes_(mr), shared_(mr), uses_(mr)
+    {}
 
     const ast_node_t &root() const override { return **root_; }
-    int execute(symbol_table_t &st) const override
+    node_it root_it() const { return root_; }
+    const std::vector<node_it> &functions() const override
     {
-        (*root_)->Iprocess(st);
+        return functions_;
+    }
+    void add_function(node_it fn) { functions_.push_back(fn); }
+    void remove_function() { functions_.pop_back(); }
+    std::size_t size() const { return nodes_.size(); }
+    int execute(symbol_table_t &st, run_counters_t *counters = nullptr,
+                run_budget_t *budget = nullptr,
+                run_snapshots_t *snapshots = nullptr,
+                run_tasks_t *tasks = nullptr,
+                run_trace_t *trace = nullptr) const override
+    {
+        (*root_)->Iprocess(st, counters, budget, snapshots, tasks, trace);
         return 0;
     }
 
     void set_root(node_it root) { root_ = root; }
 
+    // Expressions without side effects are hash-consed: an expression made
+    // again is the node made the first time, so repeated subtrees of a
+    // program take the memory of one. Nodes are looked up only while the
+    // tree is built, the optimizer may then rewrite the children of a node
+    // that has a single parent.
     template <typename T, class... Args> node_it make_node(Args &&... args)
     {
-        nodes_.push_back(std::make_shared<T>(std::forward<Args>(args)...));
-        return std::prev(nodes_.end());
+        if constexpr (shareable_v<T>)
+        {
+            T node(std::forward<Args>(args)...);
+            auto node_key = key(node);
+            if (!node_key)
+                return add<T>(std::move(node));
+            if (auto it = shared_.find(*node_key); it != shared_.end())
+            {
+                ++uses_[it->second->get()];
+                return it->second;
+            }
+            node_it res = add<T>(std::move(node));
+            shared_.emplace(*key(**res), res);
+            uses_.emplace(res->get(), 1);
+            return res;
+        }
+        else
+            return add<T>(std::forward<Args>(args)...);
+    }
+
+    // Whether node is a child of several nodes, so that rewriting its
+    // children would change all of them.
+    bool shared(const ast_node_t &node) const override
+    {
+        auto it = uses_.find(&node);
+        return it != uses_.end() && it->second > 1;
+    }
+    // Node given to one more parent by the optimizer, which is shared then.
+    node_it share(node_it node)
+    {
+        ++uses_.try_emplace(node->get(), 1).first->second;
+        return node;
+    }
+
+    // Nodes of each type made by the parser and the optimizer.
+    const std::array<std::size_t, node_types_count> &made() const
+    {
+        return made_;
+    }
+
+    // Releases the nodes made after the first size ones. No node is shared
+    // with the ones made from then on.
+    void truncate(std::size_t size)
+    {
+        shared_.clear();
+        uses_.clear();
+        nodes_.resize(size);
     }
 };
 
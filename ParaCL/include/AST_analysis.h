@@ -0,0 +1,486 @@
+#pragma once
+
+#include "AST.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace AST {
+
+using node_it = ast_node_t::node_it;
+using names_t = std::unordered_set<std::string_view>;
+
+template <typename From, typename To>
+using copy_const_t =
+    std::conditional_t<std::is_const_v<From>, std::add_const_t<To>, To>;
+
+template <typename T, typename Node> copy_const_t<Node, T> &node_cast(Node &n)
+{
+    return static_cast<copy_const_t<Node, T> &>(n);
+}
+
+// Calls f for every child edge of node. Edges are the node_it fields of the
+// parent, so assigning to one replaces the child only for this parent.
+template <typename Node, typename F> void for_each_edge(Node &node, F &&f)
+{
+    static_assert(std::is_same_v<std::remove_const_t<Node>, ast_node_t>);
+    switch (node.nt)
+    {
+    case node_types::BIN_OP:
+    {
+        auto &bin = node_cast<ast_bin_op_t>(node);
+        f(bin.lhs);
+        f(bin.rhs);
+        break;
+    }
+    case node_types::UN_OP:
+        f(node_cast<ast_un_op_t>(node).rhs);
+        break;
+    case node_types::STATEMENTS:
+        for (auto &&e : node_cast<ast_statements_t>(node).seq)
+            f(e);
+        break;
+    case node_types::IF:
+    {
+        auto &ifst = node_cast<ast_if_t>(node);
+        f(ifst.condition);
+        f(ifst.body);
+        break;
+    }
+    case node_types::IFELSE:
+    {
+        auto &ifelse = node_cast<ast_ifelse_t>(node);
+        f(ifelse.condition);
+        f(ifelse.body);
+        f(ifelse.else_body);
+        break;
+    }
+    case node_types::WHILE:
+    {
+        auto &whilest = node_cast<ast_while_t>(node);
+        f(whilest.condition);
+        f(whilest.body);
+        break;
+    }
+    case node_types::CACHED:
+        f(node_cast<ast_cached_expr_t>(node).expr);
+        break;
+    case node_types::CLOSED_LOOP:
+        f(node_cast<ast_closed_loop_t>(node).loop);
+        break;
+    case node_types::LOCAL_ASSIGN:
+    {
+        auto &assign = node_cast<ast_local_assign_t>(node);
+        f(assign.lhs);
+        f(assign.rhs);
+        break;
+    }
+    case node_types::CALL:
+        for (auto &&e : node_cast<ast_call_t>(node).args)
+            f(e);
+        break;
+    case node_types::RETURN:
+        f(node_cast<ast_return_t>(node).expr);
+        break;
+    case node_types::FUNCTION:
+        f(node_cast<ast_func_t>(node).body);
+        break;
+    case node_types::INDUCTION:
+    {
+        auto &induction = node_cast<ast_induction_t>(node);
+        f(induction.lhs);
+        f(induction.rhs);
+        break;
+    }
+    case node_types::REDUCED:
+    {
+        auto &reduced = node_cast<ast_reduced_expr_t>(node);
+        f(reduced.expr);
+        f(reduced.coef);
+        break;
+    }
+    case node_types::UNROLLED_LOOP:
+        f(node_cast<ast_unrolled_loop_t>(node).loop);
+        break;
+    case node_types::NUMBER:
+    case node_types::VARIABLE:
+    case node_types::LOCAL:
+    case node_types::LVAL:
+    case node_types::WRITE:
+    case node_types::EMPTY:
+        break;
+    default:
+        assert(0 && "Unreachable.");
+        break;
+    }
+}
+
+// Pre-order walk. The visitor returns false to skip the children of a node.
+template <typename Node, typename F> void walk(Node &node, F &&f)
+{
+    if (!f(node))
+        return;
+    for_each_edge(node, [&f](auto &&edge) {
+        walk(static_cast<Node &>(**edge), f);
+    });
+}
+
+inline void collect_writes(const ast_node_t &node, names_t &names)
+{
+    walk(node, [&names](const ast_node_t &n) {
+        if (n.nt == node_types::LVAL)
+            names.insert(static_cast<const ast_lval_t &>(n).name);
+        return true;
+    });
+}
+
+inline void collect_reads(const ast_node_t &node, names_t &names)
+{
+    walk(node, [&names](const ast_node_t &n) {
+        if (n.nt == node_types::VARIABLE)
+            names.insert(static_cast<const ast_var_t &>(n).name);
+        return true;
+    });
+}
+
+inline bool intersects(const names_t &lhs, const names_t &rhs)
+{
+    const names_t &small = lhs.size() < rhs.size() ? lhs : rhs;
+    const names_t &big = lhs.size() < rhs.size() ? rhs : lhs;
+    for (auto &&name : small)
+        if (big.contains(name))
+            return true;
+    return false;
+}
+
+// Expression without side effects: it neither reads input, prints nor
+// assigns, so evaluating it again yields the same value while the variables
+// it reads are unchanged.
+inline bool is_pure(const ast_node_t &node)
+{
+    bool pure = true;
+    walk(node, [&pure](const ast_node_t &n) {
+        switch (n.nt)
+        {
+        case node_types::NUMBER:
+        case node_types::VARIABLE:
+        case node_types::CACHED:
+            break;
+        case node_types::BIN_OP:
+            pure &= static_cast<const ast_bin_op_t &>(n).op !=
+                    ast_bin_ops::ASSIGNMENT;
+            break;
+        case node_types::UN_OP:
+            pure &=
+                static_cast<const ast_un_op_t &>(n).op != ast_un_ops::PRINT;
+            break;
+        default:
+            pure = false;
+            break;
+        }
+        return pure;
+    });
+    return pure;
+}
+
+// The names a subtree reads and writes and whether it is pure, as
+// collect_reads, collect_writes and is_pure find them. They are found
+// bottom-up and kept for the sequences, branches and loops, so asking about
+// a node and then about the nodes that enclose it walks every node once. The
+// summary of another node lasts until the next question.
+// Later changes of the tree are not seen: a pass that moves statements into
+// or out of a kept subtree forgets it and every kept node around it that
+// does not hold them both before and after.
+class summaries_t final {
+public:
+    struct summary_t {
+        names_t reads, writes;
+        bool pure = true;
+    };
+
+private:
+    std::unordered_map<const ast_node_t *, summary_t> kept_;
+    summary_t last_;
+
+    static bool is_kept(const ast_node_t &node)
+    {
+        switch (node.nt)
+        {
+        case node_types::STATEMENTS:
+        case node_types::IF:
+        case node_types::IFELSE:
+        case node_types::WHILE:
+        case node_types::CLOSED_LOOP:
+        case node_types::UNROLLED_LOOP:
+        case node_types::FUNCTION:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static void add(const ast_node_t &node, summary_t &sum)
+    {
+        switch (node.nt)
+        {
+        case node_types::NUMBER:
+        case node_types::CACHED:
+            break;
+        case node_types::VARIABLE:
+            sum.reads.insert(static_cast<const ast_var_t &>(node).name);
+            break;
+        case node_types::LVAL:
+            sum.writes.insert(static_cast<const ast_lval_t &>(node).name);
+            sum.pure = false;
+            break;
+        case node_types::BIN_OP:
+            sum.pure &= static_cast<const ast_bin_op_t &>(node).op !=
+                        ast_bin_ops::ASSIGNMENT;
+            break;
+        case node_types::UN_OP:
+            sum.pure &=
+                static_cast<const ast_un_op_t &>(node).op != ast_un_ops::PRINT;
+            break;
+        default:
+            sum.pure = false;
+            break;
+        }
+    }
+
+    // Walks the nodes of root down to the kept nodes below it, which are
+    // merged as they are.
+    summary_t summarize(const ast_node_t &root) const
+    {
+        summary_t sum;
+        std::vector<const ast_node_t *> stack{&root};
+        while (!stack.empty())
+        {
+            const ast_node_t *node = stack.back();
+            stack.pop_back();
+            if (node != &root)
+                if (auto it = kept_.find(node); it != kept_.end())
+                {
+                    auto &&inner = it->second;
+                    sum.reads.insert(inner.reads.begin(), inner.reads.end());
+                    sum.writes.insert(inner.writes.begin(), inner.writes.end());
+                    sum.pure = sum.pure && inner.pure;
+                    continue;
+                }
+            add(*node, sum);
+            for_each_edge(*node, [&stack](const node_it &e) {
+                stack.push_back(e->get());
+            });
+        }
+        return sum;
+    }
+
+public:
+    const summary_t &operator()(const ast_node_t &root)
+    {
+        if (auto it = kept_.find(&root); it != kept_.end())
+            return it->second;
+        // The kept nodes below root that are not yet known, in pre-order:
+        // the reverse order has every node after the ones below it.
+        std::vector<const ast_node_t *> order, stack{&root};
+        while (!stack.empty())
+        {
+            const ast_node_t *node = stack.back();
+            stack.pop_back();
+            if (node != &root && kept_.contains(node))
+                continue;
+            if (is_kept(*node))
+                order.push_back(node);
+            for_each_edge(*node, [&stack](const node_it &e) {
+                stack.push_back(e->get());
+            });
+        }
+        for (auto it = order.rbegin(); it != order.rend(); ++it)
+            if (!kept_.contains(*it))
+                kept_.emplace(*it, summarize(**it));
+        if (is_kept(root))
+            return kept_.find(&root)->second;
+        return last_ = summarize(root);
+    }
+
+    const names_t &reads(const ast_node_t &node) { return (*this)(node).reads; }
+    const names_t &writes(const ast_node_t &node)
+    {
+        return (*this)(node).writes;
+    }
+    bool pure(const ast_node_t &node) { return (*this)(node).pure; }
+
+    void forget(const ast_node_t &node) { kept_.erase(&node); }
+};
+
+// Operator that may fail the run: a division or remainder whose divisor is
+// not a nonzero constant, or an operator with overflow checks.
+inline bool may_trap(const ast_node_t &node)
+{
+    bool trap = false;
+    walk(node, [&trap](const ast_node_t &n) {
+        if (n.nt == node_types::UN_OP &&
+            static_cast<const ast_un_op_t &>(n).op == ast_un_ops::MINUS)
+            trap = static_cast<const ast_unminus_op &>(n).overflow_check;
+        auto *arith = as_arith(n);
+        if (!arith)
+            return !trap;
+        if (arith->overflow_check)
+            trap = true;
+        else if (arith->zero_check)
+        {
+            auto &divisor = **arith->rhs;
+            trap = divisor.nt != node_types::NUMBER ||
+                   static_cast<const ast_num_t &>(divisor).val == 0;
+        }
+        return !trap;
+    });
+    return trap;
+}
+
+// Relation that holds with its operands swapped.
+inline ast_bin_ops flip(ast_bin_ops rel)
+{
+    switch (rel)
+    {
+    case ast_bin_ops::LESS:
+        return ast_bin_ops::GREATER;
+    case ast_bin_ops::LESSEQ:
+        return ast_bin_ops::GREATEREQ;
+    case ast_bin_ops::GREATER:
+        return ast_bin_ops::LESS;
+    case ast_bin_ops::GREATEREQ:
+        return ast_bin_ops::LESSEQ;
+    default:
+        return rel;
+    }
+}
+
+// Nodes of the subtree, counted up to one more than max_size at most.
+inline std::size_t subtree_size(const ast_node_t &node,
+                                std::size_t max_size = SIZE_MAX)
+{
+    std::size_t size = 0;
+    walk(node, [&size, max_size](const ast_node_t &) {
+        return size <= max_size && ++size;
+    });
+    return size;
+}
+
+// Height of the tree, found without recursion so that it can tell whether
+// the recursive passes are safe to run on it.
+inline std::size_t depth(const ast_node_t &root)
+{
+    std::size_t res = 0;
+    std::vector<std::pair<const ast_node_t *, std::size_t>> stack{{&root, 1}};
+    while (!stack.empty())
+    {
+        auto [node, d] = stack.back();
+        stack.pop_back();
+        res = std::max(res, d);
+        for_each_edge(*node, [&stack, d](const node_it &e) {
+            stack.emplace_back(e->get(), d + 1);
+        });
+    }
+    return res;
+}
+
+// Loops that are in no other loop, found without recursion as well.
+inline std::vector<node_it> outer_loops(const ast_node_t &root)
+{
+    std::vector<node_it> loops;
+    std::vector<const ast_node_t *> stack{&root};
+    while (!stack.empty())
+    {
+        const ast_node_t *node = stack.back();
+        stack.pop_back();
+        for_each_edge(*node, [&loops, &stack](const node_it &e) {
+            if ((*e)->nt == node_types::WHILE)
+                loops.push_back(e);
+            else
+                stack.push_back(e->get());
+        });
+    }
+    return loops;
+}
+
+inline bool is_operator(const ast_node_t &node)
+{
+    return node.nt == node_types::BIN_OP || node.nt == node_types::UN_OP;
+}
+
+// Structural key of a pure expression, or nullopt if the expression is larger
+// than max_size nodes or is not pure.
+inline std::optional<std::string> expr_key(const ast_node_t &node,
+                                           std::size_t max_size = 64)
+{
+    std::string key;
+    std::size_t size = 0;
+    bool fits = true;
+    auto append = [&](const ast_node_t &n, auto &&self) -> void {
+        if (!fits || ++size > max_size)
+        {
+            fits = false;
+            return;
+        }
+        switch (n.nt)
+        {
+        case node_types::NUMBER:
+            key += '#' + std::to_string(static_cast<const ast_num_t &>(n).val);
+            break;
+        case node_types::VARIABLE:
+            key += '$';
+            key += static_cast<const ast_var_t &>(n).name;
+            break;
+        case node_types::BIN_OP:
+        {
+            auto &bin = static_cast<const ast_bin_op_t &>(n);
+            if (bin.op == ast_bin_ops::ASSIGNMENT)
+            {
+                fits = false;
+                break;
+            }
+            key += "(b";
+            key += bin.op_str();
+            key += ' ';
+            self(**bin.lhs, self);
+            key += ' ';
+            self(**bin.rhs, self);
+            key += ')';
+            break;
+        }
+        case node_types::UN_OP:
+        {
+            auto &un = static_cast<const ast_un_op_t &>(n);
+            if (un.op == ast_un_ops::PRINT)
+            {
+                fits = false;
+                break;
+            }
+            key += "(u";
+            key += un.op_str();
+            key += ' ';
+            self(**un.rhs, self);
+            key += ')';
+            break;
+        }
+        default:
+            fits = false;
+            break;
+        }
+    };
+    append(node, append);
+    if (!fits)
+        return std::nullopt;
+    return key;
+}
+
+} // namespace AST
@@ -1,10 +1,15 @@
 #pragma once
 
 #include "AST.h"
+#include "dump_format.h"
 
 #include <algorithm>
 #include <iostream>
+#include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace AST {
 
@@ -54,6 +59,46 @@ private:
         case node_types::EMPTY:
             return "empty";
             break;
+        case node_types::CACHED:
+            return "cached";
+            break;
+        case node_types::CLOSED_LOOP:
+            return "closed loop";
+            break;
+        case node_types::LOCAL:
+            return "Local\\n\\l " +
+                   static_cast<const ast_local_t &>(node).name + " \\l";
+            break;
+        case node_types::LOCAL_ASSIGN:
+            return "=";
+            break;
+        case node_types::CALL:
+            return "Call\\n\\l " +
+                   static_cast<const ast_call_t &>(node).fn->name + " \\l";
+            break;
+        case node_types::RETURN:
+            return "return";
+            break;
+        case node_types::FUNCTION:
+            return "Function\\n\\l " +
+                   static_cast<const ast_func_t &>(node).name + " \\l";
+            break;
+        case node_types::INDUCTION:
+        {
+            auto &induction = static_cast<const ast_induction_t &>(node);
+            return "Induction\\n\\l " + std::string(induction.name) +
+                   " += " + std::to_string(induction.step) + " \\l";
+            break;
+        }
+        case node_types::REDUCED:
+            return "reduced";
+            break;
+        case node_types::UNROLLED_LOOP:
+            return "unrolled loop\\n\\l x" +
+                   std::to_string(
+                       static_cast<const ast_unrolled_loop_t &>(node).factor) +
+                   " \\l";
+            break;
         default:
             assert(0 && "Unreachable.");
             break;
@@ -70,165 +115,257 @@ public:
     }
 };
 
-struct dot_edge_t final {
-    std::pair<int, int> line;
-    std::string label;
-    dot_edge_t(int src, int dst, std::string_view labell = "")
-        : line(src, dst), label(labell)
-    {}
+// Calls f(child, label) for every child of node, in the order of a
+// recursive walk.
+template <typename F> void for_each_child(const ast_node_t &node, F &&f)
+{
+    switch (node.nt)
+    {
+    case node_types::BIN_OP:
+    {
+        auto &bin = static_cast<const ast_bin_op_t &>(node);
+        f(**bin.lhs, "lhs");
+        f(**bin.rhs, "rhs");
+        break;
+    }
+    case node_types::UN_OP:
+        f(**static_cast<const ast_un_op_t &>(node).rhs, "operand");
+        break;
+    case node_types::STATEMENTS:
+    {
+        auto &seq = static_cast<const ast_statements_t &>(node).seq;
+        for (std::size_t i = 0; i < seq.size(); ++i)
+            f(**seq[i], std::to_string(i + 1));
+        break;
+    }
+    case node_types::IF:
+    case node_types::IFELSE:
+    {
+        auto &ifst = static_cast<const ast_if_t &>(node);
+        f(**ifst.condition, "cond");
+        f(**ifst.body, "body");
+        if (node.nt == node_types::IFELSE)
+            f(**static_cast<const ast_ifelse_t &>(node).else_body,
+              "else_body");
+        break;
+    }
+    case node_types::WHILE:
+    {
+        auto &whilest = static_cast<const ast_while_t &>(node);
+        f(**whilest.condition, "cond");
+        f(**whilest.body, "body");
+        break;
+    }
+    case node_types::CACHED:
+        f(**static_cast<const ast_cached_expr_t &>(node).expr, "expr");
+        break;
+    case node_types::CLOSED_LOOP:
+        f(**static_cast<const ast_closed_loop_t &>(node).loop, "loop");
+        break;
+    case node_types::LOCAL_ASSIGN:
+    {
+        auto &assign = static_cast<const ast_local_assign_t &>(node);
+        f(**assign.lhs, "lhs");
+        f(**assign.rhs, "rhs");
+        break;
+    }
+    case node_types::CALL:
+    {
+        auto &args = static_cast<const ast_call_t &>(node).args;
+        for (std::size_t i = 0; i < args.size(); ++i)
+            f(**args[i], std::to_string(i + 1));
+        break;
+    }
+    case node_types::RETURN:
+        f(**static_cast<const ast_return_t &>(node).expr, "expr");
+        break;
+    case node_types::FUNCTION:
+        f(**static_cast<const ast_func_t &>(node).body, "body");
+        break;
+    case node_types::INDUCTION:
+    {
+        auto &induction = static_cast<const ast_induction_t &>(node);
+        f(**induction.lhs, "lhs");
+        f(**induction.rhs, "rhs");
+        break;
+    }
+    case node_types::REDUCED:
+    {
+        auto &reduced = static_cast<const ast_reduced_expr_t &>(node);
+        f(**reduced.expr, "expr");
+        f(**reduced.coef, "coef");
+        break;
+    }
+    case node_types::UNROLLED_LOOP:
+        f(**static_cast<const ast_unrolled_loop_t &>(node).loop, "loop");
+        break;
+    case node_types::LOCAL:
+    case node_types::WRITE:
+    case node_types::LVAL:
+    case node_types::NUMBER:
+    case node_types::VARIABLE:
+    case node_types::EMPTY:
+        break;
+    default:
+        assert(0 && "Unreachable.");
+        break;
+    }
+}
+
+class dot_writer_t final {
+    std::ostream *os_;
+    ast_node_dumper node_dumper_;
+
+public:
+    dot_writer_t(std::ostream *os) : os_(os), node_dumper_(os) {}
+
+    void begin() const { *os_ << "digraph \"AST\"\n{\n"; }
+    void node(const ast_node_t &node, int id) const { node_dumper_(node, id); }
+    void child(int id, int child_id, std::string_view label, std::size_t) const
+    {
+        *os_ << "\t" << id << " -> " << child_id << " [style=solid label=\""
+             << label << "\"]\n";
+    }
+    void node_end(std::size_t) const {}
+    void end() const { *os_ << "}\n"; }
 };
 
-class dot_ast_t final {
-    const IIast_t *ast_;
-    std::unordered_map<int, const ast_node_t *> nodes_;
-    std::vector<dot_edge_t> edges_;
-    int ids = 1;
+// One object per node, its children given by their ids:
+// {"id":1,"type":"BIN_OP","op":"+","children":[2,3]}
+class json_writer_t final {
+    std::ostream *os_;
 
-private:
-    void add_node(const ast_node_t &node, int id = 0)
+public:
+    json_writer_t(std::ostream *os) : os_(os) {}
+
+    void begin() const { *os_ << "{\"nodes\":[\n"; }
+    void node(const ast_node_t &node, int id) const
     {
+        if (id != 0)
+            *os_ << ",\n";
+        *os_ << "{\"id\":" << id << ",\"type\":\"" << node_type_name(node.nt)
+             << '"';
         switch (node.nt)
         {
-        case node_types::BIN_OP:
-        {
-            int l_id = ids++, r_id = ids++;
-            nodes_.try_emplace(id, &node);
-            edges_.push_back({id, l_id, "lhs"});
-            edges_.push_back({id, r_id, "rhs"});
-            add_node(**(static_cast<const ast_bin_op_t &>(node).lhs), l_id);
-            add_node(**(static_cast<const ast_bin_op_t &>(node).rhs), r_id);
+        case node_types::NUMBER:
+            *os_ << ",\"value\":" << static_cast<const ast_num_t &>(node).val;
             break;
-        }
-        case node_types::UN_OP:
-        {
-            int r_id = ids++;
-            nodes_.try_emplace(id, &node);
-            edges_.push_back({id, r_id, "operand"});
-            add_node(**(static_cast<const ast_un_op_t &>(node).rhs), r_id);
+        case node_types::VARIABLE:
+        case node_types::LVAL:
+            *os_ << ",\"name\":\"" << static_cast<const ast_var_t &>(node).name
+                 << '"';
             break;
-        }
-        case node_types::STATEMENTS:
+        case node_types::LOCAL:
         {
-            nodes_.try_emplace(id, &node);
-            int stat_i = 1;
-            auto &seq = static_cast<const ast_statements_t &>(node).seq;
-
-            for (auto &&p : seq)
-            {
-                int r_id = ids++;
-                edges_.push_back({id, r_id, std::to_string(stat_i++)});
-                add_node(**p, r_id);
-            }
+            auto &local = static_cast<const ast_local_t &>(node);
+            *os_ << ",\"name\":\"" << local.name
+                 << "\",\"slot\":" << local.slot;
             break;
         }
-        case node_types::IF:
-        {
-            int cond_id = ids++, body_id = ids++;
-            nodes_.try_emplace(id, &node);
-            edges_.push_back({id, cond_id, "cond"});
-            edges_.push_back({id, body_id, "body"});
-            add_node(**(static_cast<const ast_if_t &>(node).condition),
-                     cond_id);
-            add_node(**(static_cast<const ast_if_t &>(node).body), body_id);
+        case node_types::CALL:
+            *os_ << ",\"function\":\""
+                 << static_cast<const ast_call_t &>(node).fn->name << '"';
             break;
-        }
-        case node_types::IFELSE:
-        {
-            int cond_id = ids++, body_id = ids++, else_body_id = ids++;
-            nodes_.try_emplace(id, &node);
-            edges_.push_back({id, cond_id, "cond"});
-            edges_.push_back({id, body_id, "body"});
-            edges_.push_back({id, else_body_id, "else_body"});
-            add_node(**(static_cast<const ast_ifelse_t &>(node).condition),
-                     cond_id);
-            add_node(**(static_cast<const ast_ifelse_t &>(node).body), body_id);
-            add_node(**(static_cast<const ast_ifelse_t &>(node).else_body),
-                     else_body_id);
+        case node_types::FUNCTION:
+            *os_ << ",\"name\":\"" << static_cast<const ast_func_t &>(node).name
+                 << '"';
             break;
-        }
-        case node_types::WHILE:
+        case node_types::INDUCTION:
         {
-            int cond_id = ids++, body_id = ids++;
-            nodes_.try_emplace(id, &node);
-            edges_.push_back({id, cond_id, "cond"});
-            edges_.push_back({id, body_id, "body"});
-            add_node(**(static_cast<const ast_while_t &>(node).condition),
-                     cond_id);
-            add_node(**(static_cast<const ast_while_t &>(node).body), body_id);
+            auto &induction = static_cast<const ast_induction_t &>(node);
+            *os_ << ",\"name\":\"" << induction.name
+                 << "\",\"step\":" << induction.step;
             break;
         }
-        case node_types::WRITE:
-        case node_types::LVAL:
-        case node_types::NUMBER:
-        case node_types::VARIABLE:
-        case node_types::EMPTY:
-            nodes_.try_emplace(id, &node);
+        case node_types::UNROLLED_LOOP:
+            *os_ << ",\"factor\":"
+                 << static_cast<const ast_unrolled_loop_t &>(node).factor;
+            break;
+        case node_types::BIN_OP:
+            *os_ << ",\"op\":\""
+                 << static_cast<const ast_bin_op_t &>(node).op_str() << '"';
+            break;
+        case node_types::UN_OP:
+            *os_ << ",\"op\":\""
+                 << static_cast<const ast_un_op_t &>(node).op_str() << '"';
             break;
         default:
-            assert(0 && "Unreachable.");
             break;
         }
     }
-
-public:
-    dot_ast_t(const IIast_t *ast) : ast_(ast)
+    void child(int, int child_id, std::string_view, std::size_t i) const
     {
-        assert(ast);
-        add_node(ast_->root());
+        *os_ << (i ? "," : ",\"children\":[") << child_id;
     }
-
-    const std::unordered_map<int, const ast_node_t *> &nodes() const
+    void node_end(std::size_t children) const
     {
-        return nodes_;
+        *os_ << (children ? "]}" : "}");
     }
-    const std::vector<dot_edge_t> &edges() const { return edges_; }
+    void end() const { *os_ << "\n]}\n"; }
 };
 
+// Writes the AST as it walks it. A node shared by several parents is written
+// once, under the id it got from the first of them, and the others only get
+// an edge to it. Only the shared nodes are remembered, the others are
+// numbered as they come.
 class ast_dumper final {
     std::ostream *debug_stream_;
-    ast_node_dumper node_dumper_;
+    dump_format_t format_;
 
 private:
-    template <typename Vec> void dump_edges_invis(const Vec &edges) const
-    {
-        for (auto &&e : edges)
-        {
-            *debug_stream_ << "\t" << e.line.first << " -> " << e.line.second
-                           << " [style=invis]\n";
-        }
-    }
-
-    template <typename Map> void dump_nodes(const Map &nodes) const
-    {
-        for (auto &&p : nodes)
-        {
-            node_dumper_(*(p.second), p.first);
-        }
-    }
-
-    template <typename Vec> void dump_edges(const Vec &edges) const
+    // Children are pushed in reverse, so they are numbered and visited in the
+    // same depth-first order as a recursive walk. The functions follow the
+    // program.
+    template <typename Writer>
+    void dump(const IIast_t &ast, const Writer &writer) const
     {
-        for (auto &&e : edges)
+        std::vector<std::pair<const ast_node_t *, int>> stack;
+        std::unordered_map<const ast_node_t *, int> shared_ids;
+        const auto &functions = ast.functions();
+        for (std::size_t i = functions.size(); i-- > 0;)
+            stack.emplace_back(functions[i]->get(), i + 1);
+        stack.emplace_back(&ast.root(), 0);
+        int ids = functions.size() + 1;
+        writer.begin();
+        while (!stack.empty())
         {
-            *debug_stream_ << "\t" << e.line.first << " -> " << e.line.second
-                           << " [style=solid label=\"" << e.label << "\"]\n";
+            auto [node, id] = stack.back();
+            stack.pop_back();
+            writer.node(*node, id);
+            std::size_t top = stack.size(), children = 0;
+            for_each_child(*node, [&, id = id](const ast_node_t &child,
+                                               std::string_view label) {
+                bool fresh = true;
+                int child_id = ids;
+                if (ast.shared(child))
+                {
+                    auto it = shared_ids.try_emplace(&child, ids).first;
+                    fresh = it->second == ids;
+                    child_id = it->second;
+                }
+                writer.child(id, child_id, label, children++);
+                if (fresh)
+                    stack.emplace_back(&child, ids++);
+            });
+            writer.node_end(children);
+            std::reverse(stack.begin() + top, stack.end());
         }
+        writer.end();
     }
 
 public:
-    ast_dumper(std::ostream *ds = &std::cout)
-        : debug_stream_(ds), node_dumper_(ds)
+    ast_dumper(std::ostream *ds = &std::cout,
+               dump_format_t format = dump_format_t::dot)
+        : debug_stream_(ds), format_(format)
     {}
 
     void operator()(const IIast_t &ast) const
     {
-        dot_ast_t dot_ast(&ast);
-        *debug_stream_ << "digraph \"AST\"\n{\n";
-        dump_edges_invis(dot_ast.edges());
-        dump_nodes(dot_ast.nodes());
-        dump_edges(dot_ast.edges());
-        *debug_stream_ << "}";
+        if (format_ == dump_format_t::json)
+            dump(ast, json_writer_t{debug_stream_});
+        else
+            dump(ast, dot_writer_t{debug_stream_});
     }
 };
 
-} // namespace AST
\ No newline at end of file
+} // namespace AST
@@ -0,0 +1,271 @@
+#pragma once
+
+#include "AST.h"
+#include "AST_analysis.h"
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace AST {
+
+// Backward liveness over the statement structure. A store is dead when its
+// variable is not read before the next store or the end of the variable's
+// scope; it is replaced by its right-hand side, which is dropped in turn if
+// it is pure and can not fault. Input reads are kept, so the program
+// consumes exactly the same input.
+class dead_store_elimination final {
+    struct scope_info_t {
+        names_t declared;
+        const names_t *reads = nullptr;
+    };
+
+    ast_t *ast_;
+    summaries_t summaries_;
+    // Stores creating a variable, mapped to the scope they create it in.
+    std::unordered_map<const ast_node_t *, const ast_node_t *> declaring_;
+    std::unordered_map<const ast_node_t *, scope_info_t> scopes_;
+    // Names declared by the enclosing scopes while they are declared.
+    names_t known_;
+    // Names a loop body reads before writing them, it is live at its head
+    // whatever is live after it.
+    std::unordered_map<const ast_node_t *, names_t> gens_;
+    std::size_t stores_ = 0, nodes_ = 0;
+
+private:
+    // Replays the parse time name resolution: every reachable statement
+    // sequence is a scope and a store declares its variable unless one of
+    // the enclosing scopes already has it.
+    void declare(const ast_node_t &node,
+                 std::vector<const ast_node_t *> &scopes)
+    {
+        if (node.nt == node_types::STATEMENTS)
+        {
+            scopes_[&node].reads = &summaries_.reads(node);
+            scopes.push_back(&node);
+            for_each_edge(node, [this, &scopes](const node_it &e) {
+                declare(**e, scopes);
+            });
+            scopes.pop_back();
+            for (auto &&name : scopes_[&node].declared)
+                known_.erase(name);
+            return;
+        }
+        if (node.nt == node_types::LVAL)
+        {
+            auto &name = static_cast<const ast_lval_t &>(node).name;
+            if (known_.insert(name).second)
+            {
+                scopes_[scopes.back()].declared.insert(name);
+                declaring_.emplace(&node, scopes.back());
+            }
+        }
+        for_each_edge(node, [this, &scopes](const node_it &e) {
+            declare(**e, scopes);
+        });
+    }
+
+    // A declaring store is only removable if nothing in its scope reads the
+    // variable: otherwise a later store in a nested scope would declare it
+    // there instead.
+    bool removable(const ast_lval_t &lval) const
+    {
+        auto it = declaring_.find(&lval);
+        return it == declaring_.end() ||
+               !scopes_.at(it->second).reads->contains(lval.name);
+    }
+
+    // The live names a statement writing writes can kill or find dead, the
+    // others are live before it as they are after it.
+    static names_t restrict(const names_t &live, const names_t &writes)
+    {
+        names_t res;
+        if (live.size() < writes.size())
+        {
+            for (auto &&name : live)
+                if (writes.contains(name))
+                    res.insert(name);
+        }
+        else
+            for (auto &&name : writes)
+                if (live.contains(name))
+                    res.insert(name);
+        return res;
+    }
+
+    names_t add_reads(names_t live, const ast_node_t &expr)
+    {
+        auto &reads = summaries_.reads(expr);
+        live.insert(reads.begin(), reads.end());
+        return live;
+    }
+
+    static bool is_store(const ast_node_t &node)
+    {
+        return node.nt == node_types::BIN_OP &&
+               static_cast<const ast_bin_op_t &>(node).op ==
+                   ast_bin_ops::ASSIGNMENT;
+    }
+
+    // Store whose value is used by the enclosing expression.
+    names_t live_value(node_it &edge, names_t live, bool transform)
+    {
+        if (!is_store(**edge))
+            return add_reads(std::move(live), **edge);
+        auto &store = static_cast<ast_bin_op_t &>(**edge);
+        auto &lval = static_cast<const ast_lval_t &>(**store.lhs);
+        bool dead = !live.contains(lval.name) && removable(lval);
+        live.erase(lval.name);
+        if (dead && transform)
+        {
+            ++stores_;
+            nodes_ += 2;
+            edge = store.rhs;
+            return live_value(edge, std::move(live), transform);
+        }
+        return live_value(store.rhs, std::move(live), transform);
+    }
+
+    // Expression statement, its value is discarded. Sets drop if the whole
+    // statement can be removed.
+    names_t live_effect(node_it &edge, names_t live, bool transform,
+                        bool &drop)
+    {
+        ast_node_t &node = **edge;
+        switch (node.nt)
+        {
+        case node_types::STATEMENTS:
+            return live_scope(static_cast<ast_statements_t &>(node),
+                              std::move(live), transform);
+        case node_types::IF:
+        {
+            auto &ifst = static_cast<ast_if_t &>(node);
+            names_t in = live_body(
+                ifst.body, restrict(live, summaries_.writes(**ifst.body)),
+                transform);
+            live.insert(in.begin(), in.end());
+            return add_reads(std::move(live), **ifst.condition);
+        }
+        case node_types::IFELSE:
+        {
+            auto &ifelse = static_cast<ast_ifelse_t &>(node);
+            names_t body_live =
+                restrict(live, summaries_.writes(**ifelse.body));
+            names_t else_live =
+                restrict(live, summaries_.writes(**ifelse.else_body));
+            // A name both branches write is live only if one reads it.
+            for (auto &&name : else_live)
+                if (body_live.contains(name))
+                    live.erase(name);
+            names_t in =
+                live_body(ifelse.body, std::move(body_live), transform);
+            names_t else_in =
+                live_body(ifelse.else_body, std::move(else_live), transform);
+            live.insert(in.begin(), in.end());
+            live.insert(else_in.begin(), else_in.end());
+            return add_reads(std::move(live), **ifelse.condition);
+        }
+        case node_types::WHILE:
+            return live_loop(static_cast<ast_while_t &>(node),
+                             std::move(live), transform);
+        case node_types::EMPTY:
+            drop = transform;
+            return live;
+        default:
+            break;
+        }
+
+        if (is_store(node))
+        {
+            auto &store = static_cast<ast_bin_op_t &>(node);
+            auto &lval = static_cast<const ast_lval_t &>(**store.lhs);
+            bool dead = !live.contains(lval.name) && removable(lval);
+            live.erase(lval.name);
+            if (dead && transform)
+            {
+                ++stores_;
+                nodes_ += 2;
+                edge = store.rhs;
+                return live_effect(edge, std::move(live), transform, drop);
+            }
+            return live_value(store.rhs, std::move(live), transform);
+        }
+        if (transform && summaries_.pure(node) && !may_trap(node))
+        {
+            drop = true;
+            return live;
+        }
+        return add_reads(std::move(live), node);
+    }
+
+    // Statement that is not an element of a sequence: a dropped one becomes
+    // an empty statement.
+    names_t live_body(node_it &edge, names_t live, bool transform)
+    {
+        bool drop = false;
+        live = live_effect(edge, std::move(live), transform, drop);
+        if (drop && (*edge)->nt != node_types::EMPTY)
+        {
+            nodes_ += subtree_size(**edge) - 1;
+            edge = ast_->make_node<ast_empty_op_t>();
+        }
+        return live;
+    }
+
+    // Every statement keeps what is live after it but the names it kills
+    // and adds the ones it reads, so the head of the loop needs a single
+    // pass over the body with nothing live after it instead of rounds.
+    names_t live_loop(ast_while_t &loop, names_t live, bool transform)
+    {
+        auto it = gens_.find(&loop);
+        if (it == gens_.end())
+            it = gens_.emplace(&loop, live_body(loop.body, {}, false)).first;
+        names_t head = add_reads(std::move(live), **loop.condition);
+        head.insert(it->second.begin(), it->second.end());
+        if (transform)
+            live_body(loop.body,
+                      restrict(head, summaries_.writes(**loop.body)), true);
+        return head;
+    }
+
+    names_t live_scope(ast_statements_t &scope, names_t live, bool transform)
+    {
+        for (auto &&name : scopes_[&scope].declared)
+            live.erase(name);
+        std::vector<bool> drops(scope.seq.size());
+        for (std::size_t i = scope.seq.size(); i-- > 0;)
+        {
+            bool drop = false;
+            live = live_effect(scope.seq[i], std::move(live), transform, drop);
+            drops[i] = drop;
+        }
+        if (!transform)
+            return live;
+
+        ast_statements_t::deque_t kept;
+        for (std::size_t i = 0; i < scope.seq.size(); ++i)
+        {
+            if (drops[i])
+                nodes_ += subtree_size(**scope.seq[i]);
+            else
+                kept.push_back(scope.seq[i]);
+        }
+        scope.seq = std::move(kept);
+        return live;
+    }
+
+public:
+    dead_store_elimination(ast_t *ast) : ast_(ast) {}
+
+    // Returns the number of removed stores and of removed nodes.
+    std::pair<std::size_t, std::size_t> operator()(node_it root)
+    {
+        std::vector<const ast_node_t *> scopes;
+        declare(**root, scopes);
+        bool drop = false;
+        live_effect(root, {}, true, drop);
+        return {stores_, nodes_};
+    }
+};
+
+} // namespace AST
@@ -0,0 +1,468 @@
+#pragma once
+
+#include "AST.h"
+#include "AST_analysis.h"
+#include "AST_liveness.h"
+#include "AST_range.h"
+#include "AST_scev.h"
+#include "dump_format.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace AST {
+
+// Caches every maximal pure expression that is invariant in an enclosing loop
+// on the epoch of the outermost such loop. The expression is computed on its
+// first use after the loop is entered, so it is "hoisted" without being
+// evaluated on paths that never reached it: input, output and division by
+// zero happen exactly as before.
+class loop_invariant_motion final {
+    struct expr_info_t {
+        names_t reads;
+        std::size_t level;
+    };
+
+    ast_t *ast_;
+    summaries_t summaries_;
+    std::vector<const ast_while_t *> loops_;
+    // Enclosing loops that write a name. A loop writes every name that the
+    // loops in it write, so they are the outermost ones.
+    std::unordered_map<std::string_view, std::size_t> writers_;
+    std::size_t hoisted_ = 0;
+
+private:
+    // Index of the outermost loop that does not modify reads, or the number
+    // of enclosing loops if there is no such loop.
+    std::size_t level(const names_t &reads) const
+    {
+        std::size_t lvl = 0;
+        for (auto &&name : reads)
+            if (auto it = writers_.find(name); it != writers_.end())
+                lvl = std::max(lvl, it->second);
+        return lvl;
+    }
+
+    void hoist(node_it &edge, std::size_t lvl)
+    {
+        edge = ast_->make_node<ast_cached_expr_t>(
+            edge, std::make_shared<ast_cache_slot_t>(), &loops_[lvl]->epoch);
+        ++hoisted_;
+    }
+
+    // Nothing is hoisted from below a shared node, where it would be cached
+    // on the loop of one of its occurrences for all of them.
+    std::optional<expr_info_t> process(node_it &edge, bool frozen = false)
+    {
+        ast_node_t &node = **edge;
+        frozen = frozen || ast_->shared(node);
+        bool is_loop = node.nt == node_types::WHILE;
+        if (is_loop)
+        {
+            loops_.push_back(&static_cast<const ast_while_t &>(node));
+            for (auto &&name : summaries_.writes(node))
+                ++writers_[name];
+        }
+
+        std::vector<std::pair<node_it *, std::optional<expr_info_t>>> children;
+        for_each_edge(node, [this, &children, frozen](node_it &e) {
+            auto info = process(e, frozen);
+            children.emplace_back(&e, std::move(info));
+        });
+        if (is_loop)
+        {
+            loops_.pop_back();
+            for (auto &&name : summaries_.writes(node))
+                if (--writers_[name] == 0)
+                    writers_.erase(name);
+        }
+
+        std::optional<expr_info_t> info;
+        if (node.nt == node_types::NUMBER)
+            info = expr_info_t{{}, level({})};
+        else if (node.nt == node_types::VARIABLE)
+        {
+            names_t reads{static_cast<const ast_var_t &>(node).name};
+            std::size_t lvl = level(reads);
+            info = expr_info_t{std::move(reads), lvl};
+        }
+        else if (is_operator(node) && is_pure_op(node) &&
+                 std::all_of(children.begin(), children.end(),
+                             [](auto &&c) { return c.second.has_value(); }))
+        {
+            names_t reads;
+            for (auto &&c : children)
+                reads.insert(c.second->reads.begin(), c.second->reads.end());
+            std::size_t lvl = level(reads);
+            info = expr_info_t{std::move(reads), lvl};
+        }
+
+        for (auto &&[child_edge, child_info] : children)
+        {
+            if (!frozen && child_info && child_info->level < loops_.size() &&
+                is_operator(***child_edge) &&
+                (!info || child_info->level < info->level))
+                hoist(*child_edge, child_info->level);
+        }
+        return info;
+    }
+
+    static bool is_pure_op(const ast_node_t &node)
+    {
+        if (node.nt == node_types::BIN_OP)
+            return static_cast<const ast_bin_op_t &>(node).op !=
+                   ast_bin_ops::ASSIGNMENT;
+        return static_cast<const ast_un_op_t &>(node).op != ast_un_ops::PRINT;
+    }
+
+public:
+    loop_invariant_motion(ast_t *ast) : ast_(ast) {}
+
+    std::size_t operator()(node_it root)
+    {
+        process(root);
+        return hoisted_;
+    }
+};
+
+// Shares the value of a pure expression between its occurrences in
+// consecutive statements of a sequence that do not modify its variables.
+// Whichever occurrence is evaluated first computes the value, the others
+// reuse it until the sequence is executed again. A nested sequence shares
+// the expressions in it on its own, so every node is looked at by one.
+class common_subexpression_elimination final {
+    using group_t = std::pair<std::string, std::size_t>;
+
+    ast_t *ast_;
+    summaries_t summaries_;
+    std::size_t shared_ = 0;
+
+private:
+    void process_sequence(ast_statements_t &stmts)
+    {
+        std::unordered_map<std::string, names_t> keys;
+        std::unordered_map<std::string_view, std::size_t> stores;
+        std::map<group_t, std::size_t> counts;
+        std::map<group_t, std::vector<node_it *>> groups;
+
+        auto reads_of = [&](std::string key,
+                            const ast_node_t &expr) -> const names_t & {
+            auto [it, inserted] = keys.try_emplace(std::move(key));
+            if (inserted)
+                collect_reads(expr, it->second);
+            return it->second;
+        };
+
+        // Keys are killed by the statements writing their variables: a run
+        // numbers the stretch of statements between two such writes, as the
+        // statements that wrote the variables so far do.
+        auto run = [&stores](const names_t &reads) {
+            std::size_t res = 0;
+            for (auto &&name : reads)
+                if (auto it = stores.find(name); it != stores.end())
+                    res += it->second;
+            return res;
+        };
+
+        auto scan = [&](auto &&on_stmt) {
+            stores.clear();
+            for (auto &&stmt : stmts.seq)
+            {
+                const names_t &writes = summaries_.writes(**stmt);
+                on_stmt(stmt, writes);
+                for (auto &&name : writes)
+                    ++stores[name];
+            }
+        };
+
+        scan([&](node_it &stmt, const names_t &writes) {
+            walk(**stmt, [&](const ast_node_t &n) {
+                if (!is_operator(n))
+                    return n.nt != node_types::STATEMENTS;
+                if (auto key = expr_key(n))
+                {
+                    auto &reads = reads_of(*key, n);
+                    if (!intersects(reads, writes))
+                        ++counts[{std::move(*key), run(reads)}];
+                }
+                return true;
+            });
+        });
+
+        scan([&](node_it &stmt, const names_t &writes) {
+            auto visit = [&](node_it &edge, auto &&self) -> void {
+                const ast_node_t &n = **edge;
+                if (is_operator(n))
+                {
+                    if (auto key = expr_key(n))
+                    {
+                        auto &reads = keys.find(*key)->second;
+                        group_t group{std::move(*key), run(reads)};
+                        if (!intersects(reads, writes) &&
+                            counts[group] > 1)
+                        {
+                            groups[std::move(group)].push_back(&edge);
+                            return;
+                        }
+                    }
+                }
+                // The children of a shared node are left as they are.
+                if (ast_->shared(n) || n.nt == node_types::STATEMENTS)
+                    return;
+                for_each_edge(**edge, [&self](node_it &e) { self(e, self); });
+            };
+            visit(stmt, visit);
+        });
+
+        for (auto &&[group, edges] : groups)
+        {
+            if (edges.size() < 2)
+                continue;
+            auto slot = std::make_shared<ast_cache_slot_t>();
+            for (auto *edge : edges)
+                *edge = ast_->make_node<ast_cached_expr_t>(*edge, slot,
+                                                           &stmts.epoch);
+            shared_ += edges.size() - 1;
+        }
+    }
+
+public:
+    common_subexpression_elimination(ast_t *ast) : ast_(ast) {}
+
+    std::size_t operator()(node_it root)
+    {
+        walk(**root, [this](ast_node_t &n) {
+            if (n.nt == node_types::STATEMENTS)
+                process_sequence(static_cast<ast_statements_t &>(n));
+            return true;
+        });
+        return shared_;
+    }
+};
+
+struct opt_report_t final {
+    std::size_t dead_stores = 0;
+    std::size_t removed_nodes = 0;
+    std::size_t closed_loops = 0;
+    std::size_t hoisted = 0;
+    std::size_t shared = 0;
+    std::size_t reduced = 0;
+    std::size_t unrolled = 0;
+    std::size_t removed_checks = 0;
+    std::size_t fused = 0;
+    std::size_t split = 0;
+    std::size_t unoptimized_nodes = 0;
+};
+
+class ast_optimizer_t final {
+public:
+    // The passes recurse on the native stack. In a deeper tree only the runs
+    // of statements that are not too deep are optimized, each as a sequence
+    // of its own, dead stores are kept and the nodes left are reported as
+    // unoptimized.
+    static constexpr std::size_t max_depth = 2000;
+
+private:
+    // Height and size of every subtree, found without recursion.
+    using extents_t =
+        std::unordered_map<const ast_node_t *,
+                           std::pair<std::size_t, std::size_t>>;
+
+    static extents_t extents(const ast_node_t &root)
+    {
+        extents_t res;
+        std::vector<std::pair<const ast_node_t *, bool>> stack{{&root, false}};
+        while (!stack.empty())
+        {
+            auto [node, done] = stack.back();
+            if (!done)
+            {
+                stack.back().second = true;
+                for_each_edge(*node, [&stack, &res](const node_it &e) {
+                    if (!res.contains(e->get()))
+                        stack.emplace_back(e->get(), false);
+                });
+                continue;
+            }
+            stack.pop_back();
+            std::pair<std::size_t, std::size_t> extent{1, 1};
+            for_each_edge(*node, [&extent, &res](const node_it &e) {
+                auto [height, size] = res.at(e->get());
+                extent.first = std::max(extent.first, height + 1);
+                extent.second += size;
+            });
+            res.emplace(node, extent);
+        }
+        return res;
+    }
+
+    // Puts every run of statements that is not too deep in the sequences of
+    // a deeper tree in a sequence of its own and passes it to pass. Returns
+    // the number of the nodes in no run.
+    template <typename F>
+    static std::size_t shallow_runs(ast_t &ast, ast_node_t &root, F &&pass)
+    {
+        auto ext = extents(root);
+        auto deep = [&ext](const node_it &e) {
+            return ext.at(e->get()).first > max_depth;
+        };
+        std::size_t unoptimized = 0;
+        std::vector<ast_node_t *> stack{&root};
+        while (!stack.empty())
+        {
+            ast_node_t &node = *stack.back();
+            stack.pop_back();
+            ++unoptimized;
+            if (node.nt != node_types::STATEMENTS)
+            {
+                for_each_edge(node, [&](node_it &e) {
+                    if (deep(e))
+                        stack.push_back(e->get());
+                    else
+                        unoptimized += ext.at(e->get()).second;
+                });
+                continue;
+            }
+            auto &seq = static_cast<ast_statements_t &>(node).seq;
+            ast_statements_t::deque_t stmts(seq.get_allocator());
+            std::vector<node_it> runs;
+            for (node_it stmt : seq)
+            {
+                if (deep(stmt))
+                {
+                    stmts.push_back(stmt);
+                    stack.push_back(stmt->get());
+                    continue;
+                }
+                if (runs.empty() || stmts.back() != runs.back())
+                {
+                    runs.push_back(ast.make_node<ast_statements_t>());
+                    stmts.push_back(runs.back());
+                }
+                static_cast<ast_statements_t &>(**runs.back())
+                    .seq.push_back(stmt);
+            }
+            seq = std::move(stmts);
+            for (node_it run : runs)
+                pass(run);
+        }
+        return unoptimized;
+    }
+
+    static void local_passes(ast_t &ast, node_it root, opt_report_t &report)
+    {
+        // The checks are cleared first, the loop passes only transform
+        // arithmetic that has none.
+        report.removed_checks += range_analysis{}(root);
+        report.fused += loop_fusion{}(root);
+        report.split += loop_fission{&ast}(root);
+        report.closed_loops += closed_form_loops{&ast}(root);
+        report.hoisted += loop_invariant_motion{&ast}(root);
+        report.shared += common_subexpression_elimination{&ast}(root);
+        report.reduced += strength_reduction{&ast}(root);
+        report.unrolled += loop_unrolling{&ast}(root);
+    }
+
+public:
+    opt_report_t operator()(ast_t &ast) const
+    {
+        opt_report_t report;
+        if (depth(ast.root()) > max_depth)
+            report.unoptimized_nodes = shallow_runs(
+                ast, **ast.root_it(), [&ast, &report](node_it run) {
+                    local_passes(ast, run, report);
+                });
+        else
+        {
+            std::tie(report.dead_stores, report.removed_nodes) =
+                dead_store_elimination{&ast}(ast.root_it());
+            local_passes(ast, ast.root_it(), report);
+        }
+        for (auto &&fn : ast.functions())
+            (*this)(ast, static_cast<ast_func_t &>(**fn), report);
+        return report;
+    }
+
+    // Functions are only cleared of the checks they do not need.
+    void operator()(ast_t &ast, ast_func_t &fn, opt_report_t &report) const
+    {
+        if (depth(**fn.body) <= max_depth)
+            report.removed_checks += range_analysis{}(fn.body);
+        else
+            report.unoptimized_nodes +=
+                shallow_runs(ast, **fn.body, [&report](node_it run) {
+                    report.removed_checks += range_analysis{}(run);
+                });
+    }
+
+    // Optimizes a subtree before the rest of the program is known, so only
+    // the passes that do not look outside of it are run.
+    void operator()(ast_t &ast, node_it root, opt_report_t &report) const
+    {
+        if (depth(**root) <= max_depth)
+            local_passes(ast, root, report);
+        else
+            report.unoptimized_nodes +=
+                shallow_runs(ast, **root, [&ast, &report](node_it run) {
+                    local_passes(ast, run, report);
+                });
+    }
+};
+
+class opt_report_dumper final {
+    std::ostream *debug_stream_;
+    dump_format_t format_;
+
+public:
+    opt_report_dumper(std::ostream *ds,
+                      dump_format_t format = dump_format_t::dot)
+        : debug_stream_(ds), format_(format)
+    {}
+
+    void operator()(const opt_report_t &report) const
+    {
+        if (format_ == dump_format_t::json)
+        {
+            *debug_stream_ << "{\"dead_stores\":" << report.dead_stores
+                           << ",\"removed_nodes\":" << report.removed_nodes
+                           << ",\"closed_loops\":" << report.closed_loops
+                           << ",\"hoisted\":" << report.hoisted
+                           << ",\"shared\":" << report.shared
+                           << ",\"reduced\":" << report.reduced
+                           << ",\"unrolled\":" << report.unrolled
+                           << ",\"removed_checks\":" << report.removed_checks
+                           << ",\"fused\":" << report.fused
+                           << ",\"split\":" << report.split
+                           << ",\"unoptimized_nodes\":"
+                           << report.unoptimized_nodes << "}\n";
+            return;
+        }
+        *debug_stream_ << "Optimizer report:" << std::endl
+                       << "(Dead stores) " << report.dead_stores << std::endl
+                       << "(Removed nodes) " << report.removed_nodes
+                       << std::endl
+                       << "(Closed loops) " << report.closed_loops << std::endl
+                       << "(Hoisted expressions) " << report.hoisted
+                       << std::endl
+                       << "(Shared expressions) " << report.shared
+                       << std::endl
+                       << "(Reduced products) " << report.reduced << std::endl
+                       << "(Unrolled loops) " << report.unrolled << std::endl
+                       << "(Removed checks) " << report.removed_checks
+                       << std::endl
+                       << "(Fused loops) " << report.fused << std::endl
+                       << "(Split loops) " << report.split << std::endl
+                       << "(Unoptimized nodes) " << report.unoptimized_nodes
+                       << std::endl;
+    }
+};
+
+} // namespace AST
@@ -0,0 +1,409 @@
+#pragma once
+
+#include "AST.h"
+#include "AST_analysis.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace AST {
+
+// Values an expression may take. The bounds may exceed those of an int,
+// which tells that the expression may overflow.
+struct range_t final {
+    static constexpr std::int64_t min = std::numeric_limits<int>::min();
+    static constexpr std::int64_t max = std::numeric_limits<int>::max();
+
+    std::int64_t lo = min, hi = max;
+
+    bool fits() const { return lo >= min && hi <= max; }
+    bool contains(std::int64_t val) const { return lo <= val && val <= hi; }
+    // Values of the int result: any if it may wrap around.
+    range_t wrapped() const { return fits() ? *this : range_t{}; }
+    range_t join(const range_t &other) const
+    {
+        return {std::min(lo, other.lo), std::max(hi, other.hi)};
+    }
+
+    bool operator==(const range_t &) const = default;
+};
+
+// Value range analysis: interprets the program over ranges of its variables,
+// iterating every loop until the ranges at its head stop growing, and clears
+// the checks of the arithmetic operators that can not fail on any of them.
+class range_analysis final {
+    // Ranges of the variables, a variable that is not there may be anything.
+    using state_t = std::unordered_map<std::string_view, range_t>;
+
+    // Rounds of a loop before the bounds that still grow are widened to
+    // those of an int.
+    static constexpr std::size_t widen_after = 2;
+    // Nodes interpreted and ranges copied at most, the analysis gives up on
+    // larger programs. Nested loops take rounds of their enclosing ones, so
+    // the work grows with the depth of the nest as well.
+    static constexpr std::size_t max_steps = 1 << 20;
+
+    std::unordered_set<ast_node_t *> visited_, zero_, overflows_;
+    std::size_t steps_ = 0;
+
+private:
+    static range_t get(const state_t &state, std::string_view name)
+    {
+        auto it = state.find(name);
+        return it == state.end() ? range_t{} : it->second;
+    }
+
+    static state_t join(const state_t &lhs, const state_t &rhs)
+    {
+        state_t res;
+        for (auto &&[name, range] : lhs)
+            if (auto it = rhs.find(name); it != rhs.end())
+                res.emplace(name, range.join(it->second));
+        return res;
+    }
+
+    // Joins next into prev, taking the bounds that grow to those of an int.
+    static state_t widen(const state_t &prev, const state_t &next)
+    {
+        state_t res;
+        for (auto &&[name, range] : prev)
+            if (auto it = next.find(name); it != next.end())
+                res.emplace(name, range_t{it->second.lo < range.lo
+                                              ? range_t::min
+                                              : range.lo,
+                                          it->second.hi > range.hi
+                                              ? range_t::max
+                                              : range.hi});
+        return res;
+    }
+
+    static range_t corners(std::initializer_list<std::int64_t> vals)
+    {
+        return {std::min(vals), std::max(vals)};
+    }
+
+    static range_t divide(range_t lhs, range_t rhs)
+    {
+        std::optional<range_t> res;
+        range_t negative{rhs.lo, std::min<std::int64_t>(rhs.hi, -1)},
+            positive{std::max<std::int64_t>(rhs.lo, 1), rhs.hi};
+        for (range_t part : {negative, positive})
+        {
+            if (part.lo > part.hi)
+                continue;
+            range_t q = corners({lhs.lo / part.lo, lhs.lo / part.hi,
+                                 lhs.hi / part.lo, lhs.hi / part.hi});
+            res = res ? res->join(q) : q;
+        }
+        return res ? res->wrapped() : range_t{};
+    }
+
+    static range_t remainder(range_t lhs, range_t rhs)
+    {
+        std::int64_t most = std::max(-rhs.lo, rhs.hi) - 1;
+        if (most < 0)
+            return {};
+        return {lhs.lo >= 0 ? 0 : std::max(lhs.lo, -most),
+                lhs.hi <= 0 ? 0 : std::min(lhs.hi, most)};
+    }
+
+    range_t arith(ast_arith_op_t &op, range_t lhs, range_t rhs)
+    {
+        visited_.insert(&op);
+        range_t res;
+        switch (op.op)
+        {
+        case ast_bin_ops::PLUS:
+            res = {lhs.lo + rhs.lo, lhs.hi + rhs.hi};
+            break;
+        case ast_bin_ops::MINUS:
+            res = {lhs.lo - rhs.hi, lhs.hi - rhs.lo};
+            break;
+        case ast_bin_ops::MULTIPLICATION:
+            res = corners({lhs.lo * rhs.lo, lhs.lo * rhs.hi, lhs.hi * rhs.lo,
+                           lhs.hi * rhs.hi});
+            break;
+        case ast_bin_ops::DIVISION:
+        case ast_bin_ops::MODDIV:
+            if (rhs.contains(0))
+                zero_.insert(&op);
+            if (op.op == ast_bin_ops::MODDIV)
+                return remainder(lhs, rhs);
+            if (lhs.contains(range_t::min) && rhs.contains(-1))
+                overflows_.insert(&op);
+            return divide(lhs, rhs);
+        default:
+            return {};
+        }
+        if (!res.fits())
+            overflows_.insert(&op);
+        return res.wrapped();
+    }
+
+    // Narrows the ranges of the variables that cond compares to a constant
+    // or another variable by its value being truth.
+    static void refine(const ast_node_t &cond, state_t &state, bool truth)
+    {
+        if (cond.nt == node_types::VARIABLE)
+        {
+            auto name = static_cast<const ast_var_t &>(cond).name;
+            range_t var = get(state, name);
+            if (!truth && var.contains(0))
+                state[name] = {0, 0};
+            else if (truth && var.lo == 0)
+                state[name] = {1, std::max<std::int64_t>(var.hi, 1)};
+            else if (truth && var.hi == 0)
+                state[name] = {std::min<std::int64_t>(var.lo, -1), -1};
+            return;
+        }
+        if (cond.nt == node_types::UN_OP &&
+            static_cast<const ast_un_op_t &>(cond).op == ast_un_ops::LNO)
+            return refine(**static_cast<const ast_un_op_t &>(cond).rhs, state,
+                          !truth);
+        if (cond.nt != node_types::BIN_OP)
+            return;
+        auto &bin = static_cast<const ast_bin_op_t &>(cond);
+        if ((bin.op == ast_bin_ops::LAND && truth) ||
+            (bin.op == ast_bin_ops::LOR && !truth))
+        {
+            refine(**bin.lhs, state, truth);
+            refine(**bin.rhs, state, truth);
+            return;
+        }
+        auto operand = [&state](const ast_node_t &n) -> std::optional<range_t> {
+            if (n.nt == node_types::NUMBER)
+            {
+                int val = static_cast<const ast_num_t &>(n).val;
+                return range_t{val, val};
+            }
+            if (n.nt == node_types::VARIABLE)
+                return get(state, static_cast<const ast_var_t &>(n).name);
+            return std::nullopt;
+        };
+        auto lhs = operand(**bin.lhs), rhs = operand(**bin.rhs);
+        if (!lhs || !rhs)
+            return;
+        narrow(**bin.lhs, *lhs, *rhs, bin.op, truth, state);
+        narrow(**bin.rhs, *rhs, *lhs, flip(bin.op), truth, state);
+    }
+
+    // Narrows var, if it is a variable, by var rel other being truth.
+    static void narrow(const ast_node_t &var, range_t range, range_t other,
+                       ast_bin_ops rel, bool truth, state_t &state)
+    {
+        if (var.nt != node_types::VARIABLE)
+            return;
+        if (!truth)
+            rel = negate(rel);
+        switch (rel)
+        {
+        case ast_bin_ops::LESS:
+            range.hi = std::min(range.hi, other.hi - 1);
+            break;
+        case ast_bin_ops::LESSEQ:
+            range.hi = std::min(range.hi, other.hi);
+            break;
+        case ast_bin_ops::GREATER:
+            range.lo = std::max(range.lo, other.lo + 1);
+            break;
+        case ast_bin_ops::GREATEREQ:
+            range.lo = std::max(range.lo, other.lo);
+            break;
+        case ast_bin_ops::EQUAL:
+            range = {std::max(range.lo, other.lo),
+                     std::min(range.hi, other.hi)};
+            break;
+        case ast_bin_ops::NOTEQUAL:
+            if (other.lo == other.hi && range.lo == other.lo)
+                ++range.lo;
+            else if (other.lo == other.hi && range.hi == other.hi)
+                --range.hi;
+            break;
+        default:
+            return;
+        }
+        // A branch that is never taken keeps the ranges it has.
+        if (range.lo <= range.hi)
+            state[static_cast<const ast_var_t &>(var).name] = range;
+    }
+
+    static ast_bin_ops negate(ast_bin_ops rel)
+    {
+        switch (rel)
+        {
+        case ast_bin_ops::LESS:
+            return ast_bin_ops::GREATEREQ;
+        case ast_bin_ops::LESSEQ:
+            return ast_bin_ops::GREATER;
+        case ast_bin_ops::GREATER:
+            return ast_bin_ops::LESSEQ;
+        case ast_bin_ops::GREATEREQ:
+            return ast_bin_ops::LESS;
+        case ast_bin_ops::EQUAL:
+            return ast_bin_ops::NOTEQUAL;
+        case ast_bin_ops::NOTEQUAL:
+            return ast_bin_ops::EQUAL;
+        default:
+            return rel;
+        }
+    }
+
+    void loop(ast_while_t &loop, state_t &state)
+    {
+        state_t head = state;
+        for (std::size_t round = 0;; ++round)
+        {
+            // The round copies the state for the condition, the body and
+            // the next head.
+            steps_ += 3 * head.size();
+            state_t cond = head;
+            eval(**loop.condition, cond);
+            state_t body = cond;
+            refine(**loop.condition, body, true);
+            eval(**loop.body, body);
+            state_t next = join(head, body);
+            if (round >= widen_after)
+                next = widen(head, next);
+            if (next == head || steps_ > max_steps)
+            {
+                refine(**loop.condition, cond, false);
+                state = std::move(cond);
+                return;
+            }
+            head = std::move(next);
+        }
+    }
+
+    // Range of the value of node, which is evaluated in state.
+    range_t eval(ast_node_t &node, state_t &state)
+    {
+        if (++steps_ > max_steps)
+        {
+            state.clear();
+            return {};
+        }
+        switch (node.nt)
+        {
+        case node_types::NUMBER:
+        {
+            int val = static_cast<const ast_num_t &>(node).val;
+            return {val, val};
+        }
+        case node_types::VARIABLE:
+            return get(state, static_cast<const ast_var_t &>(node).name);
+        case node_types::BIN_OP:
+        {
+            auto &bin = static_cast<ast_bin_op_t &>(node);
+            range_t rhs = eval(**bin.rhs, state);
+            if (bin.op == ast_bin_ops::ASSIGNMENT)
+            {
+                state[static_cast<const ast_lval_t &>(**bin.lhs).name] = rhs;
+                return rhs;
+            }
+            range_t lhs = eval(**bin.lhs, state);
+            if (as_arith(bin))
+                return arith(static_cast<ast_arith_op_t &>(bin), lhs, rhs);
+            return {0, 1};
+        }
+        case node_types::UN_OP:
+        {
+            auto &un = static_cast<ast_un_op_t &>(node);
+            range_t rhs = eval(**un.rhs, state);
+            switch (un.op)
+            {
+            case ast_un_ops::MINUS:
+            {
+                visited_.insert(&un);
+                range_t res{-rhs.hi, -rhs.lo};
+                if (!res.fits())
+                    overflows_.insert(&un);
+                return res.wrapped();
+            }
+            case ast_un_ops::LNO:
+                return {0, 1};
+            default:
+                return rhs;
+            }
+        }
+        case node_types::STATEMENTS:
+            for (auto &&stmt : static_cast<ast_statements_t &>(node).seq)
+                eval(**stmt, state);
+            return {};
+        case node_types::IF:
+        case node_types::IFELSE:
+        {
+            auto &ifst = static_cast<ast_if_t &>(node);
+            eval(**ifst.condition, state);
+            steps_ += state.size();
+            state_t other = state;
+            refine(**ifst.condition, state, true);
+            refine(**ifst.condition, other, false);
+            eval(**ifst.body, state);
+            if (node.nt == node_types::IFELSE)
+                eval(**static_cast<ast_ifelse_t &>(node).else_body, other);
+            state = join(state, other);
+            return {};
+        }
+        case node_types::WHILE:
+            loop(static_cast<ast_while_t &>(node), state);
+            return {};
+        default:
+        {
+            // Calls, returns and the variables of functions: their children
+            // are evaluated, their values are unknown. The nodes the other
+            // passes make come after this one.
+            names_t writes;
+            collect_writes(node, writes);
+            for_each_edge(node, [this, &state](node_it &e) {
+                eval(**e, state);
+            });
+            for (auto &&name : writes)
+                state.erase(name);
+            return {};
+        }
+        }
+    }
+
+public:
+    // Returns the number of checks that were cleared.
+    std::size_t operator()(node_it root)
+    {
+        state_t state;
+        eval(**root, state);
+        if (steps_ > max_steps)
+            return 0;
+        std::size_t cleared = 0;
+        for (auto *node : visited_)
+        {
+            if (node->nt == node_types::UN_OP)
+            {
+                auto &minus = static_cast<ast_unminus_op &>(*node);
+                if (minus.overflow_check && !overflows_.contains(node))
+                {
+                    minus.overflow_check = false;
+                    ++cleared;
+                }
+                continue;
+            }
+            auto &op = static_cast<ast_arith_op_t &>(*node);
+            if (op.zero_check && !zero_.contains(node))
+            {
+                op.zero_check = false;
+                ++cleared;
+            }
+            if (op.overflow_check && !overflows_.contains(node))
+            {
+                op.overflow_check = false;
+                ++cleared;
+            }
+        }
+        return cleared;
+    }
+};
+
+} // namespace AST
@@ -0,0 +1,992 @@
+#pragma once
+
+#include "AST.h"
+#include "AST_analysis.h"
+#include "affine_map.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace AST {
+
+// sum(coefs[v] * v) + free_term modulo 2^32. Expressions with overflow
+// checks have none, as they do not wrap around.
+struct affine_expr_t final {
+    std::map<std::string_view, std::uint32_t> coefs;
+    std::uint32_t free_term = 0;
+
+    bool is_const() const { return coefs.empty(); }
+
+    affine_expr_t &scale(std::uint32_t k)
+    {
+        for (auto &&c : coefs)
+            c.second *= k;
+        free_term *= k;
+        return *this;
+    }
+    affine_expr_t &add(const affine_expr_t &rhs, std::uint32_t k = 1)
+    {
+        for (auto &&c : rhs.coefs)
+            coefs[c.first] += c.second * k;
+        free_term += rhs.free_term * k;
+        return *this;
+    }
+};
+
+inline std::optional<affine_expr_t> affine_form(const ast_node_t &node)
+{
+    switch (node.nt)
+    {
+    case node_types::NUMBER:
+    {
+        int val = static_cast<const ast_num_t &>(node).val;
+        return affine_expr_t{{}, static_cast<std::uint32_t>(val)};
+    }
+    case node_types::VARIABLE:
+        return affine_expr_t{{{static_cast<const ast_var_t &>(node).name, 1}},
+                             0};
+    case node_types::UN_OP:
+    {
+        auto &un = static_cast<const ast_un_op_t &>(node);
+        auto rhs = affine_form(**un.rhs);
+        if (!rhs || (un.op != ast_un_ops::MINUS && un.op != ast_un_ops::PLUS))
+            return std::nullopt;
+        if (un.op == ast_un_ops::MINUS &&
+            static_cast<const ast_unminus_op &>(un).overflow_check)
+            return std::nullopt;
+        if (un.op == ast_un_ops::MINUS)
+            rhs->scale(-1u);
+        return rhs;
+    }
+    case node_types::BIN_OP:
+    {
+        auto &bin = static_cast<const ast_bin_op_t &>(node);
+        if ((bin.op != ast_bin_ops::PLUS && bin.op != ast_bin_ops::MINUS &&
+             bin.op != ast_bin_ops::MULTIPLICATION) ||
+            as_arith(bin)->overflow_check)
+            return std::nullopt;
+        auto lhs = affine_form(**bin.lhs), rhs = affine_form(**bin.rhs);
+        if (!lhs || !rhs)
+            return std::nullopt;
+        if (bin.op == ast_bin_ops::PLUS)
+            return lhs->add(*rhs);
+        if (bin.op == ast_bin_ops::MINUS)
+            return lhs->add(*rhs, -1u);
+        if (rhs->is_const())
+            return lhs->scale(rhs->free_term);
+        if (lhs->is_const())
+            return rhs->scale(lhs->free_term);
+        return std::nullopt;
+    }
+    default:
+        return std::nullopt;
+    }
+}
+
+// Condition iv rel bound of a loop, where iv is a variable the loop writes
+// and bound a pure expression of variables it does not write. A condition
+// bound rel iv is flipped.
+struct loop_test_t final {
+    std::string_view iv;
+    node_it bound;
+    ast_bin_ops rel;
+};
+
+inline std::optional<loop_test_t> loop_test(const ast_node_t &condition,
+                                            const names_t &writes)
+{
+    if (condition.nt != node_types::BIN_OP)
+        return std::nullopt;
+    auto &cond = static_cast<const ast_bin_op_t &>(condition);
+    ast_bin_ops rel = cond.op;
+    if (rel != ast_bin_ops::LESS && rel != ast_bin_ops::LESSEQ &&
+        rel != ast_bin_ops::GREATER && rel != ast_bin_ops::GREATEREQ &&
+        rel != ast_bin_ops::NOTEQUAL)
+        return std::nullopt;
+
+    auto is_iv = [&writes](const ast_node_t &n) {
+        return n.nt == node_types::VARIABLE &&
+               writes.contains(static_cast<const ast_var_t &>(n).name);
+    };
+    node_it iv_side = cond.lhs, bound = cond.rhs;
+    if (!is_iv(**iv_side))
+    {
+        std::swap(iv_side, bound);
+        rel = flip(rel);
+    }
+    names_t bound_reads;
+    collect_reads(**bound, bound_reads);
+    if (!is_iv(**iv_side) || !is_pure(**bound) ||
+        intersects(bound_reads, writes))
+        return std::nullopt;
+    return loop_test_t{static_cast<const ast_var_t &>(**iv_side).name, bound,
+                       rel};
+}
+
+// Step of x = x + c, x = c + x or x = x - c that wraps around.
+inline std::optional<int> step_of(const ast_bin_op_t &assign)
+{
+    if (assign.op != ast_bin_ops::ASSIGNMENT ||
+        (*assign.lhs)->nt != node_types::LVAL ||
+        (*assign.rhs)->nt != node_types::BIN_OP)
+        return std::nullopt;
+    std::string_view name = static_cast<const ast_lval_t &>(**assign.lhs).name;
+    auto &sum = static_cast<const ast_bin_op_t &>(**assign.rhs);
+    auto is_var = [name](const ast_node_t &n) {
+        return n.nt == node_types::VARIABLE &&
+               static_cast<const ast_var_t &>(n).name == name;
+    };
+    auto *lhs = sum.lhs->get(), *rhs = sum.rhs->get();
+    if (sum.op == ast_bin_ops::PLUS && !is_var(*lhs))
+        std::swap(lhs, rhs);
+    if ((sum.op != ast_bin_ops::PLUS && sum.op != ast_bin_ops::MINUS) ||
+        as_arith(sum)->overflow_check || !is_var(*lhs) ||
+        rhs->nt != node_types::NUMBER)
+        return std::nullopt;
+    int c = static_cast<const ast_num_t &>(*rhs).val;
+    if (sum.op == ast_bin_ops::MINUS)
+        c = static_cast<int>(-static_cast<unsigned>(c));
+    return c;
+}
+
+// Scalar evolution of print- and input-free loops: replaces a loop whose
+// body only assigns affine functions of the variables and whose condition
+// compares an induction variable with an invariant bound by its closed form.
+class closed_form_loops final {
+public:
+    // State variables of a loop, at most.
+    static constexpr std::size_t max_vars = 16;
+
+private:
+    struct assignment_t {
+        std::string_view var;
+        affine_expr_t value;
+    };
+
+    ast_t *ast_;
+    std::size_t closed_ = 0;
+
+private:
+    static std::optional<std::vector<assignment_t>>
+    body_assignments(const ast_node_t &body)
+    {
+        std::vector<const ast_node_t *> stmts;
+        if (body.nt == node_types::STATEMENTS)
+            for (auto &&s : static_cast<const ast_statements_t &>(body).seq)
+                stmts.push_back(&**s);
+        else
+            stmts.push_back(&body);
+
+        std::vector<assignment_t> res;
+        for (auto *s : stmts)
+        {
+            if (s->nt == node_types::EMPTY)
+                continue;
+            if (s->nt != node_types::BIN_OP)
+                return std::nullopt;
+            auto &assign = static_cast<const ast_bin_op_t &>(*s);
+            if (assign.op != ast_bin_ops::ASSIGNMENT ||
+                (*assign.lhs)->nt != node_types::LVAL)
+                return std::nullopt;
+            auto value = affine_form(**assign.rhs);
+            if (!value)
+                return std::nullopt;
+            res.push_back(
+                {static_cast<const ast_lval_t &>(**assign.lhs).name, *value});
+        }
+        return res;
+    }
+
+    std::optional<node_it> close(node_it loop_it) const
+    {
+        auto &loop = static_cast<const ast_while_t &>(**loop_it);
+        auto assignments = body_assignments(**loop.body);
+        if (!assignments)
+            return std::nullopt;
+        names_t writes;
+        for (auto &&a : *assignments)
+            writes.insert(a.var);
+
+        auto test = loop_test(**loop.condition, writes);
+        if (!test)
+            return std::nullopt;
+        auto [iv_name, bound, rel] = *test;
+
+        // State variables in order of appearance, with the ones whose first
+        // use in an iteration is a write marked as temporaries.
+        std::vector<ast_closed_loop_t::var_t> vars;
+        auto index = [&vars](std::string_view name, bool temp) {
+            auto it = std::find_if(vars.begin(), vars.end(),
+                                   [name](auto &&v) { return v.name == name; });
+            if (it == vars.end())
+                it = vars.insert(vars.end(), {name, temp});
+            return static_cast<std::size_t>(it - vars.begin());
+        };
+        index(iv_name, false);
+        for (auto &&a : *assignments)
+        {
+            for (auto &&c : a.value.coefs)
+                index(c.first, false);
+            index(a.var, true);
+        }
+        if (vars.size() > max_vars)
+            return std::nullopt;
+
+        std::size_t n = vars.size();
+        affine_map_t body(n + 1);
+        for (auto &&a : *assignments)
+        {
+            affine_map_t stmt(n + 1);
+            std::size_t row = index(a.var, true);
+            for (std::size_t col = 0; col <= n; ++col)
+                stmt.at(row, col) = 0;
+            for (auto &&c : a.value.coefs)
+                stmt.at(row, index(c.first, false)) = c.second;
+            stmt.at(row, n) = a.value.free_term;
+            body = stmt * body;
+        }
+
+        std::size_t iv = index(iv_name, false);
+        for (std::size_t col = 0; col < n; ++col)
+            if (body.at(iv, col) != (col == iv))
+                return std::nullopt;
+        int step = static_cast<int>(body.at(iv, n));
+        if (step == 0)
+            return std::nullopt;
+
+        return ast_->make_node<ast_closed_loop_t>(
+            loop_it, bound, rel, iv, step,
+            (*loop.body)->nt == node_types::STATEMENTS, std::move(vars),
+            std::move(body));
+    }
+
+    void process(node_it &edge)
+    {
+        for_each_edge(**edge, [this](node_it &e) { process(e); });
+        if ((*edge)->nt != node_types::WHILE)
+            return;
+        if (auto closed = close(edge))
+        {
+            edge = *closed;
+            ++closed_;
+        }
+    }
+
+public:
+    closed_form_loops(ast_t *ast) : ast_(ast) {}
+
+    std::size_t operator()(node_it root)
+    {
+        process(root);
+        return closed_;
+    }
+};
+
+// Strength reduction. An assignment x = x + c becomes a step of x. In a loop
+// that writes x by steps only, a product of x and a loop invariant is kept
+// as a running value the steps add to, so it is no longer multiplied.
+class strength_reduction final {
+    // Steps of every variable of a loop, by name.
+    using steps_t =
+        std::unordered_map<std::string_view, std::vector<ast_induction_t *>>;
+    // Running values by product. Identical products are one node.
+    using slots_t = std::unordered_map<const ast_node_t *,
+                                       std::shared_ptr<ast_reduction_slot_t>>;
+
+    struct loop_info_t {
+        steps_t steps;
+        names_t other_writes;
+    };
+
+    ast_t *ast_;
+    std::unordered_map<const ast_node_t *, loop_info_t> infos_;
+    // The enclosing loops with the running values of their products.
+    std::vector<std::pair<const ast_while_t *, slots_t>> loops_;
+    // Enclosing loops that write a name by steps and otherwise. A loop
+    // writes whatever the loops in it write, so they are the outermost ones.
+    std::unordered_map<std::string_view, std::size_t> stepping_, writing_;
+    std::size_t reduced_ = 0;
+
+private:
+    void make_steps(node_it &edge)
+    {
+        for_each_edge(**edge, [this](node_it &e) { make_steps(e); });
+        if ((*edge)->nt != node_types::BIN_OP)
+            return;
+        auto &assign = static_cast<const ast_bin_op_t &>(**edge);
+        if (auto step = step_of(assign))
+            edge = ast_->make_node<ast_induction_t>(
+                assign.lhs, assign.rhs, *step,
+                static_cast<const ast_assign_op &>(assign).offset);
+    }
+
+    // Steps of every variable of the loop and the variables it writes
+    // otherwise, found once for every loop from the ones of the loops in it.
+    const loop_info_t &info(const ast_while_t &loop)
+    {
+        if (auto it = infos_.find(&loop); it != infos_.end())
+            return it->second;
+        loop_info_t res;
+        auto add = [&res](const loop_info_t &inner) {
+            for (auto &&[name, steps] : inner.steps)
+            {
+                auto &all = res.steps[name];
+                all.insert(all.end(), steps.begin(), steps.end());
+            }
+            res.other_writes.insert(inner.other_writes.begin(),
+                                    inner.other_writes.end());
+        };
+        for_each_edge(static_cast<const ast_node_t &>(loop),
+                      [&](const node_it &e) {
+            walk(**e, [&](ast_node_t &n) {
+                if (n.nt == node_types::INDUCTION)
+                {
+                    auto &step = static_cast<ast_induction_t &>(n);
+                    res.steps[step.name].push_back(&step);
+                    return false;
+                }
+                if (n.nt == node_types::LVAL)
+                    res.other_writes.insert(
+                        static_cast<const ast_lval_t &>(n).name);
+                // A closed loop sets its variables without their steps.
+                if (n.nt == node_types::CLOSED_LOOP)
+                {
+                    collect_writes(n, res.other_writes);
+                    return false;
+                }
+                if (n.nt == node_types::WHILE)
+                {
+                    add(info(static_cast<const ast_while_t &>(n)));
+                    return false;
+                }
+                return true;
+            });
+        });
+        return infos_.emplace(&loop, std::move(res)).first->second;
+    }
+
+    // Number of the enclosing loops that write one of names, by steps or
+    // otherwise.
+    std::size_t writers(const names_t &names) const
+    {
+        std::size_t res = 0;
+        for (auto &&name : names)
+        {
+            if (auto it = stepping_.find(name); it != stepping_.end())
+                res = std::max(res, it->second);
+            if (auto it = writing_.find(name); it != writing_.end())
+                res = std::max(res, it->second);
+        }
+        return res;
+    }
+
+    // Index of the outermost enclosing loop that writes iv by steps only and
+    // not k, or the number of enclosing loops if there is none.
+    std::size_t level(const ast_node_t &iv, const ast_node_t &k) const
+    {
+        if (iv.nt != node_types::VARIABLE || !is_pure(k))
+            return loops_.size();
+        std::string_view name = static_cast<const ast_var_t &>(iv).name;
+        auto it = stepping_.find(name);
+        if (it == stepping_.end())
+            return loops_.size();
+        std::size_t lvl = 0;
+        if (auto other = writing_.find(name); other != writing_.end())
+            lvl = other->second;
+        names_t reads;
+        collect_reads(k, reads);
+        lvl = std::max(lvl, writers(reads));
+        return lvl < it->second ? lvl : loops_.size();
+    }
+
+    // Makes a running value of a product of a variable written by steps only
+    // and an invariant factor, on the outermost loop it is one in.
+    bool reduce_product(node_it &edge)
+    {
+        ast_node_t &n = **edge;
+        if (n.nt != node_types::BIN_OP ||
+            static_cast<const ast_bin_op_t &>(n).op !=
+                ast_bin_ops::MULTIPLICATION ||
+            as_arith(n)->overflow_check)
+            return false;
+        auto &bin = static_cast<const ast_bin_op_t &>(n);
+        node_it iv = bin.lhs, k = bin.rhs;
+        std::size_t lvl = level(**iv, **k);
+        if (std::size_t rhs_lvl = level(**k, **iv); rhs_lvl < lvl)
+        {
+            std::swap(iv, k);
+            lvl = rhs_lvl;
+        }
+        if (lvl == loops_.size())
+            return false;
+        auto &[loop, slots] = loops_[lvl];
+        auto &slot = slots[&n];
+        if (!slot)
+        {
+            slot = std::make_shared<ast_reduction_slot_t>();
+            slot->owner_epoch = &loop->epoch;
+            auto &steps = info(*loop).steps;
+            for (auto *step :
+                 steps.at(static_cast<const ast_var_t &>(**iv).name))
+                step->slots.push_back(slot);
+        }
+        edge = ast_->make_node<ast_reduced_expr_t>(edge, k, slot);
+        ++reduced_;
+        return true;
+    }
+
+    // A product of the variable of an outer loop is reduced on it, so it
+    // keeps its value through the inner ones.
+    void reduce(node_it &edge)
+    {
+        ast_node_t &n = **edge;
+        if (n.nt == node_types::INDUCTION || n.nt == node_types::REDUCED ||
+            (!loops_.empty() && reduce_product(edge)))
+            return;
+        // The children of a shared node are left as they are.
+        if (!loops_.empty() && ast_->shared(n))
+            return;
+        // The loops around a closed loop do not see the steps of the one in
+        // it, which is reduced on its own.
+        if (n.nt == node_types::CLOSED_LOOP)
+        {
+            auto loops = std::exchange(loops_, {});
+            auto stepping = std::exchange(stepping_, {});
+            auto writing = std::exchange(writing_, {});
+            for_each_edge(n, [this](node_it &e) { reduce(e); });
+            loops_ = std::move(loops);
+            stepping_ = std::move(stepping);
+            writing_ = std::move(writing);
+            return;
+        }
+        if (n.nt != node_types::WHILE)
+            return for_each_edge(n, [this](node_it &e) { reduce(e); });
+
+        auto &loop = static_cast<const ast_while_t &>(n);
+        auto &loop_info = info(loop);
+        for (auto &&step : loop_info.steps)
+            ++stepping_[step.first];
+        for (auto &&name : loop_info.other_writes)
+            ++writing_[name];
+        loops_.emplace_back(&loop, slots_t{});
+        for_each_edge(n, [this](node_it &e) { reduce(e); });
+        loops_.pop_back();
+        for (auto &&step : loop_info.steps)
+            if (--stepping_[step.first] == 0)
+                stepping_.erase(step.first);
+        for (auto &&name : loop_info.other_writes)
+            if (--writing_[name] == 0)
+                writing_.erase(name);
+    }
+
+public:
+    strength_reduction(ast_t *ast) : ast_(ast) {}
+
+    std::size_t operator()(node_it root)
+    {
+        make_steps(root);
+        reduce(root);
+        return reduced_;
+    }
+};
+
+// Unrolls counted loops by a factor that is larger the smaller their body
+// is: the test of the bound and the back edge are the overhead of every
+// iteration, which matters most for a small body.
+class loop_unrolling final {
+    static constexpr std::size_t max_factor = 8;
+    // Nodes of the body times the factor, at most.
+    static constexpr std::size_t max_nodes = 64;
+
+    ast_t *ast_;
+    summaries_t summaries_;
+    std::size_t unrolled_ = 0;
+
+private:
+    // The step of iv that ends the body, if it is the only write of iv.
+    const ast_induction_t *last_step(const ast_node_t &body,
+                                     std::string_view iv)
+    {
+        const ast_node_t *last = &body;
+        if (body.nt == node_types::STATEMENTS)
+        {
+            auto &seq = static_cast<const ast_statements_t &>(body).seq;
+            if (seq.empty())
+                return nullptr;
+            last = seq.back()->get();
+            for (auto it = seq.begin(); it != std::prev(seq.end()); ++it)
+                if (summaries_.writes(***it).contains(iv))
+                    return nullptr;
+        }
+        if (last->nt != node_types::INDUCTION ||
+            static_cast<const ast_induction_t *>(last)->name != iv)
+            return nullptr;
+        return static_cast<const ast_induction_t *>(last);
+    }
+
+    void process(node_it &edge)
+    {
+        for_each_edge(**edge, [this](node_it &e) { process(e); });
+        if ((*edge)->nt != node_types::WHILE)
+            return;
+        auto &loop = static_cast<const ast_while_t &>(**edge);
+        auto test = loop_test(**loop.condition, summaries_.writes(**loop.body));
+        if (!test)
+            return;
+        auto *step = last_step(**loop.body, test->iv);
+        if (!step || step->step == 0)
+            return;
+        std::size_t factor = std::min(
+            max_factor, max_nodes / subtree_size(**loop.body, max_nodes));
+        if (factor < 2)
+            return;
+        edge = ast_->make_node<ast_unrolled_loop_t>(
+            edge, test->bound, test->rel, test->iv, step->step, factor);
+        ++unrolled_;
+    }
+
+public:
+    loop_unrolling(ast_t *ast) : ast_(ast) {}
+
+    std::size_t operator()(node_it root)
+    {
+        process(root);
+        return unrolled_;
+    }
+};
+
+// Variables a statement assigns whenever it runs: the ones of the chain of
+// assignments a = b = ... it is.
+inline void collect_assigned(const ast_node_t &stmt, names_t &names)
+{
+    const ast_node_t *n = &stmt;
+    while (n->nt == node_types::BIN_OP &&
+           static_cast<const ast_bin_op_t *>(n)->op == ast_bin_ops::ASSIGNMENT)
+    {
+        auto &assign = static_cast<const ast_bin_op_t &>(*n);
+        names.insert(static_cast<const ast_lval_t &>(**assign.lhs).name);
+        n = assign.rhs->get();
+    }
+}
+
+// Adds the variables stmt assigns to defined, and the ones it did not have
+// to added.
+inline void define(const ast_node_t &stmt, names_t &defined,
+                   std::vector<std::string_view> &added)
+{
+    names_t assigned;
+    collect_assigned(stmt, assigned);
+    for (auto &&name : assigned)
+        if (defined.insert(name).second)
+            added.push_back(name);
+}
+
+// Statements that do the same whenever they run among the statements around
+// them: they neither read input, print, call a function nor loop, can not
+// fail, and read only the variables in defined or assigned by an earlier one
+// of them.
+inline bool quiet(const std::vector<node_it> &stmts, names_t defined)
+{
+    for (node_it stmt : stmts)
+    {
+        bool calm = true;
+        walk(**stmt, [&calm](const ast_node_t &n) {
+            switch (n.nt)
+            {
+            case node_types::NUMBER:
+            case node_types::VARIABLE:
+            case node_types::LVAL:
+            case node_types::BIN_OP:
+            case node_types::STATEMENTS:
+            case node_types::IF:
+            case node_types::IFELSE:
+            case node_types::EMPTY:
+                break;
+            case node_types::UN_OP:
+                calm = static_cast<const ast_un_op_t &>(n).op !=
+                       ast_un_ops::PRINT;
+                break;
+            default:
+                calm = false;
+                break;
+            }
+            return calm;
+        });
+        names_t reads;
+        collect_reads(**stmt, reads);
+        if (!calm || may_trap(**stmt) ||
+            !std::all_of(reads.begin(), reads.end(),
+                         [&defined](auto &&name) {
+                             return defined.contains(name);
+                         }))
+            return false;
+        collect_assigned(**stmt, defined);
+    }
+    return true;
+}
+
+// Assignment of an affine function of the variables, as closed form loops
+// are made of.
+inline bool affine_assignment(const ast_node_t &stmt)
+{
+    if (stmt.nt != node_types::BIN_OP)
+        return false;
+    auto &assign = static_cast<const ast_bin_op_t &>(stmt);
+    return assign.op == ast_bin_ops::ASSIGNMENT &&
+           (*assign.lhs)->nt == node_types::LVAL &&
+           affine_form(**assign.rhs).has_value();
+}
+
+// Loop of a sequence that is run right after an assignment of its counter,
+//     iv = init; while (iv rel bound) { ...; iv = iv + step; }
+// where init is pure and the body steps the counter last and nowhere else,
+// so that the loop runs as many times whenever it is run from there. The
+// statements are the ones of the body before the step.
+struct counted_loop_t final {
+    ast_while_t *loop;
+    ast_statements_t *body;
+    loop_test_t test;
+    int step;
+    std::vector<node_it> stmts;
+    names_t init_reads;
+
+    // Whether the loop ends whatever its bound is: an odd step takes the
+    // counter through every value, and the test fails on one of them.
+    bool ends() const
+    {
+        return step % 2 != 0 && test.rel != ast_bin_ops::LESSEQ &&
+               test.rel != ast_bin_ops::GREATEREQ;
+    }
+};
+
+inline std::optional<counted_loop_t>
+counted_loop(node_it init, node_it loop, summaries_t &summaries)
+{
+    if ((*init)->nt != node_types::BIN_OP || (*loop)->nt != node_types::WHILE)
+        return std::nullopt;
+    auto &assign = static_cast<const ast_bin_op_t &>(**init);
+    auto &whilest = static_cast<ast_while_t &>(**loop);
+    if (assign.op != ast_bin_ops::ASSIGNMENT || !is_pure(**assign.rhs) ||
+        (*whilest.body)->nt != node_types::STATEMENTS)
+        return std::nullopt;
+    auto &body = static_cast<ast_statements_t &>(**whilest.body);
+    if (body.seq.size() < 2 || (*body.seq.back())->nt != node_types::BIN_OP)
+        return std::nullopt;
+    auto &last = static_cast<const ast_bin_op_t &>(**body.seq.back());
+    auto step = step_of(last);
+    const names_t &writes = summaries.writes(body);
+    auto test = loop_test(**whilest.condition, writes);
+    auto name = [](node_it lval) {
+        return static_cast<const ast_lval_t &>(**lval).name;
+    };
+    if (!step || !test || name(assign.lhs) != test->iv ||
+        name(last.lhs) != test->iv)
+        return std::nullopt;
+
+    counted_loop_t res{&whilest, &body, *test, *step,
+                       {body.seq.begin(), std::prev(body.seq.end())}};
+    collect_reads(**assign.rhs, res.init_reads);
+    if (std::any_of(res.stmts.begin(), res.stmts.end(),
+                    [&summaries, &test](node_it stmt) {
+                        return summaries.writes(**stmt).contains(test->iv);
+                    }) ||
+        intersects(res.init_reads, writes))
+        return std::nullopt;
+    return res;
+}
+
+// Loop fusion. A counted loop right after another one with the same trip
+// count runs in its iterations:
+//     i = 0; while (i < n) { A; i = i + 1; }
+//     i = 0; while (i < n) { B; i = i + 1; }
+// becomes
+//     i = 0; while (i < n) { A; B; i = i + 1; }
+// which tests the bound and steps the counter once for both. Neither body
+// writes a variable the other one reads or writes, and one of them is
+// quiet, so only the other one does what can be seen and in the same order.
+// A loop that ends on any bound is needed for the quiet one to go first. The
+// loops whose bodies are affine are left to their closed forms.
+class loop_fusion final {
+    summaries_t summaries_;
+    std::size_t fused_ = 0;
+
+private:
+    static bool same(node_it lhs, node_it rhs)
+    {
+        auto key = expr_key(**lhs);
+        return key && key == expr_key(**rhs);
+    }
+    static bool scoped(const ast_statements_t &body)
+    {
+        return dynamic_cast<const ast_scope_t *>(&body) != nullptr;
+    }
+    static bool affine(const std::vector<node_it> &stmts)
+    {
+        return std::all_of(stmts.begin(), stmts.end(),
+                           [](node_it s) { return affine_assignment(**s); });
+    }
+    static node_it init_value(node_it init)
+    {
+        return static_cast<const ast_bin_op_t &>(**init).rhs;
+    }
+
+    // The names the statements of loop read and write.
+    void effects(const counted_loop_t &loop, names_t &reads, names_t &writes)
+    {
+        for (node_it stmt : loop.stmts)
+        {
+            auto &sum = summaries_(**stmt);
+            reads.insert(sum.reads.begin(), sum.reads.end());
+            writes.insert(sum.writes.begin(), sum.writes.end());
+        }
+    }
+
+    // Fuses the loops run from seq[k] and seq[k + 2]. The counter of the
+    // second one, if it has another, is assigned before the first one.
+    bool fuse(ast_statements_t::deque_t &seq, std::size_t k,
+              const names_t &defined)
+    {
+        auto first = counted_loop(seq[k], seq[k + 1], summaries_);
+        auto second = counted_loop(seq[k + 2], seq[k + 3], summaries_);
+        if (!first || !second || first->step != second->step ||
+            first->test.rel != second->test.rel ||
+            !same(first->test.bound, second->test.bound) ||
+            !same(init_value(seq[k]), init_value(seq[k + 2])) ||
+            scoped(*first->body) != scoped(*second->body))
+            return false;
+
+        std::string_view iv = first->test.iv, other_iv = second->test.iv;
+        names_t first_reads, first_writes, second_reads, second_writes;
+        effects(*first, first_reads, first_writes);
+        effects(*second, second_reads, second_writes);
+        if (second->init_reads.contains(iv) ||
+            intersects(second->init_reads, first_writes) ||
+            intersects(first_writes, second_reads) ||
+            intersects(first_writes, second_writes) ||
+            intersects(second_writes, first_reads))
+            return false;
+        if (other_iv != iv &&
+            (first->init_reads.contains(other_iv) ||
+             first_reads.contains(other_iv) ||
+             first_writes.contains(other_iv) ||
+             second_reads.contains(iv) || second_writes.contains(iv)))
+            return false;
+
+        names_t inner = defined;
+        inner.insert(iv);
+        bool first_quiet = quiet(first->stmts, inner);
+        inner.insert(other_iv);
+        bool second_quiet = quiet(second->stmts, inner);
+        if ((!first_quiet && !second_quiet) ||
+            (!second_quiet && !first->ends()) || affine(first->stmts) ||
+            affine(second->stmts))
+            return false;
+
+        auto &body = first->body->seq;
+        node_it step = body.back();
+        body.pop_back();
+        body.insert(body.end(), second->stmts.begin(), second->stmts.end());
+        body.push_back(step);
+        node_it other_init = seq[k + 2];
+        seq.erase(seq.begin() + k + 2, seq.begin() + k + 4);
+        if (other_iv != iv)
+        {
+            body.push_back(second->body->seq.back());
+            seq.insert(seq.begin() + k, other_init);
+        }
+        summaries_.forget(*first->body);
+        summaries_.forget(*first->loop);
+        return true;
+    }
+
+    // The names assigned before a statement are defined as it is
+    // processed, and the ones a sequence adds are removed after it.
+    void process(ast_node_t &node, names_t &defined)
+    {
+        if (node.nt != node_types::STATEMENTS)
+            return for_each_edge(node, [this, &defined](node_it &e) {
+                process(**e, defined);
+            });
+        auto &seq = static_cast<ast_statements_t &>(node).seq;
+        std::vector<std::string_view> added;
+        for (std::size_t k = 0; k < seq.size(); ++k)
+        {
+            while (k + 3 < seq.size() && fuse(seq, k, defined))
+                ++fused_;
+            process(**seq[k], defined);
+            define(**seq[k], defined, added);
+        }
+        for (auto &&name : added)
+            defined.erase(name);
+    }
+
+public:
+    // Returns the number of loops fused into others.
+    std::size_t operator()(node_it root)
+    {
+        names_t defined;
+        process(**root, defined);
+        return fused_;
+    }
+};
+
+// Loop fission. The affine assignments of a counted loop that neither
+// depend on the rest of its body nor the rest on them are split off to a
+// loop of their own, run before the rest, which is run from the assignment
+// of the counter again:
+//     i = 0; while (i < n) { x = ?; s = s + 2 * i; t = t + x; i = i + 1; }
+// becomes
+//     i = 0; while (i < n) { s = s + 2 * i; i = i + 1; }
+//     i = 0; while (i < n) { x = ?; t = t + x; i = i + 1; }
+// and the first loop is replaced by its closed form then. The assignments
+// split off are quiet, so what can be seen is done in the same order, if
+// the loop ends on any bound.
+class loop_fission final {
+    ast_t *ast_;
+    summaries_t summaries_;
+    std::size_t split_ = 0;
+
+private:
+    // Which statements are split off. Every one reads only variables in
+    // defined or assigned by an earlier one of them.
+    std::vector<bool> part(const counted_loop_t &loop, names_t &defined)
+    {
+        std::vector<bool> moved(loop.stmts.size());
+        std::vector<std::size_t> kept;
+        for (std::size_t i = 0; i < moved.size(); ++i)
+        {
+            moved[i] = affine_assignment(**loop.stmts[i]);
+            if (!moved[i])
+                kept.push_back(i);
+        }
+        // The statements left grow from round to round, as do their names.
+        names_t rest_reads, rest_writes;
+        do
+        {
+            for (std::size_t i : kept)
+            {
+                auto &rest = summaries_(**loop.stmts[i]);
+                rest_reads.insert(rest.reads.begin(), rest.reads.end());
+                rest_writes.insert(rest.writes.begin(), rest.writes.end());
+            }
+            kept.clear();
+            std::vector<std::string_view> added;
+            for (std::size_t i = 0; i < moved.size(); ++i)
+            {
+                if (!moved[i])
+                    continue;
+                auto &[reads, writes, pure] = summaries_(**loop.stmts[i]);
+                if (!std::all_of(reads.begin(), reads.end(),
+                                 [&defined](auto &&name) {
+                                     return defined.contains(name);
+                                 }) ||
+                    intersects(writes, rest_reads) ||
+                    intersects(writes, rest_writes) ||
+                    intersects(reads, rest_writes))
+                {
+                    moved[i] = false;
+                    kept.push_back(i);
+                    continue;
+                }
+                for (auto &&name : writes)
+                    if (defined.insert(name).second)
+                        added.push_back(name);
+            }
+            for (auto &&name : added)
+                defined.erase(name);
+        } while (!kept.empty());
+        return moved;
+    }
+
+    // Splits the loop run from seq[k].
+    bool split(ast_statements_t::deque_t &seq, std::size_t k,
+               names_t &defined)
+    {
+        auto loop = counted_loop(seq[k], seq[k + 1], summaries_);
+        if (!loop || !loop->ends())
+            return false;
+        bool fresh = defined.insert(loop->test.iv).second;
+        auto moved = part(*loop, defined);
+        if (fresh)
+            defined.erase(loop->test.iv);
+        std::vector<node_it> stmts, rest;
+        names_t vars{loop->test.iv};
+        for (std::size_t i = 0; i < moved.size(); ++i)
+        {
+            if (!moved[i])
+            {
+                rest.push_back(loop->stmts[i]);
+                continue;
+            }
+            stmts.push_back(loop->stmts[i]);
+            collect_reads(**stmts.back(), vars);
+            collect_writes(**stmts.back(), vars);
+        }
+        if (stmts.empty() || rest.empty() ||
+            vars.size() > closed_form_loops::max_vars)
+            return false;
+
+        auto &whilest = *loop->loop;
+        auto &body = *loop->body;
+        auto &step = static_cast<const ast_assign_op &>(**body.seq.back());
+        auto &init = static_cast<const ast_assign_op &>(**seq[k]);
+        node_it part_body = ast_->make_node<ast_statements_t>();
+        auto &part_seq = static_cast<ast_statements_t &>(**part_body).seq;
+        part_seq.assign(stmts.begin(), stmts.end());
+        part_seq.push_back(ast_->make_node<ast_assign_op>(
+            ast_->share(step.lhs), ast_->share(step.rhs), step.offset));
+        if (auto *scope = dynamic_cast<const ast_scope_t *>(&body))
+            part_body = ast_->make_node<ast_scope_t>(part_body, scope->offset);
+        node_it part_loop = ast_->make_node<ast_while_t>(
+            ast_->share(whilest.condition), part_body, whilest.offset);
+        node_it again = ast_->make_node<ast_assign_op>(
+            ast_->share(init.lhs), ast_->share(init.rhs), init.offset);
+
+        rest.push_back(body.seq.back());
+        body.seq.assign(rest.begin(), rest.end());
+        seq.insert(seq.begin() + k + 1, {part_loop, again});
+        summaries_.forget(body);
+        summaries_.forget(whilest);
+        return true;
+    }
+
+    // As the one of loop fusion.
+    void process(ast_node_t &node, names_t &defined)
+    {
+        if (node.nt != node_types::STATEMENTS)
+            return for_each_edge(node, [this, &defined](node_it &e) {
+                process(**e, defined);
+            });
+        auto &seq = static_cast<ast_statements_t &>(node).seq;
+        std::vector<std::string_view> added;
+        for (std::size_t k = 0; k < seq.size(); ++k)
+        {
+            if (k + 1 < seq.size() && split(seq, k, defined))
+                ++split_;
+            process(**seq[k], defined);
+            define(**seq[k], defined, added);
+        }
+        for (auto &&name : added)
+            defined.erase(name);
+    }
+
+public:
+    loop_fission(ast_t *ast) : ast_(ast) {}
+
+    // Returns the number of loops split.
+    std::size_t operator()(node_it root)
+    {
+        names_t defined;
+        process(**root, defined);
+        return split_;
+    }
+};
+
+} // namespace AST
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "AST.h"
+#include "AST_analysis.h"
+#include "AST_optimizer.h"
+
+#include <optional>
+#include <unordered_set>
+#include <vector>
+
+namespace AST {
+
+// Marks the statements that may run at the same time as their neighbours,
+// in the sequences that run once per run of the program, outside of loops
+// and functions. Such a statement has a loop, so it is worth a thread,
+// reads no input and calls no function, and every cache it uses is kept
+// for a loop or sequence of its own. Which of them are independent is found
+// when they run, from the variables there are then.
+class task_parallelism final {
+    std::size_t tasks_ = 0;
+
+    static std::optional<task_t> task(const ast_node_t &stmt)
+    {
+        bool loop = false, serial = false;
+        std::unordered_set<const unsigned long *> epochs;
+        std::vector<const unsigned long *> owners;
+        walk(stmt, [&](const ast_node_t &n) {
+            switch (n.nt)
+            {
+            case node_types::WHILE:
+                loop = true;
+                epochs.insert(&static_cast<const ast_while_t &>(n).epoch);
+                break;
+            case node_types::STATEMENTS:
+                epochs.insert(&static_cast<const ast_statements_t &>(n).epoch);
+                break;
+            case node_types::CACHED:
+                owners.push_back(
+                    static_cast<const ast_cached_expr_t &>(n).owner_epoch);
+                break;
+            case node_types::REDUCED:
+            {
+                auto &reduced = static_cast<const ast_reduced_expr_t &>(n);
+                owners.push_back(reduced.slot->owner_epoch);
+                break;
+            }
+            case node_types::INDUCTION:
+            {
+                auto &induction = static_cast<const ast_induction_t &>(n);
+                for (auto &&slot : induction.slots)
+                    owners.push_back(slot->owner_epoch);
+                break;
+            }
+            case node_types::WRITE:
+            case node_types::CALL:
+                serial = true;
+                break;
+            default:
+                break;
+            }
+            return !serial;
+        });
+        if (!loop || serial)
+            return std::nullopt;
+        for (auto *owner : owners)
+            if (!epochs.contains(owner))
+                return std::nullopt;
+        task_t res;
+        collect_reads(stmt, res.reads);
+        collect_writes(stmt, res.writes);
+        res.scope = dynamic_cast<const ast_scope_t *>(&stmt) != nullptr;
+        return res;
+    }
+
+    void process(ast_node_t &node)
+    {
+        if (node.nt == node_types::IF || node.nt == node_types::IFELSE)
+            return for_each_edge(node, [this](node_it e) { process(**e); });
+        if (node.nt != node_types::STATEMENTS)
+            return;
+        auto &stmts = static_cast<ast_statements_t &>(node);
+        std::size_t tasks = 0;
+        stmts.tasks.clear();
+        for (auto &&e : stmts.seq)
+        {
+            stmts.tasks.push_back(task(**e));
+            tasks += stmts.tasks.back().has_value();
+            process(**e);
+        }
+        if (tasks < 2)
+            stmts.tasks.clear();
+        else
+            tasks_ += tasks;
+    }
+
+public:
+    // Returns the number of statements marked.
+    std::size_t operator()(ast_node_t &root)
+    {
+        if (depth(root) > ast_optimizer_t::max_depth)
+            return 0;
+        process(root);
+        return tasks_;
+    }
+};
+
+} // namespace AST
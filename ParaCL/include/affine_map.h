@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace AST {
+
+// Affine map x -> M x of a state vector whose last component is the constant
+// 1. Arithmetic is modulo 2^32, which is exactly the wrap-around arithmetic of
+// the interpreter's 32-bit int.
+class affine_map_t final {
+    std::size_t dim_;
+    std::vector<std::uint32_t> m_;
+
+public:
+    using value_type = std::uint32_t;
+    using vector_t = std::vector<value_type>;
+
+    explicit affine_map_t(std::size_t dim = 1) : dim_(dim), m_(dim * dim)
+    {
+        for (std::size_t i = 0; i < dim_; ++i)
+            at(i, i) = 1;
+    }
+
+    std::size_t dim() const { return dim_; }
+    value_type &at(std::size_t row, std::size_t col)
+    {
+        return m_[row * dim_ + col];
+    }
+    value_type at(std::size_t row, std::size_t col) const
+    {
+        return m_[row * dim_ + col];
+    }
+
+    affine_map_t operator*(const affine_map_t &rhs) const
+    {
+        assert(dim_ == rhs.dim_);
+        affine_map_t res(dim_);
+        for (std::size_t i = 0; i < dim_; ++i)
+            for (std::size_t j = 0; j < dim_; ++j)
+            {
+                value_type sum = 0;
+                for (std::size_t k = 0; k < dim_; ++k)
+                    sum += at(i, k) * rhs.at(k, j);
+                res.at(i, j) = sum;
+            }
+        return res;
+    }
+
+    affine_map_t pow(std::uint64_t e) const
+    {
+        affine_map_t res(dim_), base = *this;
+        for (; e; e >>= 1)
+        {
+            if (e & 1)
+                res = base * res;
+            base = base * base;
+        }
+        return res;
+    }
+
+    vector_t apply(const vector_t &x) const
+    {
+        assert(x.size() == dim_);
+        vector_t res(dim_);
+        for (std::size_t i = 0; i < dim_; ++i)
+            for (std::size_t k = 0; k < dim_; ++k)
+                res[i] += at(i, k) * x[k];
+        return res;
+    }
+};
+
+} // namespace AST
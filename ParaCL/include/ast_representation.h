@@ -1,26 +1,130 @@
 #pragma once
 
+#include <algorithm>
 #include <list>
+#include <optional>
+#include <sstream>
+#include <string>
 #include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "AST.h"
 #include "AST_dumper.h"
+#include "AST_optimizer.h"
+#include "AST_tasks.h"
+#include "checkpoint.h"
+#include "memory.h"
+#include "prefix.h"
 #include "symbol_table.h"
 
 namespace AST {
 
 class ast_representation_t final {
-    ast_t ast_;
-    symbol_table_t st_;
-
 public:
     using node_it = typename ast_t::node_it;
     using iterator = typename symbol_table_t::iterator;
 
-    ast_representation_t() : ast_() {}
+private:
+    // Names of the function being parsed. Every name takes a slot of the
+    // frame for the whole function and is visible in the scope that assigns
+    // it first, like a variable of the program.
+    struct function_scope_t {
+        ast_func_t *fn;
+        std::vector<std::string> slots;
+        std::vector<std::size_t> visible;
+        std::vector<std::size_t> scopes;
+
+        std::optional<std::size_t> find(std::string_view name) const
+        {
+            for (std::size_t slot : visible)
+                if (slots[slot] == name)
+                    return slot;
+            return std::nullopt;
+        }
+    };
+
+    program_memory_t memory_;
+    ast_t ast_;
+    symbol_table_t st_;
+    opt_report_t opt_report_;
+    std::optional<run_counters_t> counters_;
+    std::optional<run_budget_t> budget_;
+    std::optional<run_snapshots_t> snapshots_;
+    std::optional<run_tasks_t> tasks_;
+    std::optional<run_trace_t> trace_;
+    std::unordered_map<std::string, const ast_func_t *> functions_;
+    std::optional<function_scope_t> function_;
+    // Nodes of the program and its functions, which streamed statements do
+    // not release, and the names declared so far: an interactive session
+    // falls back to them when a statement does not compile.
+    std::size_t kept_nodes_ = 0, kept_names_ = 0;
+    // Variables assigned for the first time by the assignments being parsed,
+    // which do not exist yet when their right hand sides are evaluated.
+    std::vector<std::string> assigning_;
+    bool memoize_ = false;
+    bool check_overflow_ = false;
+    bool interactive_ = false;
+    bool streaming_;
+
+    run_counters_t *counters() { return counters_ ? &*counters_ : nullptr; }
+    run_budget_t *budget() { return budget_ ? &*budget_ : nullptr; }
+    run_snapshots_t *snapshots()
+    {
+        return snapshots_ ? &*snapshots_ : nullptr;
+    }
+    run_tasks_t *tasks() { return tasks_ ? &*tasks_ : nullptr; }
+    run_trace_t *trace() { return trace_ ? &*trace_ : nullptr; }
+    void keep()
+    {
+        kept_nodes_ = ast_.size();
+        kept_names_ = st_.size();
+    }
+
+public:
+    ast_representation_t(bool streaming = false)
+        : memory_(streaming), ast_(memory_.parse()), st_(memory_.run()),
+          streaming_(streaming)
+    {}
     const symbol_table_t &get_st() const { return st_; }
     const IIast_t &get_ast() const { return ast_; }
+    const opt_report_t &get_opt_report() const { return opt_report_; }
+    const program_memory_t &get_memory() const { return memory_; }
+    const std::array<std::size_t, node_types_count> &get_made_nodes() const
+    {
+        return ast_.made();
+    }
+    const std::optional<run_counters_t> &get_counters() const
+    {
+        return counters_;
+    }
+    const std::optional<run_trace_t> &get_trace() const { return trace_; }
+
+    // Counts what the program does when it runs.
+    void count_runs() { counters_.emplace(); }
+    // Stops the program once it exceeds the budget. The time limit runs
+    // from now.
+    void limit(const run_budget_t &budget)
+    {
+        budget_.emplace(budget);
+        budget_->start();
+    }
+
+    // Saves the state of the run when snapshots asks for it.
+    void snapshot(run_snapshots_t snapshots)
+    {
+        snapshots_.emplace(std::move(snapshots));
+    }
+    // Records the input and output of the run, or replays those of trace.
+    void record(run_trace_t trace = {}) { trace_.emplace(std::move(trace)); }
+    // Memoizes the pure functions defined from now on.
+    void memoize() { memoize_ = true; }
+    // Fails the run on arithmetic that overflows instead of wrapping around.
+    void check_overflow() { check_overflow_ = true; }
+    // Runs the statements of several parses, one after another, in the same
+    // scope of the program.
+    void interact() { interactive_ = streaming_ = true; }
 
     void set_root(node_it root) { return ast_.set_root(root); }
 
@@ -34,30 +138,346 @@ public:
         return ast_.make_node<T, Args...>(std::forward<Args>(args)..., st_);
     }
 
-    void pop_scope() { st_.pop_scope(); }
-    void emplace_scope() { st_.emplace_scope(); }
+    void add_statement(node_it stmts, node_it stmt)
+    {
+        static_pointer_cast<ast_statements_t>(*stmts)->seq.push_back(stmt);
+    }
+
+    // A streamed statement is run as soon as it is parsed and its nodes are
+    // released, so the tree never holds more than one top level statement.
+    void add_top_statement(node_it stmts, node_it stmt)
+    {
+        if (!streaming_)
+            return add_statement(stmts, stmt);
+        auto seq = make_node<ast_statements_t>();
+        add_statement(seq, stmt);
+        ast_optimizer_t{}(ast_, seq, opt_report_);
+        if (!interactive_)
+            (*seq)->Iprocess(st_, counters(), budget());
+        else
+            run_or_undo(seq);
+        ast_.truncate(kept_nodes_);
+        keep();
+    }
+    // An interactive statement that fails as it runs leaves the variables as
+    // they were before it, though what it looked up is counted.
+    void run_or_undo(node_it seq)
+    {
+        st_.mark();
+        try
+        {
+            (*seq)->Iprocess(st_, counters(), budget());
+        }
+        catch (const ExceptsPCL::run_error &)
+        {
+            st_.rollback();
+            throw;
+        }
+        st_.commit();
+    }
+
+    // Statements of the program, in its scope.
+    node_it begin_program()
+    {
+        if (!interactive_ || st_.depth() == 0)
+            st_.emplace_scope();
+        auto stmts = make_node<ast_statements_t>();
+        keep();
+        return stmts;
+    }
+    void end_program() { st_.pop_scope(); }
+    // Drops what the statement that failed to compile or run has made: a
+    // function it began, its scopes, names and nodes.
+    void recover()
+    {
+        if (function_)
+        {
+            functions_.erase(function_->fn->name);
+            ast_.remove_function();
+            function_.reset();
+        }
+        assigning_.clear();
+        while (st_.depth() > 1)
+            st_.pop_scope();
+        st_.truncate(kept_names_);
+        ast_.truncate(kept_nodes_);
+    }
+
+    void pop_scope()
+    {
+        if (!function_)
+            return st_.pop_scope();
+        function_->visible.resize(function_->scopes.back());
+        function_->scopes.pop_back();
+    }
+    void emplace_scope()
+    {
+        if (!function_)
+            return st_.emplace_scope();
+        function_->scopes.push_back(function_->visible.size());
+    }
+
+    // The body of a function is parsed in a scope of its own, which sees
+    // the parameters but no variable of the program.
+    void begin_function(std::string_view name,
+                        const std::vector<std::string> &params)
+    {
+        if (functions_.contains(std::string{name}))
+            throw ExceptsPCL::compilation_error("Redefinition of function " +
+                                                std::string{name});
+        auto fn = make_node<ast_func_t>(name, params.size());
+        function_.emplace();
+        function_->fn = static_cast<ast_func_t *>(fn->get());
+        functions_.emplace(name, function_->fn);
+        ast_.add_function(fn);
+        for (auto &&param : params)
+        {
+            if (function_->find(param))
+                throw ExceptsPCL::compilation_error(
+                    "Redefinition of parameter " + param);
+            function_->visible.push_back(function_->slots.size());
+            function_->slots.push_back(param);
+        }
+    }
+    void end_function(node_it body)
+    {
+        ast_func_t &fn = *function_->fn;
+        fn.body = body;
+        fn.slots = function_->slots.size();
+        fn.pure = true;
+        walk(**body, [&fn](const ast_node_t &n) {
+            if (n.nt == node_types::WRITE ||
+                (n.nt == node_types::UN_OP &&
+                 static_cast<const ast_un_op_t &>(n).op == ast_un_ops::PRINT))
+                fn.pure = false;
+            if (n.nt == node_types::CALL)
+            {
+                auto *callee = static_cast<const ast_call_t &>(n).fn;
+                fn.pure &= callee == &fn || callee->pure;
+            }
+            return fn.pure;
+        });
+        if (memoize_ && fn.pure)
+            fn.memo.emplace(memory_.run());
+        // The whole program is optimized at once, but a streamed one never
+        // is.
+        if (streaming_)
+            ast_optimizer_t{}(ast_, fn, opt_report_);
+        function_.reset();
+        keep();
+    }
+
+    // Defines a function read from a module artifact, whose variables are
+    // resolved to its slots already. build makes its body once it is
+    // begun.
+    template <typename F>
+    void define_function(std::string_view name,
+                         const std::vector<std::string> &params,
+                         std::size_t slots, F &&build)
+    {
+        begin_function(name, params);
+        function_->slots.resize(std::max(slots, function_->slots.size()));
+        end_function(build());
+    }
+    const ast_func_t *find_function(std::string_view name) const
+    {
+        auto it = functions_.find(std::string{name});
+        return it == functions_.end() ? nullptr : it->second;
+    }
+
+    node_it make_var(std::string_view name)
+    {
+        if (std::find(assigning_.begin(), assigning_.end(), name) !=
+            assigning_.end())
+            throw ExceptsPCL::compilation_error("Undefined variable: " +
+                                                std::string{name});
+        if (!function_)
+            return make_node_st<ast_var_t>(name);
+        if (auto slot = function_->find(name))
+            return make_node<ast_local_t>(name, *slot);
+        throw ExceptsPCL::compilation_error("Undefined variable: " +
+                                            std::string{name});
+    }
+    node_it make_lval(std::string_view name)
+    {
+        if (!function_)
+        {
+            std::size_t names = st_.size();
+            auto lval = make_node_st<ast_lval_t>(name);
+            if (st_.size() != names)
+                assigning_.emplace_back(name);
+            return lval;
+        }
+        auto slot = function_->find(name);
+        if (!slot)
+        {
+            auto &slots = function_->slots;
+            slot = static_cast<std::size_t>(
+                std::find(slots.begin(), slots.end(), name) - slots.begin());
+            if (*slot == slots.size())
+                slots.emplace_back(name);
+            function_->visible.push_back(*slot);
+            assigning_.emplace_back(name);
+        }
+        return make_node<ast_local_t>(name, *slot);
+    }
+    node_it make_assign(node_it lhs, node_it rhs, std::size_t offset)
+    {
+        bool local = (*lhs)->nt == node_types::LOCAL;
+        std::string_view name =
+            local ? static_cast<const ast_local_t &>(**lhs).name
+                  : static_cast<const ast_lval_t &>(**lhs).name;
+        if (!assigning_.empty() && assigning_.back() == name)
+            assigning_.pop_back();
+        if (local)
+            return make_node<ast_local_assign_t>(lhs, rhs);
+        return make_node<ast_assign_op>(lhs, rhs, offset);
+    }
+    // Arithmetic operator, with overflow checks if they are asked for.
+    template <typename T, typename... Args> node_it make_arith(Args &&... args)
+    {
+        return make_node<T>(std::forward<Args>(args)..., check_overflow_);
+    }
+    // A block of a function is no scope of the symbol table.
+    node_it make_scope(node_it stmts, std::size_t offset)
+    {
+        if (function_)
+            return stmts;
+        return make_node<ast_scope_t>(stmts, offset);
+    }
+    node_it make_call(std::string_view name, std::vector<node_it> args,
+                      std::size_t offset)
+    {
+        auto it = functions_.find(std::string{name});
+        if (it == functions_.end())
+            throw ExceptsPCL::compilation_error("Undefined function: " +
+                                                std::string{name});
+        if (args.size() != it->second->params)
+            throw ExceptsPCL::compilation_error(
+                "Function " + std::string{name} + " takes " +
+                std::to_string(it->second->params) + " arguments");
+        return make_node<ast_call_t>(it->second, std::move(args), offset);
+    }
+    // A call returned at once is a tail call.
+    node_it make_return(node_it expr)
+    {
+        if (!function_)
+            throw ExceptsPCL::compilation_error("Return outside of a function");
+        if ((*expr)->nt == node_types::CALL)
+            static_cast<ast_call_t &>(**expr).tail = true;
+        return make_node<ast_return_t>(expr);
+    }
+
     iterator add_name(std::string_view name) { return st_.add_name(name); }
     bool is_in_symbol_table(std::string_view name) const
     {
-        return st_.find(std::string{name}) != st_.cend();
+        return st_.contains(name);
+    }
+
+    void optimize() { opt_report_ = ast_optimizer_t{}(ast_); }
+    // Optimizes the functions, then every loop that is in no other loop on
+    // its own, since a run may switch to it at any iteration. ready is
+    // called with the offset of each loop in the source and its optimized
+    // form, which may run at once.
+    template <typename F> void optimize_loops(F &&ready)
+    {
+        for (auto &&fn : ast_.functions())
+            ast_optimizer_t{}(ast_, static_cast<ast_func_t &>(**fn),
+                              opt_report_);
+        for (node_it loop : outer_loops(ast_.root()))
+        {
+            auto seq = make_node<ast_statements_t>();
+            add_statement(seq, loop);
+            auto &whilest = static_cast<const ast_while_t &>(**loop);
+            ast_optimizer_t{}(ast_, seq, opt_report_);
+            ready(whilest.offset, **seq);
+        }
+    }
+    // Runs the independent statements with loops of the optimized program
+    // on threads at the same time. A run with limits or a trace is not
+    // parallel.
+    void parallelize(unsigned threads)
+    {
+        tasks_.emplace(run_tasks_t{threads});
+        task_parallelism{}(**ast_.root_it());
+    }
+    void execute()
+    {
+        ast_.execute(st_, counters(), budget(), snapshots(), tasks(),
+                     trace());
+    }
+    // Runs the program on from the state saved to is.
+    void resume(const checkpoint_t &checkpoint, std::istream &is)
+    {
+        ast_machine_t m{st_, counters(), budget(), snapshots()};
+        checkpoint.load(is, m);
+        if (!m.done())
+            m.resume();
     }
 
-    void execute() { ast_.execute(st_); }
+    // Runs the program on a copy of its variables up to the first value ?
+    // reads, or to its end, within max_steps loop iterations and scope
+    // entries. The state of the run there is saved with checkpoint, and
+    // what it printed is kept. A prefix that takes longer or fails is left
+    // empty.
+    run_prefix_t run_prefix(const checkpoint_t &checkpoint,
+                            std::uint64_t max_steps)
+    {
+        struct paused_t {};
+        symbol_table_t st = st_;
+        run_budget_t budget;
+        budget.max_steps = max_steps;
+        std::ostringstream out, state;
+        run_snapshots_t snapshots;
+        snapshots.before_read = true;
+        snapshots.save = [&checkpoint, &state](const ast_machine_t &m) {
+            checkpoint.save(state, m);
+            throw paused_t{};
+        };
+        ast_machine_t m{st, nullptr, &budget, &snapshots};
+        m.output(&out);
+        try
+        {
+            m.run(ast_.root());
+            checkpoint.save(state, m);
+        }
+        catch (const paused_t &)
+        {}
+        catch (const ExceptsPCL::paracl_error &)
+        {
+            return {};
+        }
+        return {out.str(), state.str()};
+    }
+    // Prints what prefix printed and runs the program on from its state.
+    void resume(const checkpoint_t &checkpoint, const run_prefix_t &prefix)
+    {
+        if (prefix.state.empty())
+            return execute();
+        std::cout << prefix.output;
+        std::istringstream is(prefix.state);
+        resume(checkpoint, is);
+    }
 };
 
 class astr_dumper final {
     ast_dumper ast_dumper_;
     symbol_table_dumper st_dumper_;
+    opt_report_dumper opt_dumper_;
 
 public:
-    astr_dumper(std::ostream *ast_stream, std::ostream *st_stream = &std::cout)
-        : ast_dumper_(ast_stream), st_dumper_(st_stream)
+    astr_dumper(std::ostream *ast_stream, std::ostream *st_stream = &std::cout,
+                std::ostream *opt_stream = &std::cout,
+                dump_format_t format = dump_format_t::dot)
+        : ast_dumper_(ast_stream, format), st_dumper_(st_stream, format),
+          opt_dumper_(opt_stream, format)
     {}
 
     void operator()(const ast_representation_t &astr) const
     {
         ast_dumper_(astr.get_ast());
         st_dumper_(astr.get_st());
+        opt_dumper_(astr.get_opt_report());
     }
 };
 
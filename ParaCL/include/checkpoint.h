@@ -0,0 +1,230 @@
+#pragma once
+
+#include "AST.h"
+#include "AST_analysis.h"
+#include "driver_exceptions.h"
+#include "symbol_table.h"
+#include "varint.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace AST {
+
+// FNV-1a hash of the program text, which a checkpoint must match.
+inline std::uint64_t program_hash(std::string_view text)
+{
+    std::uint64_t h = 0xcbf29ce484222325;
+    for (unsigned char c : text)
+        h = (h ^ c) * 0x100000001b3;
+    return h;
+}
+
+// State of a run paused at a loop back edge: the program it belongs to,
+// the number of values read by ?, the variables of every scope, the frames
+// and values of the machine and the running calls. Nodes are numbered in
+// pre-order of the optimized tree, which is the same for every run of the
+// same program by the same build. Integers are varints.
+class checkpoint_t final {
+    static constexpr std::string_view magic = "PCLSTAT1";
+
+    using reader_t = varint_reader_t<ExceptsPCL::checkpoint_error>;
+
+    const IIast_t &ast_;
+    std::uint64_t program_;
+    mutable std::vector<const ast_node_t *> nodes_{nullptr};
+    mutable std::string image_;
+
+    // Numbers the nodes from 1 once, the first time a checkpoint is saved
+    // or loaded. A shared node keeps the number of its first occurrence.
+    void number() const
+    {
+        if (nodes_.size() > 1)
+            return;
+        std::vector<const ast_node_t *> stack;
+        const auto &functions = ast_.functions();
+        for (auto it = functions.rbegin(); it != functions.rend(); ++it)
+            stack.push_back((*it)->get());
+        stack.push_back(&ast_.root());
+        while (!stack.empty())
+        {
+            const ast_node_t *node = stack.back();
+            stack.pop_back();
+            if (node->id)
+                continue;
+            node->id = static_cast<std::uint32_t>(nodes_.size());
+            nodes_.push_back(node);
+            std::size_t top = stack.size();
+            for_each_edge(*node, [&stack](const node_it &child) {
+                stack.push_back(child->get());
+            });
+            // The bound of a closed or unrolled loop is evaluated but is no
+            // edge.
+            if (node->nt == node_types::CLOSED_LOOP)
+                stack.push_back(
+                    static_cast<const ast_closed_loop_t *>(node)->bound->get());
+            if (node->nt == node_types::UNROLLED_LOOP)
+                stack.push_back(
+                    static_cast<const ast_unrolled_loop_t *>(node)
+                        ->bound->get());
+            std::reverse(stack.begin() + top, stack.end());
+        }
+    }
+
+public:
+    checkpoint_t(const IIast_t &ast, std::uint64_t program)
+        : ast_(ast), program_(program)
+    {}
+
+    void save(std::ostream &os, const ast_machine_t &m) const
+    {
+        number();
+        std::string &out = image_;
+        out.assign(magic);
+        put_varint(out, program_);
+        put_varint(out, nodes_.size());
+        put_varint(out, m.reads_);
+
+        const symbol_table_t &st = m.st_;
+        put_varint(out, st.scopes().size());
+        for (std::size_t mark : st.scopes())
+            put_varint(out, mark);
+        put_varint(out, st.size());
+        for (const auto &entry : st)
+        {
+            auto name = st.name(entry);
+            put_varint(out, name.size());
+            out.append(name);
+            put_zigzag(out, entry.second);
+        }
+
+        put_varint(out, m.frames_.size());
+        for (auto &&frame : m.frames_)
+        {
+            put_varint(out, frame.node->id);
+            put_varint(out, frame.pc);
+        }
+        put_varint(out, m.values_.size());
+        for (auto &&val : m.values_)
+        {
+            if (auto *num = std::get_if<int>(&val))
+            {
+                put_varint(out, 0);
+                put_zigzag(out, *num);
+            }
+            else
+            {
+                put_varint(out, 1);
+                put_varint(out, std::get<IIterator>(val).index());
+            }
+        }
+        put_varint(out, m.calls_.size());
+        for (auto &&call : m.calls_)
+        {
+            put_varint(out, call.fn->id);
+            put_varint(out, call.frame);
+            put_varint(out, call.values);
+            put_varint(out, call.base);
+            put_varint(out, call.args.size());
+            for (int arg : call.args)
+                put_zigzag(out, arg);
+        }
+        put_varint(out, m.locals_.size());
+        for (int local : m.locals_)
+            put_zigzag(out, local);
+        put_varint(out, m.base_);
+        os.write(out.data(), out.size());
+    }
+
+    // Puts the state saved to is into m, which runs with an empty symbol
+    // table, and skips the values of input that were read before.
+    void load(std::istream &is, ast_machine_t &m,
+              std::istream &input = std::cin) const
+    {
+        number();
+        std::string image{std::istreambuf_iterator<char>(is), {}};
+        reader_t in(image, "Checkpoint");
+        if (!in.starts_with(magic))
+            throw ExceptsPCL::checkpoint_error("Not a checkpoint");
+        if (in.get() != program_ || in.get() != nodes_.size())
+            throw ExceptsPCL::checkpoint_error(
+                "Checkpoint is of another program");
+        m.reads_ = in.get();
+        for (std::uint64_t i = 0; i < m.reads_; ++i)
+        {
+            int skipped;
+            input >> skipped;
+        }
+
+        symbol_table_t &st = m.st_;
+        std::vector<std::uint64_t> scopes(in.get(image.size()));
+        for (auto &mark : scopes)
+            mark = in.get();
+        std::uint64_t names = in.get(image.size());
+        auto scope = scopes.begin();
+        for (std::uint64_t i = 0; i < names; ++i)
+        {
+            for (; scope != scopes.end() && *scope == i; ++scope)
+                st.emplace_scope();
+            if (st.depth() == 0)
+                throw ExceptsPCL::checkpoint_error("Checkpoint is corrupt");
+            auto name = in.get_str();
+            st.add_name(name)->second = in.get_int();
+        }
+        for (; scope != scopes.end(); ++scope)
+            st.emplace_scope();
+
+        m.frames_.resize(in.get(image.size()));
+        for (auto &frame : m.frames_)
+        {
+            frame.node = nodes_[in.get(nodes_.size())];
+            if (!frame.node)
+                throw ExceptsPCL::checkpoint_error("Checkpoint is corrupt");
+            frame.pc = in.get();
+            // Values cached for a sequence or loop that was running are
+            // computed again, also when this process cached them before.
+            if (frame.node->nt == node_types::STATEMENTS)
+                ++static_cast<const ast_statements_t *>(frame.node)->epoch;
+            if (frame.node->nt == node_types::WHILE)
+                ++static_cast<const ast_while_t *>(frame.node)->epoch;
+            if (frame.node->nt == node_types::UNROLLED_LOOP)
+                ++static_cast<const ast_while_t &>(
+                      **static_cast<const ast_unrolled_loop_t *>(frame.node)
+                            ->loop)
+                      .epoch;
+        }
+        m.values_.resize(in.get(image.size()));
+        for (auto &val : m.values_)
+        {
+            if (in.get(2) == 0)
+                val = in.get_int();
+            else
+                val = IIterator{&st, in.get(st.size())};
+        }
+        m.calls_.resize(in.get(image.size()));
+        for (auto &call : m.calls_)
+        {
+            call.fn = static_cast<const ast_func_t *>(
+                nodes_[in.get(nodes_.size())]);
+            if (!call.fn || call.fn->nt != node_types::FUNCTION)
+                throw ExceptsPCL::checkpoint_error("Checkpoint is corrupt");
+            call.frame = in.get(m.frames_.size());
+            call.values = in.get(m.values_.size() + 1);
+            call.base = in.get();
+            call.args.resize(in.get(image.size()));
+            for (int &arg : call.args)
+                arg = in.get_int();
+        }
+        m.locals_.resize(in.get(image.size()));
+        for (int &local : m.locals_)
+            local = in.get_int();
+        m.base_ = in.get(m.locals_.size() + 1);
+    }
+};
+
+} // namespace AST
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstddef>
+#include <optional>
 #include <stdexcept>
+#include <string>
 
 namespace ExceptsPCL {
 
@@ -15,4 +18,46 @@ public:
     compilation_error(const std::string &what_arg) : paracl_error(what_arg) {}
 };
 
+// A limit of the run was exceeded in the loop or scope at offset.
+class budget_error final : public paracl_error {
+    std::size_t offset_;
+
+public:
+    budget_error(const std::string &what_arg, std::size_t offset)
+        : paracl_error(what_arg), offset_(offset)
+    {}
+    std::size_t offset() const { return offset_; }
+};
+
+// An operation of the run has no defined result, e.g. a division by zero.
+// It is located at offset in the source if it is known.
+class run_error final : public paracl_error {
+    std::optional<std::size_t> offset_;
+
+public:
+    run_error(const std::string &what_arg,
+              std::optional<std::size_t> offset = std::nullopt)
+        : paracl_error(what_arg), offset_(offset)
+    {}
+    std::optional<std::size_t> offset() const { return offset_; }
+};
+
+// A checkpoint can not be written or does not fit the program.
+class checkpoint_error final : public paracl_error {
+public:
+    checkpoint_error(const std::string &what_arg) : paracl_error(what_arg) {}
+};
+
+// A trace can not be written or does not fit the program.
+class trace_error final : public paracl_error {
+public:
+    trace_error(const std::string &what_arg) : paracl_error(what_arg) {}
+};
+
+// The run was stopped on request once its state was saved.
+class interrupted_error final : public paracl_error {
+public:
+    interrupted_error(const std::string &what_arg) : paracl_error(what_arg) {}
+};
+
 }; // namespace ExceptsPCL
\ No newline at end of file
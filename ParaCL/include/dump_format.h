@@ -0,0 +1,9 @@
+#pragma once
+
+namespace AST {
+
+// Format of the AST, symbol table and optimizer report dumps: dot for
+// graphviz, json for tools.
+enum class dump_format_t { dot, json };
+
+} // namespace AST
@@ -5,58 +5,91 @@
 #endif
 
 #include "parser.h"
+#include "source.h"
 
 #include <iostream>
-#include <sstream>
-#include <string>
+#include <string_view>
 
 namespace yy {
 
+enum class input_t {
+    whole,  // read by blocks, the whole text is kept
+    stream, // read by lines, only the recent text is kept
+    chunk,  // read by blocks, no text is kept
+};
+
 class LexerPCL final : public yyFlexLexer {
-    location_t loc_{};
-    std::string text;
+    // Text kept behind the current token when streaming, for diagnostics.
+    static constexpr std::size_t max_kept = 1 << 16;
 
-    using StrIt = typename std::string::const_iterator;
-    std::vector<StrIt> strs_;
-    StrIt pos_;
+    source_t source_;
+    std::size_t begin_ = 0, pos_ = 0;
+    std::istream *istream_;
+    input_t input_;
+    std::ostream *prompt_ = nullptr;
 
 public:
-    LexerPCL(std::stringstream *istream)
-        : yyFlexLexer(istream), text(istream->str()), pos_(text.cbegin())
-    {
-        update_line();
-    }
+    // Locations are offsets from base, the position of the input in a
+    // larger text.
+    LexerPCL(std::istream *istream, input_t input = input_t::whole,
+             std::size_t base = 0)
+        : yyFlexLexer(istream), begin_(base), pos_(base), istream_(istream),
+          input_(input)
+    {}
+
+    const source_t &source() const { return source_; }
+    location_t get_loc() const { return {begin_, pos_}; }
+    int yylex() override;
 
-    std::string get_str(int i) const
+    // Writes a prompt to os before every line read from a stream.
+    void prompt(std::ostream *os) { prompt_ = os; }
+    // Drops the rest of the line read from a stream, lexing goes on from
+    // the next one.
+    void skip_line()
     {
-        auto start = strs_[i], end = std::find(start, text.cend(), '\n');
-        return std::string{start, end};
+        switch_streams(istream_);
+        begin_ = pos_ = source_.size();
     }
-    const location_t &get_loc() const { return loc_; }
-    int yylex() override;
 
 private:
-    void update_line() { strs_.emplace_back(pos_); }
+    void advance(std::size_t len)
+    {
+        if (input_ == input_t::stream && source_.text().size() > max_kept)
+            source_.discard(begin_);
+        begin_ = pos_;
+        pos_ += len;
+    }
 
-    int update_location()
+    // A streamed program is read line by line, so a statement is run as
+    // soon as its line is complete instead of when the buffer is full.
+    int read_line(char *buf, int max_size)
     {
-        loc_.first_line = loc_.last_line;
-        loc_.first_column = loc_.last_column;
-        int i = 0;
-        for (; yytext[i] != '\0'; i++)
+        if (prompt_)
+            *prompt_ << "> " << std::flush;
+        auto *sb = yyin.rdbuf();
+        int n = 0;
+        while (n < max_size)
         {
-            if (yytext[i] == '\n')
-            {
-                loc_.last_line++;
-                loc_.last_column = 0;
-            }
-            else
-            {
-                loc_.last_column++;
-            }
+            int c = sb->sbumpc();
+            if (c == std::char_traits<char>::eof())
+                break;
+            buf[n++] = static_cast<char>(c);
+            if (c == '\n')
+                break;
         }
-        return i;
+        return n;
+    }
+
+protected:
+    int LexerInput(char *buf, int max_size) override
+    {
+        int n = input_ == input_t::stream
+                    ? read_line(buf, max_size)
+                    : yyFlexLexer::LexerInput(buf, max_size);
+        if (n > 0 && input_ != input_t::chunk)
+            source_.append({buf, static_cast<std::size_t>(n)});
+        return n;
     }
 };
 
-} // namespace yy
\ No newline at end of file
+} // namespace yy
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PARACL_HAS_MMAP 1
+#endif
+
+namespace yy {
+
+// Text of a file, mapped into memory when it is a regular file and read
+// otherwise, e.g. from a pipe.
+class mapped_file_t final {
+    std::string_view text_;
+    std::string read_;
+    void *map_ = nullptr;
+    bool fail_ = false;
+
+public:
+    explicit mapped_file_t(const std::string &name)
+    {
+        if (!map(name))
+            read(name);
+    }
+
+    mapped_file_t(const mapped_file_t &) = delete;
+    mapped_file_t &operator=(const mapped_file_t &) = delete;
+
+    ~mapped_file_t()
+    {
+#ifdef PARACL_HAS_MMAP
+        if (map_)
+            munmap(map_, text_.size());
+#endif
+    }
+
+    bool fail() const { return fail_; }
+    std::string_view text() const { return text_; }
+
+private:
+    bool map([[maybe_unused]] const std::string &name)
+    {
+#ifdef PARACL_HAS_MMAP
+        int fd = open(name.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+                map_ = p;
+                text_ = {static_cast<const char *>(p),
+                         static_cast<std::size_t>(st.st_size)};
+            }
+        }
+        close(fd);
+        return map_;
+#else
+        return false;
+#endif
+    }
+
+    void read(const std::string &name)
+    {
+        std::ifstream file(name, std::ios::binary);
+        if (file.fail())
+        {
+            fail_ = true;
+            return;
+        }
+        read_.assign(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+        text_ = read_;
+    }
+};
+
+} // namespace yy
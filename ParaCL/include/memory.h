@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+
+namespace AST {
+
+// What was allocated through a resource: bytes and calls in all, and the
+// most bytes in use at once.
+struct memory_counters_t final {
+    std::uint64_t bytes = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t peak_bytes = 0;
+};
+
+// Passes allocations on to upstream and counts them, from any thread.
+class counting_resource_t final : public std::pmr::memory_resource {
+    std::pmr::memory_resource *upstream_;
+    std::atomic<std::uint64_t> bytes_{0}, allocations_{0}, in_use_{0},
+        peak_{0};
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void *res = upstream_->allocate(bytes, alignment);
+        bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        std::uint64_t in_use =
+            in_use_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        std::uint64_t peak = peak_.load(std::memory_order_relaxed);
+        while (in_use > peak &&
+               !peak_.compare_exchange_weak(peak, in_use,
+                                            std::memory_order_relaxed))
+            ;
+        return res;
+    }
+    void do_deallocate(void *p, std::size_t bytes,
+                       std::size_t alignment) override
+    {
+        upstream_->deallocate(p, bytes, alignment);
+        in_use_.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+    bool do_is_equal(const memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+public:
+    explicit counting_resource_t(std::pmr::memory_resource *upstream)
+        : upstream_(upstream)
+    {}
+
+    memory_counters_t counters() const
+    {
+        return {bytes_.load(std::memory_order_relaxed),
+                allocations_.load(std::memory_order_relaxed),
+                peak_.load(std::memory_order_relaxed)};
+    }
+};
+
+// Memory of a program by the phase that allocates it. The nodes the parser
+// and the optimizer make live as long as the program, so they are cut from
+// a monotonic buffer and freed all at once, unless statements are freed as
+// they run, as in a streamed program. The run takes its stacks, variables
+// and cached results from pools that keep the blocks freed by left scopes
+// and returned calls for the next ones. Threads of a run share the pools.
+class program_memory_t final {
+    std::pmr::synchronized_pool_resource pool_;
+    std::pmr::monotonic_buffer_resource buffer_;
+    counting_resource_t parse_, run_;
+
+public:
+    explicit program_memory_t(bool streaming)
+        : parse_(streaming ? static_cast<std::pmr::memory_resource *>(&pool_)
+                           : &buffer_),
+          run_(&pool_)
+    {}
+    program_memory_t(const program_memory_t &) = delete;
+    program_memory_t &operator=(const program_memory_t &) = delete;
+
+    std::pmr::memory_resource *parse() { return &parse_; }
+    std::pmr::memory_resource *run() { return &run_; }
+    memory_counters_t parse_counters() const { return parse_.counters(); }
+    memory_counters_t run_counters() const { return run_.counters(); }
+};
+
+} // namespace AST
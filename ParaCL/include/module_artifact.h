@@ -0,0 +1,466 @@
+#pragma once
+
+#include "AST.h"
+#include "AST_analysis.h"
+#include "AST_optimizer.h"
+#include "ast_representation.h"
+#include "driver_exceptions.h"
+#include "varint.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace AST {
+
+// Module compiled once, to be read back instead of parsing its source while
+// the source keeps its size and modification time. It holds the modules
+// the module imports, each as its path and offset in the source, and the
+// functions it defines as the parser made them: their names, numbers of
+// parameters and slots and the nodes of their bodies in post-order. A call
+// keeps the name of its function, which is looked up again when the module
+// is linked, so a module is compiled again only when its own source
+// changes. Offsets are from the start of the module's source and integers
+// are varints.
+class module_artifact_t final {
+    static constexpr std::string_view magic = "PCLMOD01";
+
+    using reader_t = varint_reader_t<ExceptsPCL::compilation_error>;
+
+public:
+    struct import_t {
+        std::string path;
+        std::size_t offset;
+    };
+    // A node: its type, operator or value, and what it holds.
+    struct op_t {
+        node_types nt;
+        int op = 0;
+        std::size_t n = 0; // slot of a variable, children of a sequence or
+                           // arguments of a call
+        std::size_t offset = 0;
+        std::string_view name;
+    };
+    struct function_t {
+        std::string_view name;
+        std::vector<std::string> params;
+        std::size_t slots;
+        std::vector<op_t> body;
+    };
+
+    std::uint64_t source_size = 0, source_time = 0;
+    std::vector<import_t> imports;
+    std::vector<function_t> functions;
+
+private:
+    std::string image_;
+
+    // Writes the nodes of node in post-order. A node the parser does not
+    // make in a function, such as one of an optimized function, is not
+    // written and the module is not saved.
+    static bool put_nodes(std::string &out, const ast_node_t &node,
+                          std::size_t base, std::size_t &count)
+    {
+        bool ok = true;
+        for_each_edge(node, [&](const node_it &child) {
+            ok = ok && put_nodes(out, **child, base, count);
+        });
+        if (!ok)
+            return false;
+        ++count;
+        put_varint(out, static_cast<std::size_t>(node.nt));
+        switch (node.nt)
+        {
+        case node_types::NUMBER:
+            put_zigzag(out, static_cast<const ast_num_t &>(node).val);
+            return true;
+        case node_types::LOCAL:
+        {
+            auto &local = static_cast<const ast_local_t &>(node);
+            put_varint(out, local.name.size());
+            out.append(local.name);
+            put_varint(out, local.slot);
+            return true;
+        }
+        case node_types::BIN_OP:
+        {
+            auto &bin = static_cast<const ast_bin_op_t &>(node);
+            if (bin.op == ast_bin_ops::ASSIGNMENT)
+                return false;
+            put_varint(out, static_cast<std::size_t>(bin.op));
+            if (auto *arith = as_arith(node))
+                put_varint(out, arith->offset - base);
+            return true;
+        }
+        case node_types::UN_OP:
+        {
+            auto &un = static_cast<const ast_un_op_t &>(node);
+            put_varint(out, static_cast<std::size_t>(un.op));
+            if (un.op == ast_un_ops::PRINT)
+                put_varint(
+                    out, static_cast<const ast_print_op &>(node).offset - base);
+            if (un.op == ast_un_ops::MINUS)
+                put_varint(
+                    out,
+                    static_cast<const ast_unminus_op &>(node).offset - base);
+            return true;
+        }
+        case node_types::STATEMENTS:
+            if (dynamic_cast<const ast_scope_t *>(&node))
+                return false;
+            put_varint(out, static_cast<const ast_statements_t &>(node)
+                                .seq.size());
+            return true;
+        case node_types::WHILE:
+            put_varint(out,
+                       static_cast<const ast_while_t &>(node).offset - base);
+            return true;
+        case node_types::CALL:
+        {
+            auto &call = static_cast<const ast_call_t &>(node);
+            put_varint(out, call.fn->name.size());
+            out.append(call.fn->name);
+            put_varint(out, call.offset - base);
+            put_varint(out, call.args.size());
+            return true;
+        }
+        case node_types::WRITE:
+        case node_types::EMPTY:
+        case node_types::IF:
+        case node_types::IFELSE:
+        case node_types::LOCAL_ASSIGN:
+        case node_types::RETURN:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Reads the nodes of a body, checking that each has its children and
+    // the body is one node.
+    static std::vector<op_t> get_nodes(reader_t &in, std::size_t slots,
+                                       std::size_t size)
+    {
+        auto corrupt = [] {
+            return ExceptsPCL::compilation_error("Module artifact is corrupt");
+        };
+        std::vector<op_t> ops(in.get(size));
+        std::vector<node_types> stack;
+        auto take = [&](std::size_t n) {
+            if (stack.size() < n)
+                throw corrupt();
+            stack.resize(stack.size() - n);
+        };
+        for (op_t &op : ops)
+        {
+            op.nt = static_cast<node_types>(in.get(node_types_count));
+            switch (op.nt)
+            {
+            case node_types::NUMBER:
+                op.op = in.get_int();
+                break;
+            case node_types::LOCAL:
+                op.name = in.get_str();
+                op.n = in.get(slots);
+                break;
+            case node_types::BIN_OP:
+                op.op = static_cast<int>(
+                    in.get(static_cast<std::size_t>(ast_bin_ops::MODDIV) + 1));
+                if (static_cast<ast_bin_ops>(op.op) == ast_bin_ops::ASSIGNMENT)
+                    throw corrupt();
+                if (op.op <= static_cast<int>(ast_bin_ops::DIVISION) ||
+                    static_cast<ast_bin_ops>(op.op) == ast_bin_ops::MODDIV)
+                    op.offset = in.get();
+                take(2);
+                break;
+            case node_types::UN_OP:
+                op.op = static_cast<int>(
+                    in.get(static_cast<std::size_t>(ast_un_ops::LNO) + 1));
+                if (static_cast<ast_un_ops>(op.op) == ast_un_ops::PRINT ||
+                    static_cast<ast_un_ops>(op.op) == ast_un_ops::MINUS)
+                    op.offset = in.get();
+                take(1);
+                break;
+            case node_types::STATEMENTS:
+                op.n = in.get(size);
+                take(op.n);
+                break;
+            case node_types::IF:
+            case node_types::WHILE:
+                if (op.nt == node_types::WHILE)
+                    op.offset = in.get();
+                take(2);
+                break;
+            case node_types::IFELSE:
+                take(3);
+                break;
+            case node_types::LOCAL_ASSIGN:
+                if (stack.size() < 2 ||
+                    stack[stack.size() - 2] != node_types::LOCAL)
+                    throw corrupt();
+                take(2);
+                break;
+            case node_types::CALL:
+                op.name = in.get_str();
+                op.offset = in.get();
+                op.n = in.get(size);
+                take(op.n);
+                break;
+            case node_types::RETURN:
+                take(1);
+                break;
+            case node_types::WRITE:
+            case node_types::EMPTY:
+                break;
+            default:
+                throw corrupt();
+            }
+            stack.push_back(op.nt);
+        }
+        if (stack.size() != 1)
+            throw corrupt();
+        return ops;
+    }
+
+    static node_it make_bin(ast_representation_t &astr, const op_t &op,
+                            node_it lhs, node_it rhs, std::size_t offset)
+    {
+        switch (static_cast<ast_bin_ops>(op.op))
+        {
+        case ast_bin_ops::PLUS:
+            return astr.make_arith<ast_plus_op>(lhs, rhs, offset);
+        case ast_bin_ops::MINUS:
+            return astr.make_arith<ast_minus_op>(lhs, rhs, offset);
+        case ast_bin_ops::MULTIPLICATION:
+            return astr.make_arith<ast_mul_op>(lhs, rhs, offset);
+        case ast_bin_ops::DIVISION:
+            return astr.make_arith<ast_div_op>(lhs, rhs, offset);
+        case ast_bin_ops::MODDIV:
+            return astr.make_arith<ast_modular_division_op>(lhs, rhs, offset);
+        case ast_bin_ops::GREATER:
+            return astr.make_node<ast_greater_op>(lhs, rhs);
+        case ast_bin_ops::LESS:
+            return astr.make_node<ast_less_op>(lhs, rhs);
+        case ast_bin_ops::GREATEREQ:
+            return astr.make_node<ast_greatereq_op>(lhs, rhs);
+        case ast_bin_ops::LESSEQ:
+            return astr.make_node<ast_lesseq_op>(lhs, rhs);
+        case ast_bin_ops::EQUAL:
+            return astr.make_node<ast_equal_op>(lhs, rhs);
+        case ast_bin_ops::NOTEQUAL:
+            return astr.make_node<ast_notequal_op>(lhs, rhs);
+        case ast_bin_ops::LAND:
+            return astr.make_node<ast_logical_and_op>(lhs, rhs);
+        default:
+            return astr.make_node<ast_logical_or_op>(lhs, rhs);
+        }
+    }
+
+    static node_it make_un(ast_representation_t &astr, const op_t &op,
+                           node_it rhs, std::size_t offset)
+    {
+        switch (static_cast<ast_un_ops>(op.op))
+        {
+        case ast_un_ops::PRINT:
+            return astr.make_node<ast_print_op>(rhs, offset);
+        case ast_un_ops::MINUS:
+            return astr.make_arith<ast_unminus_op>(rhs, offset);
+        case ast_un_ops::PLUS:
+            return astr.make_node<ast_unplus_op>(rhs);
+        default:
+            return astr.make_node<ast_logical_no_op>(rhs);
+        }
+    }
+
+    // Makes the nodes of a body as the parser does, located from base.
+    static node_it make_body(ast_representation_t &astr,
+                             const std::vector<op_t> &ops, std::size_t base)
+    {
+        std::vector<node_it> stack;
+        auto pop = [&stack] {
+            node_it res = stack.back();
+            stack.pop_back();
+            return res;
+        };
+        for (const op_t &op : ops)
+        {
+            std::size_t offset = base + op.offset;
+            node_it res;
+            switch (op.nt)
+            {
+            case node_types::NUMBER:
+                res = astr.make_node<ast_num_t>(op.op);
+                break;
+            case node_types::LOCAL:
+                res = astr.make_node<ast_local_t>(op.name, op.n);
+                break;
+            case node_types::BIN_OP:
+            {
+                node_it rhs = pop(), lhs = pop();
+                res = make_bin(astr, op, lhs, rhs, offset);
+                break;
+            }
+            case node_types::UN_OP:
+                res = make_un(astr, op, pop(), offset);
+                break;
+            case node_types::STATEMENTS:
+                res = astr.make_node<ast_statements_t>();
+                for (auto it = stack.end() - op.n; it != stack.end(); ++it)
+                    astr.add_statement(res, *it);
+                stack.resize(stack.size() - op.n);
+                break;
+            case node_types::IF:
+            case node_types::WHILE:
+            {
+                node_it body = pop(), cond = pop();
+                res = op.nt == node_types::IF
+                          ? astr.make_node<ast_if_t>(cond, body)
+                          : astr.make_node<ast_while_t>(cond, body, offset);
+                break;
+            }
+            case node_types::IFELSE:
+            {
+                node_it else_body = pop(), body = pop(), cond = pop();
+                res = astr.make_node<ast_ifelse_t>(
+                    astr.make_node<ast_if_t>(cond, body), else_body);
+                break;
+            }
+            case node_types::LOCAL_ASSIGN:
+            {
+                node_it rhs = pop(), lhs = pop();
+                res = astr.make_node<ast_local_assign_t>(lhs, rhs);
+                break;
+            }
+            case node_types::CALL:
+            {
+                std::vector<node_it> args(stack.end() - op.n, stack.end());
+                stack.resize(stack.size() - op.n);
+                res = astr.make_call(op.name, std::move(args), offset);
+                break;
+            }
+            case node_types::RETURN:
+                res = astr.make_return(pop());
+                break;
+            case node_types::WRITE:
+                res = astr.make_node<ast_write_t>();
+                break;
+            default:
+                res = astr.make_node<ast_empty_op_t>();
+                break;
+            }
+            stack.push_back(res);
+        }
+        return stack.back();
+    }
+
+public:
+    // Image of a module whose source has the size and modification time,
+    // with the imports and the functions it defines, located from base.
+    // None if a function is not as the parser made it.
+    static std::optional<std::string>
+    save(std::uint64_t size, std::uint64_t time,
+         const std::vector<import_t> &imports,
+         const std::vector<const ast_func_t *> &functions, std::size_t base)
+    {
+        std::string out{magic};
+        put_varint(out, size);
+        put_varint(out, time);
+        put_varint(out, imports.size());
+        for (auto &&import : imports)
+        {
+            put_varint(out, import.path.size());
+            out.append(import.path);
+            put_varint(out, import.offset);
+        }
+        put_varint(out, functions.size());
+        for (const ast_func_t *fn : functions)
+        {
+            const ast_node_t &body = **fn->body;
+            if (depth(body) > ast_optimizer_t::max_depth)
+                return std::nullopt;
+            std::string nodes;
+            std::size_t count = 0;
+            if (!put_nodes(nodes, body, base, count))
+                return std::nullopt;
+            put_varint(out, fn->name.size());
+            out.append(fn->name);
+            put_varint(out, fn->params);
+            put_varint(out, fn->slots);
+            put_varint(out, count);
+            out.append(nodes);
+        }
+        return out;
+    }
+
+    // Reads an image, throwing compilation_error if it is not one.
+    explicit module_artifact_t(std::string image) : image_(std::move(image))
+    {
+        reader_t in(image_, "Module artifact");
+        if (!in.starts_with(magic))
+            throw ExceptsPCL::compilation_error("Not a module artifact");
+        source_size = in.get();
+        source_time = in.get();
+        imports.resize(in.get(image_.size()));
+        for (auto &import : imports)
+        {
+            import.path = in.get_str();
+            import.offset = in.get();
+        }
+        functions.resize(in.get(image_.size()));
+        for (auto &fn : functions)
+        {
+            fn.name = in.get_str();
+            // A function keeps no names of its parameters, which its body
+            // reads by slot.
+            fn.params.resize(in.get(image_.size()));
+            for (std::size_t i = 0; i < fn.params.size(); ++i)
+                fn.params[i] = std::to_string(i);
+            fn.slots = in.get();
+            if (fn.slots < fn.params.size())
+                throw ExceptsPCL::compilation_error(
+                    "Module artifact is corrupt");
+            fn.body = get_nodes(in, fn.slots, image_.size());
+        }
+        if (!in.at_end())
+            throw ExceptsPCL::compilation_error("Module artifact is corrupt");
+    }
+
+    // Whether the functions can be defined in astr: none is defined yet
+    // and every call is to a function with as many parameters as it has
+    // arguments.
+    bool links(const ast_representation_t &astr) const
+    {
+        std::unordered_map<std::string_view, std::size_t> defined;
+        for (auto &&fn : functions)
+        {
+            if (astr.find_function(fn.name) || defined.contains(fn.name))
+                return false;
+            defined.emplace(fn.name, fn.params.size());
+            for (auto &&op : fn.body)
+            {
+                if (op.nt != node_types::CALL)
+                    continue;
+                auto it = defined.find(op.name);
+                const ast_func_t *callee = astr.find_function(op.name);
+                if (callee ? callee->params != op.n
+                           : it == defined.end() || it->second != op.n)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // Defines the functions in astr, located from base.
+    void link(ast_representation_t &astr, std::size_t base) const
+    {
+        for (auto &&fn : functions)
+            astr.define_function(fn.name, fn.params, fn.slots, [&] {
+                return make_body(astr, fn.body, base);
+            });
+    }
+};
+
+} // namespace AST
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "dump_format.h"
+
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace OptionsPCL {
+
+struct options_t final {
+    std::string file_name;
+    // Runs every top level statement as soon as it is parsed.
+    bool stream = false;
+    // Reads the program from the standard input and goes on after a
+    // statement that does not compile.
+    bool repl = false;
+    // Threads lexing the program, 0 for one per core.
+    unsigned lex_threads = 0;
+    // Lexes with the hand written scanner instead of flex.
+    bool simd_lexer = false;
+    // Prints the tokens instead of running the program.
+    bool tokens = false;
+    // Writes the statistics of the run to this file as JSON.
+    std::string stats_file;
+    // Dumps the AST, symbol table and optimizer report before the run.
+    std::optional<AST::dump_format_t> dump;
+    // Starts the run at once and optimizes the program in the background.
+    bool tiered = false;
+    // Threads running independent statements at the same time, 0 for one
+    // per core.
+    std::optional<unsigned> parallel;
+    // Caches the results of functions without side effects.
+    bool memo = false;
+    // Stops the run on arithmetic that overflows instead of wrapping around.
+    bool check_overflow = false;
+    // Saves the state of the run to this file on SIGUSR1, SIGTERM and
+    // SIGINT, and every checkpoint_every loop back edges if not 0.
+    std::string checkpoint_file;
+    std::uint64_t checkpoint_every = 0;
+    // Resumes the run from the state saved to this file.
+    std::string restore_file;
+    // Saves the values read by ? and printed to this file, or reads the
+    // input from the values saved to it and checks what is printed.
+    std::string record_file, replay_file;
+    // Runs the program up to its first ? before the run, within
+    // prefix_steps loop iterations and scope entries, and saves its state
+    // there to this file, from which later runs go on.
+    std::string prefix_file;
+    std::uint64_t prefix_steps = 100'000'000;
+    // Limits of the run, unlimited when not given.
+    std::optional<std::uint64_t> max_steps, max_output, max_vars, max_time_ms;
+};
+
+// Value of --name=value if arg is one.
+template <typename T>
+bool parse_value(std::string_view arg, std::string_view name, T &value,
+                 bool &bad)
+{
+    if (!arg.starts_with(name) || arg.size() == name.size() ||
+        arg[name.size()] != '=')
+        return false;
+    auto val = arg.substr(name.size() + 1);
+    const char *end = val.data() + val.size();
+    auto [ptr, ec] = std::from_chars(val.data(), end, value);
+    bad = ec != std::errc{} || ptr != end;
+    return true;
+}
+
+template <typename T>
+bool parse_value(std::string_view arg, std::string_view name,
+                 std::optional<T> &value, bool &bad)
+{
+    T val{};
+    if (!parse_value(arg, name, val, bad))
+        return false;
+    value = val;
+    return true;
+}
+
+inline std::optional<options_t> parse_options(int argc, char **argv)
+{
+    options_t options;
+    bool has_file = false, bad = false;
+    for (int i = 1; i < argc && !bad; ++i)
+    {
+        std::string_view arg = argv[i];
+        if (parse_value(arg, "--lex-threads", options.lex_threads, bad) ||
+            parse_value(arg, "--max-steps", options.max_steps, bad) ||
+            parse_value(arg, "--max-output", options.max_output, bad) ||
+            parse_value(arg, "--max-vars", options.max_vars, bad) ||
+            parse_value(arg, "--max-time", options.max_time_ms, bad) ||
+            parse_value(arg, "--parallel", options.parallel, bad) ||
+            parse_value(arg, "--prefix-steps", options.prefix_steps, bad) ||
+            parse_value(arg, "--checkpoint-every", options.checkpoint_every,
+                        bad))
+            continue;
+        if (arg == "--stream")
+            options.stream = true;
+        else if (arg == "--repl")
+            options.repl = true;
+        else if (arg == "--lexer=simd" || arg == "--lexer=flex")
+            options.simd_lexer = arg == "--lexer=simd";
+        else if (arg == "--tokens")
+            options.tokens = true;
+        else if (arg == "--tiered")
+            options.tiered = true;
+        else if (arg == "--parallel")
+            options.parallel = 0;
+        else if (arg == "--memo")
+            options.memo = true;
+        else if (arg == "--check-overflow")
+            options.check_overflow = true;
+        else if (arg == "--dump" || arg == "--dump=dot")
+            options.dump = AST::dump_format_t::dot;
+        else if (arg == "--dump=json")
+            options.dump = AST::dump_format_t::json;
+        else if (arg.starts_with("--stats="))
+        {
+            options.stats_file = arg.substr(arg.find('=') + 1);
+            if (options.stats_file.empty())
+                return std::nullopt;
+        }
+        else if (arg.starts_with("--checkpoint="))
+        {
+            options.checkpoint_file = arg.substr(arg.find('=') + 1);
+            if (options.checkpoint_file.empty())
+                return std::nullopt;
+        }
+        else if (arg.starts_with("--restore="))
+        {
+            options.restore_file = arg.substr(arg.find('=') + 1);
+            if (options.restore_file.empty())
+                return std::nullopt;
+        }
+        else if (arg.starts_with("--record="))
+        {
+            options.record_file = arg.substr(arg.find('=') + 1);
+            if (options.record_file.empty())
+                return std::nullopt;
+        }
+        else if (arg.starts_with("--replay="))
+        {
+            options.replay_file = arg.substr(arg.find('=') + 1);
+            if (options.replay_file.empty())
+                return std::nullopt;
+        }
+        else if (arg.starts_with("--prefix="))
+        {
+            options.prefix_file = arg.substr(arg.find('=') + 1);
+            if (options.prefix_file.empty())
+                return std::nullopt;
+        }
+        else if (arg.starts_with("--") || has_file)
+            return std::nullopt;
+        else
+        {
+            options.file_name = arg;
+            has_file = true;
+        }
+    }
+    if (has_file == options.repl || bad)
+        return std::nullopt;
+    // A streamed program is never whole, so its state is not saved, it is
+    // neither optimized in the background nor run in parallel and its run
+    // is not traced. Neither is the state of a tiered or parallel one,
+    // which runs other nodes or threads as it goes, nor of a traced one. A
+    // run restored from a prefix is not restored from a checkpoint too, nor
+    // limited, as the steps and output of a saved prefix are not counted.
+    bool saves = !options.checkpoint_file.empty() ||
+                 !options.restore_file.empty() || !options.prefix_file.empty();
+    bool traces =
+        !options.record_file.empty() || !options.replay_file.empty();
+    bool whole = options.tiered || options.parallel || traces;
+    bool limited = options.max_steps || options.max_output ||
+                   options.max_vars || options.max_time_ms;
+    if ((saves && (options.stream || options.repl || whole)) ||
+        (!options.record_file.empty() && !options.replay_file.empty()) ||
+        (!options.prefix_file.empty() &&
+         (!options.restore_file.empty() || limited)) ||
+        (whole && (options.stream || options.repl)) ||
+        (options.tiered && options.parallel) ||
+        (options.checkpoint_every && options.checkpoint_file.empty()))
+        return std::nullopt;
+    return options;
+}
+
+} // namespace OptionsPCL
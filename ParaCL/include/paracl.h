@@ -4,57 +4,150 @@
 #include "ast_representation.h"
 #include "driver_exceptions.h"
 #include "lexer.h"
+#include "mapped_file.h"
+#include "module_artifact.h"
 #include "parser.tab.hh"
 #include "symbol_table.h"
+#include "token_array.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace yy {
 
+class module_loader_t;
+
 class DriverPCL final {
-    LexerPCL *plex_;
+    LexerPCL *plex_ = nullptr;
+    token_array_t *tokens_ = nullptr;
     std::ostream *report_stream_;
     std::string file_name_;
+    module_loader_t *modules_ = nullptr;
+    // Offset of the text in the program, past the program's own for a
+    // module, and whether the parser is yet to be told it parses one.
+    std::size_t base_ = 0;
+    bool module_ = false;
 
 public:
     DriverPCL(LexerPCL *plex, std::string_view fn,
               std::ostream *rs = &std::cerr)
         : plex_(plex), report_stream_(rs), file_name_(fn)
     {}
+    DriverPCL(token_array_t *tokens, std::string_view fn,
+              std::ostream *rs = &std::cerr)
+        : tokens_(tokens), report_stream_(rs), file_name_(fn)
+    {}
+    // Parses the module of modules located from base.
+    DriverPCL(token_array_t *tokens, std::string_view fn,
+              module_loader_t *modules, std::size_t base,
+              std::ostream *rs = &std::cerr)
+        : tokens_(tokens), report_stream_(rs), file_name_(fn),
+          modules_(modules), base_(base), module_(true)
+    {}
+
+    // Loads the modules the program imports with modules.
+    void use_modules(module_loader_t *modules) { modules_ = modules; }
 
     parser::token_type yylex(parser::semantic_type *yylval, location_t *loc)
     {
-        parser::token_type tt = static_cast<parser::token_type>(plex_->yylex());
-        *loc = plex_->get_loc();
+        int kind = 0, value = 0;
+        std::string_view text;
+        if (module_)
+        {
+            module_ = false;
+            *loc = {base_, base_};
+            return parser::token_type::MODULE;
+        }
+        if (tokens_)
+        {
+            const token_t *tok = tokens_->next();
+            *loc = tok ? location_t{tok->offset, tok->offset + tok->length}
+                       : tokens_->eof();
+            loc->begin += base_;
+            loc->end += base_;
+            if (tok)
+            {
+                kind = tok->kind;
+                value = tok->value;
+                text = tokens_->text(*tok);
+            }
+        }
+        else
+        {
+            kind = plex_->yylex();
+            *loc = plex_->get_loc();
+            text = {plex_->YYText(), static_cast<std::size_t>(plex_->YYLeng())};
+            if (kind == parser::token_type::NUMBER)
+            {
+                auto val = number_value(text);
+                kind = val ? kind : token_t::bad_number;
+                value = val.value_or(0);
+            }
+        }
+
+        if (kind == token_t::bad_number)
+        {
+            report_error("Number " + std::string{text} + " is out of range",
+                         *loc);
+            throw ExceptsPCL::compilation_error("");
+        }
+        auto tt = static_cast<parser::token_type>(kind);
         if (tt == yy::parser::token_type::NUMBER)
-            yylval->as<int>() = std::stoi(plex_->YYText());
-        if (tt == yy::parser::token_type::IDENT)
+            yylval->as<int>() = value;
+        if (tt == yy::parser::token_type::STRING)
+            text = text.substr(1, text.size() - 2);
+        if (tt == yy::parser::token_type::IDENT ||
+            tt == yy::parser::token_type::STRING)
         {
             yy::parser::semantic_type tmp;
-            tmp.as<std::string>() = plex_->YYText();
+            tmp.as<std::string>() = text;
             yylval->move<std::string>(tmp);
         }
         if (tt == yy::parser::token_type::ERROR)
         {
-            report_error("Unrecognized lexem " + std::string{plex_->YYText()},
-                         *loc);
+            report_error("Unrecognized lexem " + std::string{text}, *loc);
             throw ExceptsPCL::compilation_error("");
         }
         return tt;
     }
 
-    void report_error(std::string_view report_str, const location_t &loc) const
+    void report_error(std::string_view report_str) const
+    {
+        *report_stream_ << file_name_ << ": Error: " << report_str << '.'
+                        << std::endl;
+    }
+    void report_error(std::string_view report_str,
+                      const location_t &loc) const;
+    void report_at(std::string_view report_str, location_t loc) const
     {
-        auto err_line_str = plex_->get_str(loc.first_line);
+        loc.begin -= base_;
+        loc.end -= base_;
+        // Diagnostics end the compilation, so the whole text of a token
+        // array is indexed only then.
+        std::optional<source_t> whole;
+        if (tokens_)
+            whole.emplace(std::string{tokens_->text()});
+        const source_t &source = tokens_ ? *whole : plex_->source();
+        if (!source.kept(loc.begin))
+            return report_error(report_str);
+        auto [line, column] = source.position(loc.begin);
+        auto err_line_str = source.line(line);
         std::size_t ntabs =
             std::count(err_line_str.cbegin(), err_line_str.cend(), '\t');
         auto ptr_str = "\t  " + std::string(ntabs, '\t') +
-                       std::string(loc.first_column - ntabs, ' ') + '^';
-        *report_stream_ << file_name_ << ':' << loc.first_line + 1 << ':'
-                        << loc.first_column + 1 << ": Error: " << report_str
-                        << '.' << std::endl
-                        << "   " << loc.first_line + 1 << "\t| " << err_line_str
+                       std::string(column - ntabs, ' ') + '^';
+        *report_stream_ << file_name_ << ':' << line + 1 << ':' << column + 1
+                        << ": Error: " << report_str << '.' << std::endl
+                        << "   " << line + 1 << "\t| " << err_line_str
                         << std::endl
                         << ptr_str << std::endl;
     }
@@ -65,6 +158,255 @@ public:
         // parser.set_debug_level(true);
         return !parser.parse();
     }
+
+    // Loads the module at path, relative to the file parsed.
+    void import(std::string_view path, const location_t &loc);
+};
+
+// Modules a program imports, each loaded once. A module only defines
+// functions and imports other modules, so it compiles the same for any
+// program. Its artifact is saved next to its source with the extension
+// .pclm and read instead of the source while the source keeps its size and
+// modification time, unless its functions no longer link. A module is
+// located from a base past the text of the program and of the modules
+// loaded before it, so that a diagnostic is reported in its source.
+class module_loader_t final {
+    static constexpr std::size_t first_base = std::size_t{1} << 48;
+
+    struct module_t {
+        std::string path;
+        std::size_t base, size;
+        std::uint64_t stamp;
+        bool loaded = false;
+    };
+    // Imports of a module being compiled, and the indices of the functions
+    // each of them defined.
+    struct compiling_t {
+        std::vector<AST::module_artifact_t::import_t> imports;
+        std::vector<std::pair<std::size_t, std::size_t>> imported;
+    };
+
+    AST::ast_representation_t &astr_;
+    bool save_;
+    std::vector<module_t> modules_;
+    std::unordered_map<std::string, std::size_t> index_;
+    std::vector<compiling_t> compiling_;
+    std::size_t next_base_ = first_base;
+    std::size_t compiled_ = 0, read_ = 0;
+
+    static std::filesystem::path artifact_path(const std::string &path)
+    {
+        return std::filesystem::path(path).replace_extension(".pclm");
+    }
+
+    std::size_t defined() const { return astr_.get_ast().functions().size(); }
+
+    void load(std::string_view name, std::string_view from)
+    {
+        namespace fs = std::filesystem;
+        fs::path path = fs::path(from).parent_path() / name;
+        std::error_code size_ec, time_ec;
+        std::uintmax_t size = fs::file_size(path, size_ec);
+        auto time = fs::last_write_time(path, time_ec);
+        if (size_ec || time_ec)
+            throw ExceptsPCL::compilation_error("Module " + std::string{name} +
+                                                " is not found");
+        std::string key = fs::weakly_canonical(path, size_ec).string();
+        if (auto it = index_.find(key); it != index_.end())
+        {
+            if (!modules_[it->second].loaded)
+                throw ExceptsPCL::compilation_error(
+                    "Module " + std::string{name} + " imports itself");
+            return;
+        }
+        auto stamp =
+            static_cast<std::uint64_t>(time.time_since_epoch().count());
+        std::size_t i = modules_.size();
+        index_.emplace(key, i);
+        modules_.push_back({path.string(), next_base_, size, stamp});
+        next_base_ += size + 1;
+        try
+        {
+            if (!read(i, stamp))
+                compile(i, stamp);
+        }
+        catch (const ExceptsPCL::compilation_error &)
+        {
+            index_.erase(key);
+            throw ExceptsPCL::compilation_error(
+                "Module " + std::string{name} + " does not compile");
+        }
+        modules_[i].loaded = true;
+    }
+
+    // Defines the functions of module i from its artifact, if it has one of
+    // its source as it is.
+    bool read(std::size_t i, std::uint64_t stamp)
+    {
+        std::ifstream is(artifact_path(modules_[i].path), std::ios::binary);
+        if (!is)
+            return false;
+        std::optional<AST::module_artifact_t> artifact;
+        try
+        {
+            artifact.emplace(std::string{std::istreambuf_iterator<char>(is),
+                                         std::istreambuf_iterator<char>()});
+        }
+        catch (const ExceptsPCL::compilation_error &)
+        {
+            return false;
+        }
+        if (artifact->source_size != modules_[i].size ||
+            artifact->source_time != stamp)
+            return false;
+        std::string path = modules_[i].path;
+        std::size_t base = modules_[i].base;
+        for (auto &&import : artifact->imports)
+        {
+            try
+            {
+                load(import.path, path);
+            }
+            catch (const ExceptsPCL::compilation_error &ce)
+            {
+                std::size_t offset = base + import.offset;
+                report_error(ce.what(), {offset, offset});
+                throw ExceptsPCL::compilation_error("");
+            }
+        }
+        if (!artifact->links(astr_))
+            return false;
+        artifact->link(astr_, base);
+        ++read_;
+        return true;
+    }
+
+    // Parses module i and saves its artifact, if its functions are as the
+    // parser made them.
+    void compile(std::size_t i, std::uint64_t stamp)
+    {
+        module_t module = modules_[i];
+        mapped_file_t file(module.path);
+        if (file.fail())
+            throw ExceptsPCL::compilation_error("");
+        token_array_t tokens(file.text(), 1);
+        std::size_t first = defined();
+        compiling_.emplace_back();
+        try
+        {
+            DriverPCL driver(&tokens, module.path, this, module.base);
+            driver.parse(&astr_);
+        }
+        catch (...)
+        {
+            compiling_.pop_back();
+            throw;
+        }
+        compiling_t frame = std::move(compiling_.back());
+        compiling_.pop_back();
+        ++compiled_;
+        if (!save_)
+            return;
+
+        std::vector<const AST::ast_func_t *> own;
+        auto &functions = astr_.get_ast().functions();
+        auto imported = frame.imported.begin();
+        for (std::size_t f = first; f < functions.size();)
+        {
+            if (imported != frame.imported.end() && imported->first == f)
+                f = (imported++)->second;
+            else
+                own.push_back(static_cast<const AST::ast_func_t *>(
+                    functions[f++]->get()));
+        }
+        auto image = AST::module_artifact_t::save(module.size, stamp,
+                                                  frame.imports, own,
+                                                  module.base);
+        if (!image)
+            return;
+        // A module that can not be saved is compiled again next time.
+        std::string path = artifact_path(module.path).string();
+        std::string tmp = path + ".tmp";
+        std::ofstream os(tmp, std::ios::binary);
+        os << *image;
+        os.close();
+        if (os.fail() || std::rename(tmp.c_str(), path.c_str()) != 0)
+            std::remove(tmp.c_str());
+    }
+
+public:
+    // Loads the modules into astr, saving their artifacts if save.
+    explicit module_loader_t(AST::ast_representation_t &astr, bool save = true)
+        : astr_(astr), save_(save)
+    {}
+
+    // Modules compiled from their sources and read from their artifacts.
+    std::size_t compiled() const { return compiled_; }
+    std::size_t read() const { return read_; }
+
+    // Loads the module at path relative to the file from, which imports it
+    // at offset.
+    void import(std::string_view path, std::string_view from,
+                std::size_t offset)
+    {
+        std::size_t first = defined();
+        if (!compiling_.empty())
+            compiling_.back().imports.push_back({std::string{path}, offset});
+        load(path, from);
+        if (!compiling_.empty())
+            compiling_.back().imported.emplace_back(first, defined());
+    }
+
+    // Hash of a program with the hash h of its text and these modules, as
+    // their sources are now.
+    std::uint64_t hash(std::uint64_t h) const
+    {
+        for (auto &&module : modules_)
+            for (std::uint64_t v : {std::uint64_t{module.size}, module.stamp})
+                h = (h ^ v) * 0x100000001b3;
+        return h;
+    }
+
+    // Base of the module at offset, 0 for the program.
+    std::size_t base_of(std::size_t offset) const
+    {
+        auto it = std::upper_bound(
+            modules_.begin(), modules_.end(), offset,
+            [](std::size_t off, const module_t &m) { return off < m.base; });
+        return it == modules_.begin() ? 0 : std::prev(it)->base;
+    }
+
+    void report_error(std::string_view what, const location_t &loc) const
+    {
+        std::size_t base = base_of(loc.begin);
+        auto module = std::find_if(
+            modules_.begin(), modules_.end(),
+            [base](const module_t &m) { return m.base == base; });
+        mapped_file_t file(module->path);
+        token_array_t tokens(file.fail() ? "" : file.text(), 1);
+        DriverPCL driver(&tokens, module->path,
+                         const_cast<module_loader_t *>(this), base);
+        if (file.fail())
+            driver.report_error(what);
+        else
+            driver.report_error(what, loc);
+    }
 };
 
+inline void DriverPCL::report_error(std::string_view report_str,
+                                    const location_t &loc) const
+{
+    if (modules_ && modules_->base_of(loc.begin) != base_)
+        modules_->report_error(report_str, loc);
+    else
+        report_at(report_str, loc);
+}
+
+inline void DriverPCL::import(std::string_view path, const location_t &loc)
+{
+    if (!modules_)
+        throw ExceptsPCL::compilation_error("Modules can not be imported here");
+    modules_->import(path, file_name_, loc.begin - base_);
+}
+
 } // namespace yy
\ No newline at end of file
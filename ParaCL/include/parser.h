@@ -4,10 +4,13 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 using number_tt = int;
 using ident_tt = std::string;
 using nterm_nt = AST::ast_node_t::node_it;
+using params_nt = std::vector<std::string>;
+using args_nt = std::vector<nterm_nt>;
 
 using AST::ast_bin_op_t;
 using AST::ast_empty_op_t;
@@ -46,6 +49,7 @@ using AST::ast_unplus_op;
 using bin_ops = AST::ast_bin_ops;
 using un_ops = AST::ast_un_ops;
 
+// Byte offsets of the first and past the last character of a token or rule.
 struct location_t {
-    std::size_t first_line, first_column, last_line, last_column;
+    std::size_t begin, end;
 };
\ No newline at end of file
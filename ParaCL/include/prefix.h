@@ -0,0 +1,62 @@
+#pragma once
+
+#include "driver_exceptions.h"
+#include "varint.h"
+
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace AST {
+
+// The part of a run that reads no input, run once before the program is
+// run: what it printed and the state of the run after it, a checkpoint. An
+// empty state is of a prefix that took too long or failed, after which the
+// program runs from its start.
+struct run_prefix_t final {
+    std::string output, state;
+};
+
+// A prefix is saved as its magic, the hash of the program, whether the run
+// checks overflow, then the size of the output and the output, and the
+// checkpoint. Integers are varints.
+inline constexpr std::string_view prefix_magic = "PCLPREF1";
+
+inline void save_prefix(std::ostream &os, const run_prefix_t &prefix,
+                        std::uint64_t program, bool check_overflow)
+{
+    std::string out{prefix_magic};
+    put_varint(out, program);
+    put_varint(out, check_overflow);
+    put_varint(out, prefix.output.size());
+    out.append(prefix.output);
+    out.append(prefix.state);
+    os.write(out.data(), out.size());
+}
+
+// Prefix saved to is, if it is one of the program run as it is now.
+inline std::optional<run_prefix_t>
+load_prefix(std::istream &is, std::uint64_t program, bool check_overflow)
+{
+    std::string image{std::istreambuf_iterator<char>(is), {}};
+    try
+    {
+        varint_reader_t<ExceptsPCL::checkpoint_error> in(image, "Prefix");
+        if (!in.starts_with(prefix_magic) || in.get() != program ||
+            in.get() != check_overflow)
+            return std::nullopt;
+        run_prefix_t prefix;
+        prefix.output = in.get_str();
+        prefix.state = in.rest();
+        return prefix;
+    }
+    catch (const ExceptsPCL::checkpoint_error &)
+    {
+        return std::nullopt;
+    }
+}
+
+} // namespace AST
@@ -0,0 +1,283 @@
+#pragma once
+
+#include "tokens.h"
+
+#include <array>
+#include <bit>
+#include <cstring>
+#include <string_view>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace yy {
+
+namespace detail {
+
+enum char_class : unsigned char {
+    other = 0,
+    blank = 1, // [ \t\v\n]
+    alpha = 2, // [a-zA-Z_]
+    digit = 4, // [0-9]
+};
+
+inline constexpr std::array<char_class, 256> char_classes = [] {
+    std::array<char_class, 256> res{};
+    for (unsigned char c : {' ', '\t', '\v', '\n'})
+        res[c] = blank;
+    for (int c = 'a'; c <= 'z'; ++c)
+        res[c] = res[c - 'a' + 'A'] = alpha;
+    res['_'] = alpha;
+    for (int c = '0'; c <= '9'; ++c)
+        res[c] = digit;
+    return res;
+}();
+
+struct keyword_t {
+    std::string_view name;
+    int kind;
+};
+
+// The sum of the length and the first letter modulo 8 is distinct for the
+// keywords.
+constexpr std::size_t keyword_hash(std::string_view word)
+{
+    return (word.size() + static_cast<unsigned char>(word[0])) & 7;
+}
+
+inline constexpr std::array<keyword_t, 8> keywords = [] {
+    using tt = parser::token_type;
+    std::array<keyword_t, 8> res{};
+    for (keyword_t kw :
+         {keyword_t{"if", tt::IF}, {"else", tt::ELSE}, {"while", tt::WHILE},
+          {"print", tt::PRINT}, {"func", tt::FUNC}, {"return", tt::RETURN},
+          {"import", tt::IMPORT}})
+        res[keyword_hash(kw.name)] = kw;
+    return res;
+}();
+
+} // namespace detail
+
+// Hand written scanner for the rules of scanner.l. Blanks, identifiers and
+// numbers are skipped a vector of bytes at a time, comments with memchr,
+// and keywords are told from identifiers by a perfect hash. It makes the
+// same tokens and locations as the flex scanner.
+class simd_lexer_t final {
+    using tt = parser::token_type;
+    using enum detail::char_class;
+
+    static int word_kind(std::string_view word)
+    {
+        const auto &kw = detail::keywords[detail::keyword_hash(word)];
+        return kw.name == word ? kw.kind : tt::IDENT;
+    }
+
+    static bool is(char c, unsigned cls)
+    {
+        return detail::char_classes[static_cast<unsigned char>(c)] & cls;
+    }
+
+#if defined(__AVX2__)
+    using vec_t = __m256i;
+    static constexpr std::size_t width = 32;
+    static vec_t load(const char *p)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const vec_t *>(p));
+    }
+    static vec_t set1(char c) { return _mm256_set1_epi8(c); }
+    static vec_t eq(vec_t a, vec_t b) { return _mm256_cmpeq_epi8(a, b); }
+    static vec_t lt(vec_t a, vec_t b) { return _mm256_cmpgt_epi8(b, a); }
+    static vec_t add(vec_t a, vec_t b) { return _mm256_add_epi8(a, b); }
+    static vec_t vor(vec_t a, vec_t b) { return _mm256_or_si256(a, b); }
+    static std::uint32_t mask(vec_t v) { return _mm256_movemask_epi8(v); }
+#elif defined(__SSE2__)
+    using vec_t = __m128i;
+    static constexpr std::size_t width = 16;
+    static vec_t load(const char *p)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const vec_t *>(p));
+    }
+    static vec_t set1(char c) { return _mm_set1_epi8(c); }
+    static vec_t eq(vec_t a, vec_t b) { return _mm_cmpeq_epi8(a, b); }
+    static vec_t lt(vec_t a, vec_t b) { return _mm_cmplt_epi8(a, b); }
+    static vec_t add(vec_t a, vec_t b) { return _mm_add_epi8(a, b); }
+    static vec_t vor(vec_t a, vec_t b) { return _mm_or_si128(a, b); }
+    static std::uint32_t mask(vec_t v) { return _mm_movemask_epi8(v); }
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    // Bytes of v in [lo, hi]: shifted so the range starts at the smallest
+    // signed byte, it is one signed comparison.
+    static vec_t in_range(vec_t v, char lo, char hi)
+    {
+        vec_t shifted = add(v, set1(static_cast<char>(-128 - lo)));
+        return lt(shifted, set1(static_cast<char>(-128 + (hi - lo + 1))));
+    }
+
+    static vec_t classify(vec_t v, unsigned cls)
+    {
+        vec_t res = set1(0);
+        if (cls & blank)
+            res = vor(vor(eq(v, set1(' ')), eq(v, set1('\t'))),
+                      vor(eq(v, set1('\v')), eq(v, set1('\n'))));
+        if (cls & alpha)
+            res = vor(vor(res, eq(v, set1('_'))),
+                      vor(in_range(v, 'a', 'z'), in_range(v, 'A', 'Z')));
+        if (cls & digit)
+            res = vor(res, in_range(v, '0', '9'));
+        return res;
+    }
+#endif
+
+    // End of the run of bytes of the classes starting at i.
+    static std::size_t skip(const char *s, std::size_t i, std::size_t n,
+                            unsigned cls)
+    {
+#if defined(__AVX2__) || defined(__SSE2__)
+        for (; i + width <= n; i += width)
+        {
+            std::uint32_t out = ~mask(classify(load(s + i), cls));
+            if constexpr (width < 32)
+                out &= (1u << width) - 1;
+            if (out)
+                return i + std::countr_zero(out);
+        }
+#endif
+        while (i < n && is(s[i], cls))
+            ++i;
+        return i;
+    }
+
+    // Punctuator at i, or ERROR for a byte no rule starts with.
+    static std::pair<int, std::size_t> punctuator(const char *s, std::size_t i,
+                                                  std::size_t n)
+    {
+        char next = i + 1 < n ? s[i + 1] : '\0';
+        switch (s[i])
+        {
+        case '?':
+            return {tt::WRITE, 1};
+        case '+':
+            return {tt::PLUS, 1};
+        case '-':
+            return {tt::MINUS, 1};
+        case '*':
+            return {tt::MULTIPLICATION, 1};
+        case '/':
+            return {tt::DIVISION, 1};
+        case '%':
+            return {tt::MODDIV, 1};
+        case ';':
+            return {tt::SEMICOLON, 1};
+        case ',':
+            return {tt::COMMA, 1};
+        case '(':
+            return {tt::LPAR, 1};
+        case ')':
+            return {tt::RPAR, 1};
+        case '{':
+            return {tt::LCURLY, 1};
+        case '}':
+            return {tt::RCURLY, 1};
+        case '=':
+            return next == '=' ? std::pair{tt::EQUAL, 2}
+                               : std::pair{tt::ASSIGNMENT, 1};
+        case '>':
+            return next == '=' ? std::pair{tt::GREATEREQ, 2}
+                               : std::pair{tt::GREATER, 1};
+        case '<':
+            return next == '=' ? std::pair{tt::LESSEQ, 2}
+                               : std::pair{tt::LESS, 1};
+        case '!':
+            return next == '=' ? std::pair{tt::NOTEQUAL, 2}
+                               : std::pair{tt::LNO, 1};
+        case '&':
+            return next == '&' ? std::pair{tt::LAND, 2}
+                               : std::pair{tt::ERROR, 1};
+        case '|':
+            return next == '|' ? std::pair{tt::LOR, 2}
+                               : std::pair{tt::ERROR, 1};
+        default:
+            return {tt::ERROR, 1};
+        }
+    }
+
+    // Last lexeme of a run of blanks ending the text: a newline or the
+    // spaces after the last one.
+    static location_t blank_end(const char *s, std::size_t begin,
+                                std::size_t n, std::size_t base)
+    {
+        if (s[n - 1] == '\n')
+            return {base + n - 1, base + n};
+        std::size_t i = n;
+        while (i > begin && s[i - 1] != '\n')
+            --i;
+        return {base + i, base + n};
+    }
+
+public:
+    lexed_t operator()(std::string_view text, std::size_t base) const
+    {
+        const char *s = text.data();
+        std::size_t n = text.size(), i = 0;
+        lexed_t res{{}, {base, base}};
+        res.tokens.reserve(n / lexed_t::bytes_per_token);
+        while (i < n)
+        {
+            char c = s[i];
+            std::size_t j;
+            if (is(c, blank))
+            {
+                j = skip(s, i, n, blank);
+                if (j == n)
+                    res.eof = blank_end(s, i, n, base);
+                i = j;
+                continue;
+            }
+            if (c == '/' && i + 1 < n && s[i + 1] == '/')
+            {
+                auto *nl = static_cast<const char *>(
+                    std::memchr(s + i, '\n', n - i));
+                j = nl ? nl - s : n;
+                res.eof = {base + i, base + j};
+                i = j;
+                continue;
+            }
+
+            int kind;
+            if (is(c, alpha))
+            {
+                j = skip(s, i + 1, n, alpha | digit);
+                kind = word_kind({s + i, j - i});
+            }
+            else if (is(c, digit))
+            {
+                j = skip(s, i + 1, n, digit);
+                kind = tt::NUMBER;
+            }
+            else if (c == '"')
+            {
+                // A string ends on its line, else the quote is no token.
+                j = i + 1;
+                while (j < n && s[j] != '"' && s[j] != '\n')
+                    ++j;
+                bool closed = j < n && s[j] == '"';
+                kind = closed ? tt::STRING : tt::ERROR;
+                j = closed ? j + 1 : i + 1;
+            }
+            else
+            {
+                auto [k, len] = punctuator(s, i, n);
+                kind = k;
+                j = i + len;
+            }
+            res.tokens.push_back(make_token(kind, base + i, {s + i, j - i}));
+            res.eof = {base + i, base + j};
+            i = j;
+        }
+        return res;
+    }
+};
+
+} // namespace yy
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace yy {
+
+struct position_t {
+    std::size_t line, column;
+};
+
+// Program text addressed by byte offsets. Line and column of an offset are
+// only needed for diagnostics, so the line start index is extended on
+// request and searched with a binary search. Text before a line start can
+// be discarded, the offsets and line numbers of the rest stay the same.
+class source_t final {
+    std::string text_;
+    std::size_t base_ = 0, base_line_ = 0;
+    mutable std::vector<std::size_t> line_starts_{0};
+    mutable std::size_t indexed_ = 0;
+
+public:
+    source_t() = default;
+    explicit source_t(std::string text) : text_(std::move(text)) {}
+
+    const std::string &text() const { return text_; }
+    std::size_t size() const { return base_ + text_.size(); }
+
+    void append(std::string_view text) { text_.append(text); }
+    // Whether the text at offset is still kept.
+    bool kept(std::size_t offset) const { return offset >= base_; }
+
+    // Keeps the lines from the one containing offset on.
+    void discard(std::size_t offset)
+    {
+        const auto &starts = line_starts(offset);
+        auto it = std::prev(std::upper_bound(starts.begin(), starts.end(),
+                                             offset - base_));
+        std::size_t start = *it;
+        if (start == 0)
+            return;
+        base_line_ += std::distance(starts.begin(), it);
+        base_ += start;
+        text_.erase(0, start);
+        line_starts_.assign(1, 0);
+        indexed_ = 0;
+    }
+
+    position_t position(std::size_t offset) const
+    {
+        const auto &starts = line_starts(offset);
+        auto it = std::upper_bound(starts.begin(), starts.end(),
+                                   offset - base_);
+        std::size_t line = std::distance(starts.begin(), it) - 1;
+        return {base_line_ + line, offset - base_ - starts[line]};
+    }
+
+    std::string_view line(std::size_t i) const
+    {
+        std::string_view text = text_;
+        std::size_t start = line_starts(size())[i - base_line_];
+        return text.substr(start, text.find('\n', start) - start);
+    }
+
+private:
+    // Line starts relative to base_, indexed at least up to offset.
+    const std::vector<std::size_t> &line_starts(std::size_t offset) const
+    {
+        std::size_t end = std::min(offset - base_, text_.size());
+        if (end < indexed_)
+            return line_starts_;
+        const char *begin = text_.data(), *last = begin + text_.size();
+        for (const char *p = begin + indexed_;
+             (p = static_cast<const char *>(std::memchr(p, '\n', last - p)));)
+            line_starts_.push_back(++p - begin);
+        indexed_ = text_.size();
+        return line_starts_;
+    }
+};
+
+} // namespace yy
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "AST.h"
+#include "ast_representation.h"
+#include "memory.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <ostream>
+#include <string_view>
+
+#if __has_include(<sys/resource.h>)
+#include <sys/resource.h>
+#define PARACL_HAS_RUSAGE 1
+#endif
+
+namespace StatsPCL {
+
+enum class phase_t { read, lex, parse, optimize, dump, execute };
+
+inline constexpr std::array<std::string_view, 6> phase_names = {
+    "read", "lex", "parse", "optimize", "dump", "execute"};
+
+// Statistics of a run of the interpreter, written as JSON. Every key is
+// always present, so the output can be scraped without looking at the mode
+// the interpreter ran in; a phase that did not happen takes no time.
+class stats_t final {
+    struct phase_time_t {
+        double wall_ms = 0;
+        double cpu_ms = 0;
+    };
+
+    std::array<phase_time_t, phase_names.size()> times_{};
+
+public:
+    void add(phase_t phase, double wall_ms, double cpu_ms)
+    {
+        auto &time = times_[static_cast<std::size_t>(phase)];
+        time.wall_ms += wall_ms;
+        time.cpu_ms += cpu_ms;
+    }
+
+    void write(std::ostream &os, const AST::ast_representation_t &astr) const
+    {
+        os << "{\n  \"version\": 3,\n  \"phases\": {";
+        for (std::size_t i = 0; i < times_.size(); ++i)
+            os << (i ? "," : "") << "\n    \"" << phase_names[i]
+               << "\": {\"wall_ms\": " << times_[i].wall_ms
+               << ", \"cpu_ms\": " << times_[i].cpu_ms << "}";
+        os << "\n  },\n";
+
+        const AST::program_memory_t &memory = astr.get_memory();
+        os << "  \"memory\": {";
+        write_memory(os, "parse", memory.parse_counters());
+        os << ",";
+        write_memory(os, "execute", memory.run_counters());
+        os << "\n  },\n";
+
+        write_nodes(os, "ast_nodes", astr.get_made_nodes());
+        AST::run_counters_t run;
+        if (astr.get_counters())
+            run = *astr.get_counters();
+        write_nodes(os, "executed_nodes", run.executed);
+
+        const auto &st = astr.get_st().counters();
+        os << "  \"unoptimized_nodes\": "
+           << astr.get_opt_report().unoptimized_nodes << ",\n"
+           << "  \"scope_pushes\": " << st.scope_pushes << ",\n"
+           << "  \"scope_pops\": " << st.scope_pops << ",\n"
+           << "  \"symbol_lookups\": " << st.lookups << ",\n"
+           << "  \"reads\": " << run.reads << ",\n"
+           << "  \"writes\": " << run.writes << ",\n"
+           << "  \"peak_rss_kb\": " << peak_rss_kb() << "\n}\n";
+    }
+
+private:
+    template <typename T>
+    static void write_nodes(std::ostream &os, std::string_view key,
+                            const std::array<T, AST::node_types_count> &counts)
+    {
+        os << "  \"" << key << "\": {";
+        for (std::size_t i = 0; i < counts.size(); ++i)
+            os << (i ? "," : "") << "\n    \""
+               << AST::node_type_name(static_cast<AST::node_types>(i))
+               << "\": " << counts[i];
+        os << "\n  },\n";
+    }
+
+    static void write_memory(std::ostream &os, std::string_view phase,
+                             const AST::memory_counters_t &counters)
+    {
+        os << "\n    \"" << phase << "\": {\"bytes\": " << counters.bytes
+           << ", \"allocations\": " << counters.allocations
+           << ", \"peak_bytes\": " << counters.peak_bytes << "}";
+    }
+
+    static long peak_rss_kb()
+    {
+#ifdef PARACL_HAS_RUSAGE
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            return usage.ru_maxrss;
+#endif
+        return 0;
+    }
+};
+
+// Times consecutive phases: each lap ends the phase that started at the
+// previous one. Without statistics it reads no clocks.
+class stopwatch_t final {
+    using wall_clock_t = std::chrono::steady_clock;
+
+    stats_t *stats_;
+    wall_clock_t::time_point wall_;
+    std::clock_t cpu_;
+
+public:
+    explicit stopwatch_t(stats_t *stats) : stats_(stats) { restart(); }
+
+    void restart()
+    {
+        if (!stats_)
+            return;
+        wall_ = wall_clock_t::now();
+        cpu_ = std::clock();
+    }
+
+    void lap(phase_t phase)
+    {
+        if (!stats_)
+            return;
+        auto wall = wall_clock_t::now();
+        auto cpu = std::clock();
+        stats_->add(phase,
+                    std::chrono::duration<double, std::milli>(wall - wall_)
+                        .count(),
+                    1000.0 * (cpu - cpu_) / CLOCKS_PER_SEC);
+        wall_ = wall;
+        cpu_ = cpu;
+    }
+};
+
+} // namespace StatsPCL
@@ -1,81 +1,276 @@
 #pragma once
 
+#include "dump_format.h"
+
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <functional>
 #include <iostream>
-#include <list>
-#include <memory>
-#include <stack>
+#include <limits>
+#include <memory_resource>
 #include <string>
 #include <string_view>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace AST {
 
-template <typename T, typename U> using BaseMap = std::unordered_map<T, U>;
-using map_it = BaseMap<std::string_view, int>::iterator;
-using scope_t = std::vector<map_it>;
+// Variables of the nested scopes, in a flat open addressing table. A name is
+// declared once, in the innermost scope at the time, and scopes are left in
+// the reverse order, so the live entries are always a prefix of the
+// declarations. Leaving a scope just empties the slots of its suffix of the
+// entries, the undo log, without tombstones. Names are stored in one buffer
+// cut back the same way. Once the buffers have grown, nothing is allocated.
+// A part of the run can be undone from a mark: the entries before it keep
+// the values they had when they were first looked up after it.
+class symbol_table_t final {
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
 
-class scopes_t final : private std::stack<scope_t> {
 public:
-    void add_name(map_it it)
-    {
-        assert(!empty());
-        top().push_back(it);
-    }
+    struct entry_t {
+        std::uint32_t name_begin, name_size;
+        std::uint32_t slot;
+        int second;
+    };
 
-    using std::stack<scope_t>::empty;
-    using std::stack<scope_t>::size;
-    using std::stack<scope_t>::top;
-    using std::stack<scope_t>::emplace;
-    using std::stack<scope_t>::pop;
-};
+    // Entry index: stays valid while the table grows.
+    class iterator final {
+        symbol_table_t *st_ = nullptr;
+        std::size_t i_ = npos;
+
+    public:
+        iterator() = default;
+        iterator(symbol_table_t *st, std::size_t i) : st_(st), i_(i) {}
+
+        entry_t &operator*() const { return st_->entries_[i_]; }
+        entry_t *operator->() const { return &st_->entries_[i_]; }
+        iterator &operator++()
+        {
+            if (++i_ == st_->entries_.size())
+                i_ = npos;
+            return *this;
+        }
+        bool operator==(const iterator &other) const { return i_ == other.i_; }
+        std::size_t index() const { return i_; }
+    };
+    using const_iterator = std::pmr::vector<entry_t>::const_iterator;
+
+    struct counters_t {
+        std::uint64_t lookups = 0;
+        std::uint64_t scope_pushes = 0;
+        std::uint64_t scope_pops = 0;
+    };
 
-class symbol_table_t final : private BaseMap<std::string_view, int> {
-    scopes_t scopes_;
+private:
+    static constexpr std::uint32_t empty_slot =
+        std::numeric_limits<std::uint32_t>::max();
+
+    std::pmr::vector<std::uint32_t> slots_;
+    std::pmr::vector<entry_t> entries_;
+    std::pmr::string names_;
+    std::pmr::vector<std::size_t> scopes_; // entries before each scope
+    mutable counters_t counters_;
+    // Entries before the mark, and scopes at it, with the first values
+    // looked up since.
+    std::size_t mark_ = 0, mark_depth_ = 0;
+    std::pmr::vector<std::pair<std::uint32_t, int>> kept_;
+    std::pmr::vector<bool> is_kept_;
 
 public:
-    using iterator = map_it;
-    using const_iterator =
-        typename BaseMap<std::string_view, int>::const_iterator;
+    explicit symbol_table_t(
+        std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+        : slots_(16, empty_slot, mr), entries_(mr), names_(mr), scopes_(mr),
+          kept_(mr), is_kept_(mr)
+    {}
+    // A copy takes its memory from the same resource.
+    symbol_table_t(const symbol_table_t &other)
+        : slots_(other.slots_, other.resource()),
+          entries_(other.entries_, other.resource()),
+          names_(other.names_, other.resource()),
+          scopes_(other.scopes_, other.resource()), counters_(other.counters_),
+          kept_(other.resource()), is_kept_(other.resource())
+    {}
+    symbol_table_t &operator=(const symbol_table_t &) = default;
 
-    symbol_table_t() {}
+    std::pmr::memory_resource *resource() const
+    {
+        return entries_.get_allocator().resource();
+    }
 
-    using BaseMap<std::string_view, int>::begin;
-    using BaseMap<std::string_view, int>::end;
-    using BaseMap<std::string_view, int>::cbegin;
-    using BaseMap<std::string_view, int>::cend;
-    using BaseMap<std::string_view, int>::empty;
-    using BaseMap<std::string_view, int>::size;
-    using BaseMap<std::string_view, int>::find;
+    iterator begin() { return {this, entries_.empty() ? npos : 0}; }
+    iterator end() { return {this, npos}; }
+    const_iterator begin() const { return entries_.begin(); }
+    const_iterator end() const { return entries_.end(); }
+    bool empty() const { return entries_.empty(); }
+    std::size_t size() const { return entries_.size(); }
+    std::size_t depth() const { return scopes_.size(); }
+    // Number of entries before each scope.
+    const std::pmr::vector<std::size_t> &scopes() const { return scopes_; }
+    const counters_t &counters() const { return counters_; }
+    // Adds what another table, which kept the variables of a part of the
+    // run, counted since it had the counts before.
+    void count(const counters_t &other, const counters_t &before)
+    {
+        counters_.lookups += other.lookups - before.lookups;
+        counters_.scope_pushes += other.scope_pushes - before.scope_pushes;
+        counters_.scope_pops += other.scope_pops - before.scope_pops;
+    }
+
+    std::string_view name(const entry_t &entry) const
+    {
+        return std::string_view{names_}.substr(entry.name_begin,
+                                               entry.name_size);
+    }
+
+    iterator find(std::string_view name)
+    {
+        ++counters_.lookups;
+        std::uint32_t slot = slots_[probe(name)];
+        if (slot == empty_slot)
+            return end();
+        keep(slot);
+        return {this, slot};
+    }
+    bool contains(std::string_view name) const
+    {
+        ++counters_.lookups;
+        return slots_[probe(name)] != empty_slot;
+    }
 
     iterator add_name(std::string_view name)
     {
-        auto insertion = insert({name, 0});
-        if (insertion.second)
-            scopes_.add_name(insertion.first);
-        return insertion.first;
+        assert(!scopes_.empty());
+        ++counters_.lookups;
+        std::size_t pos = probe(name);
+        if (slots_[pos] != empty_slot)
+        {
+            keep(slots_[pos]);
+            return {this, slots_[pos]};
+        }
+        if (2 * (entries_.size() + 1) > slots_.size())
+        {
+            grow();
+            pos = probe(name);
+        }
+        std::uint32_t index = entries_.size();
+        entries_.push_back({static_cast<std::uint32_t>(names_.size()),
+                            static_cast<std::uint32_t>(name.size()),
+                            static_cast<std::uint32_t>(pos), 0});
+        names_.append(name);
+        slots_[pos] = index;
+        return {this, index};
     }
 
-    void emplace_scope() { scopes_.emplace(); }
+    void emplace_scope()
+    {
+        ++counters_.scope_pushes;
+        scopes_.push_back(entries_.size());
+    }
 
     void pop_scope()
     {
-        auto &cur_scope = scopes_.top();
-        for (auto &&pos : cur_scope)
-            erase(pos);
-        scopes_.pop();
+        ++counters_.scope_pops;
+        truncate(scopes_.back());
+        scopes_.pop_back();
+    }
+
+    // Forgets the names declared after the first size ones.
+    void truncate(std::size_t size)
+    {
+        if (size >= entries_.size())
+            return;
+        names_.resize(entries_[size].name_begin);
+        for (std::size_t i = size; i < entries_.size(); ++i)
+            slots_[entries_[i].slot] = empty_slot;
+        entries_.resize(size);
+    }
+
+    // Undoes from here what commit() does not keep.
+    void mark()
+    {
+        mark_ = entries_.size();
+        mark_depth_ = scopes_.size();
+        is_kept_.resize(mark_);
+    }
+    void commit()
+    {
+        for (auto [index, value] : kept_)
+            is_kept_[index] = false;
+        kept_.clear();
+        mark_ = 0;
+    }
+    // Sets the values back to those at the mark and forgets the names and
+    // scopes added since.
+    void rollback()
+    {
+        for (auto [index, value] : kept_)
+            entries_[index].second = value;
+        std::size_t size = mark_;
+        scopes_.resize(std::min(scopes_.size(), mark_depth_));
+        commit();
+        truncate(size);
+    }
+
+private:
+    void keep(std::uint32_t index)
+    {
+        if (index >= mark_ || is_kept_[index])
+            return;
+        is_kept_[index] = true;
+        kept_.emplace_back(index, entries_[index].second);
+    }
+
+    // Slot of the name, or the empty slot where it would go.
+    std::size_t probe(std::string_view name) const
+    {
+        std::size_t mask = slots_.size() - 1;
+        std::size_t pos = std::hash<std::string_view>{}(name) & mask;
+        for (; slots_[pos] != empty_slot; pos = (pos + 1) & mask)
+            if (this->name(entries_[slots_[pos]]) == name)
+                break;
+        return pos;
+    }
+
+    // Declarations are inserted again in their order, so the slots still
+    // look as if the live entries were the only ones ever inserted.
+    void grow()
+    {
+        slots_.assign(2 * slots_.size(), empty_slot);
+        for (std::size_t i = 0; i < entries_.size(); ++i)
+        {
+            std::size_t pos = probe(name(entries_[i]));
+            slots_[pos] = i;
+            entries_[i].slot = pos;
+        }
     }
 };
 
 class symbol_table_dumper final {
     std::ostream *debug_stream_;
+    dump_format_t format_;
 
 public:
-    symbol_table_dumper(std::ostream *ds) : debug_stream_(ds) {}
+    symbol_table_dumper(std::ostream *ds,
+                        dump_format_t format = dump_format_t::dot)
+        : debug_stream_(ds), format_(format)
+    {}
 
     void operator()(const symbol_table_t &st) const
     {
+        if (format_ == dump_format_t::json)
+        {
+            *debug_stream_ << "{\"names\":[";
+            bool first = true;
+            for (auto &&entry : st)
+            {
+                *debug_stream_ << (first ? "\"" : ",\"") << st.name(entry)
+                               << '"';
+                first = false;
+            }
+            *debug_stream_ << "]}\n";
+            return;
+        }
         *debug_stream_ << "Symbol table dump:" << std::endl;
         if (st.empty())
         {
@@ -84,9 +279,9 @@ public:
         }
         *debug_stream_ << "(Size) " << st.size() << std::endl
                        << "(Names)" << std::endl;
-        for (auto &&p : st)
-            *debug_stream_ << "\t" << p.first << std::endl;
+        for (auto &&entry : st)
+            *debug_stream_ << "\t" << st.name(entry) << std::endl;
     }
 };
 
-} // namespace AST
\ No newline at end of file
+} // namespace AST
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "lexer.h"
+#include "simd_lexer.h"
+#include "tokens.h"
+
+#include <algorithm>
+#include <future>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <string_view>
+#include <vector>
+
+namespace yy {
+
+// Read only stream buffer over text that is not copied.
+class memory_buf_t final : public std::streambuf {
+public:
+    memory_buf_t(std::string_view text)
+    {
+        char *p = const_cast<char *>(text.data());
+        setg(p, p, p + text.size());
+    }
+};
+
+// Lexes a chunk with the flex scanner.
+struct flex_lexer_t final {
+    lexed_t operator()(std::string_view text, std::size_t base) const
+    {
+        memory_buf_t buf(text);
+        std::istream in(&buf);
+        LexerPCL lexer(&in, input_t::chunk, base);
+        lexed_t res;
+        res.tokens.reserve(text.size() / lexed_t::bytes_per_token);
+        for (int kind; (kind = lexer.yylex());)
+            res.tokens.push_back(make_token(
+                kind, lexer.get_loc().begin,
+                {lexer.YYText(), static_cast<std::size_t>(lexer.YYLeng())}));
+        res.eof = lexer.get_loc();
+        return res;
+    }
+};
+
+enum class scanner_t { flex, simd };
+
+// Tokens of a text lexed by chunks in parallel. No token spans a line, so
+// the text is split right after newlines, and a comment always ends in the
+// chunk it starts in. The chunks are kept apart and read in order.
+class token_array_t final {
+    // Chunks smaller than this are not worth a thread.
+    static constexpr std::size_t min_chunk = 1 << 20;
+
+    std::string_view text_;
+    std::vector<std::vector<token_t>> chunks_;
+    location_t eof_{0, 0};
+    std::size_t chunk_ = 0, next_ = 0;
+
+public:
+    token_array_t(std::string_view text, unsigned threads,
+                  scanner_t scanner = scanner_t::flex)
+        : text_(text)
+    {
+        auto parts = split(std::max(threads, 1u));
+        auto lex = [this, scanner](std::string_view part) {
+            std::size_t base = part.data() - text_.data();
+            return scanner == scanner_t::simd ? simd_lexer_t{}(part, base)
+                                              : flex_lexer_t{}(part, base);
+        };
+        std::vector<std::future<lexed_t>> futures;
+        for (std::size_t i = 1; i < parts.size(); ++i)
+            futures.push_back(std::async(std::launch::async, lex, parts[i]));
+        auto add = [this](lexed_t lexed) {
+            chunks_.push_back(std::move(lexed.tokens));
+            eof_ = lexed.eof;
+        };
+        if (!parts.empty())
+            add(lex(parts[0]));
+        for (auto &&f : futures)
+            add(f.get());
+    }
+
+    std::string_view text() const { return text_; }
+    std::string_view text(const token_t &tok) const
+    {
+        return text_.substr(tok.offset, tok.length);
+    }
+    // Location of the end of input, the last lexeme as flex reports it.
+    location_t eof() const { return eof_; }
+
+    // Reads the tokens again from the first one.
+    void rewind() { chunk_ = next_ = 0; }
+    // Next token in text order, nullptr at the end.
+    const token_t *next()
+    {
+        while (chunk_ < chunks_.size() && next_ == chunks_[chunk_].size())
+        {
+            ++chunk_;
+            next_ = 0;
+        }
+        if (chunk_ == chunks_.size())
+            return nullptr;
+        return &chunks_[chunk_][next_++];
+    }
+
+private:
+    std::vector<std::string_view> split(unsigned threads) const
+    {
+        std::size_t nparts =
+            std::clamp<std::size_t>(text_.size() / min_chunk, 1, threads);
+        std::size_t target = text_.size() / nparts;
+        std::vector<std::string_view> parts;
+        std::size_t begin = 0;
+        for (std::size_t i = 1; i < nparts && begin < text_.size(); ++i)
+        {
+            std::size_t nl = text_.find('\n', std::max(begin, i * target));
+            if (nl == std::string_view::npos)
+                break;
+            parts.push_back(text_.substr(begin, nl + 1 - begin));
+            begin = nl + 1;
+        }
+        if (begin < text_.size())
+            parts.push_back(text_.substr(begin));
+        return parts;
+    }
+};
+
+// Prints the kind and location of every token, and the end of input.
+inline void dump_tokens(token_array_t &tokens, std::ostream &os)
+{
+    while (const token_t *tok = tokens.next())
+    {
+        os << tok->kind << ' ' << tok->offset << ' ' << tok->length;
+        if (tok->kind == parser::token_type::NUMBER)
+            os << ' ' << tok->value;
+        os << '\n';
+    }
+    os << "eof " << tokens.eof().begin << ' ' << tokens.eof().end << '\n';
+}
+
+} // namespace yy
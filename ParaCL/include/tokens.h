@@ -0,0 +1,61 @@
+#pragma once
+
+#include "parser.h"
+#include "parser.tab.hh"
+
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace yy {
+
+// Value of a NUMBER token, if it fits in int.
+inline std::optional<int> number_value(std::string_view text)
+{
+    int val = 0;
+    const char *end = text.data() + text.size();
+    auto [ptr, ec] = std::from_chars(text.data(), end, val);
+    if (ec != std::errc{} || ptr != end)
+        return std::nullopt;
+    return val;
+}
+
+struct token_t final {
+    // Kind of a NUMBER token whose value does not fit in int.
+    static constexpr std::int32_t bad_number = -1;
+
+    std::size_t offset;
+    std::uint32_t length;
+    std::int32_t kind;
+    int value;
+};
+
+// Tokens of a chunk of text and the location flex reports at its end, the
+// last lexeme including blanks and comments.
+struct lexed_t final {
+    // A token takes a few bytes of text in a typical program. Capacity that
+    // is never filled is never touched, so the estimate errs on the high
+    // side to spare copies when the array grows.
+    static constexpr std::size_t bytes_per_token = 4;
+
+    std::vector<token_t> tokens;
+    location_t eof;
+};
+
+inline token_t make_token(int kind, std::size_t offset, std::string_view text)
+{
+    token_t tok{offset, static_cast<std::uint32_t>(text.size()), kind, 0};
+    if (kind == parser::token_type::NUMBER)
+    {
+        if (auto val = number_value(text))
+            tok.value = *val;
+        else
+            tok.kind = token_t::bad_number;
+    }
+    return tok;
+}
+
+} // namespace yy
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "AST.h"
+#include "driver_exceptions.h"
+#include "varint.h"
+
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+namespace AST {
+
+// A trace is saved as its magic, the hash of the program, the number of
+// values read by ? and the values, then the number of values printed and
+// the values. Integers are varints.
+inline constexpr std::string_view trace_magic = "PCLTRAC1";
+
+inline void save_trace(std::ostream &os, const run_trace_t &trace,
+                       std::uint64_t program)
+{
+    std::string out{trace_magic};
+    put_varint(out, program);
+    for (auto *vals : {&trace.reads, &trace.writes})
+    {
+        put_varint(out, vals->size());
+        for (int val : *vals)
+            put_zigzag(out, val);
+    }
+    os.write(out.data(), out.size());
+}
+
+// Trace saved to is, to replay a run of the program with it.
+inline run_trace_t load_trace(std::istream &is, std::uint64_t program)
+{
+    std::string image{std::istreambuf_iterator<char>(is), {}};
+    varint_reader_t<ExceptsPCL::trace_error> in(image, "Trace");
+    if (!in.starts_with(trace_magic))
+        throw ExceptsPCL::trace_error("Not a trace");
+    if (in.get() != program)
+        throw ExceptsPCL::trace_error("Trace is of another program");
+    run_trace_t trace;
+    trace.replay = true;
+    for (auto *vals : {&trace.reads, &trace.writes})
+    {
+        vals->resize(in.get(image.size()));
+        for (int &val : *vals)
+            val = in.get_int();
+    }
+    if (!in.at_end())
+        throw ExceptsPCL::trace_error("Trace is corrupt");
+    return trace;
+}
+
+// Fails a replayed run that has finished before its trace.
+inline void check_replayed(const run_trace_t &trace)
+{
+    if (trace.written != trace.writes.size())
+        throw ExceptsPCL::run_error(
+            "Printed " + std::to_string(trace.written) + " of the " +
+            std::to_string(trace.writes.size()) + " values of the trace");
+    if (trace.read != trace.reads.size())
+        throw ExceptsPCL::run_error(
+            "Read " + std::to_string(trace.read) + " of the " +
+            std::to_string(trace.reads.size()) + " values of the trace");
+}
+
+} // namespace AST
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace AST {
+
+// LEB128 varints of the binary files of a run, signed ones zigzag encoded,
+// so small values take a byte.
+inline void put_varint(std::string &out, std::uint64_t val)
+{
+    for (; val >= 0x80; val >>= 7)
+        out.push_back(static_cast<char>(val | 0x80));
+    out.push_back(static_cast<char>(val));
+}
+
+inline void put_zigzag(std::string &out, int val)
+{
+    auto bits = static_cast<std::uint32_t>(val);
+    put_varint(out, (bits << 1) ^ (val < 0 ? ~std::uint32_t{0} : 0));
+}
+
+// Reads the varints of an image, throwing Error("<what> is corrupt") or
+// Error("<what> is truncated") on a bad one.
+template <typename Error> class varint_reader_t final {
+    std::string_view image_;
+    std::string what_;
+    std::size_t pos_ = 0;
+
+public:
+    varint_reader_t(std::string_view image, std::string what)
+        : image_(image), what_(std::move(what))
+    {}
+
+    bool starts_with(std::string_view prefix)
+    {
+        if (!image_.starts_with(prefix))
+            return false;
+        pos_ = prefix.size();
+        return true;
+    }
+    bool at_end() const { return pos_ == image_.size(); }
+    // What is left of the image.
+    std::string_view rest() const { return image_.substr(pos_); }
+    std::uint64_t get()
+    {
+        std::uint64_t val = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            auto byte = static_cast<unsigned char>(at(pos_++));
+            val |= std::uint64_t{byte & 0x7fu} << shift;
+            if (!(byte & 0x80))
+                return val;
+        }
+        throw Error(what_ + " is corrupt");
+    }
+    std::uint64_t get(std::uint64_t bound)
+    {
+        std::uint64_t val = get();
+        if (val >= bound)
+            throw Error(what_ + " is corrupt");
+        return val;
+    }
+    int get_int()
+    {
+        std::uint64_t val = get();
+        return static_cast<int>(static_cast<std::uint32_t>(val >> 1) ^
+                                -static_cast<std::uint32_t>(val & 1));
+    }
+    std::string_view get_str()
+    {
+        std::size_t size = get(image_.size() - pos_ + 1);
+        pos_ += size;
+        return image_.substr(pos_ - size, size);
+    }
+
+private:
+    char at(std::size_t i) const
+    {
+        if (i >= image_.size())
+            throw Error(what_ + " is truncated");
+        return image_[i];
+    }
+};
+
+} // namespace AST
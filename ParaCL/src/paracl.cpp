@@ -1,44 +1,430 @@
 #include "AST.h"
 #include "AST_dumper.h"
+#include "checkpoint.h"
 #include "paracl.h"
 #include "ast_representation.h"
 #include "lexer.h"
+#include "mapped_file.h"
 #include "driver_exceptions.h"
+#include "options.h"
+#include "prefix.h"
+#include "stats.h"
+#include "token_array.h"
+#include "trace.h"
 
+#include <csignal>
+#include <cstdio>
 #include <memory>
 #include <fstream>
-#include <sstream>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unistd.h>
 
-int main(int argc, char **argv)
+namespace {
+
+// Exit code of a program stopped by one of the --max-* limits.
+constexpr int budget_exit_code = 3;
+// Exit code of a program stopped by a signal once its state was saved.
+constexpr int interrupted_exit_code = 4;
+// Exit code of a program stopped by an operation without a defined result.
+constexpr int run_error_exit_code = 5;
+
+// Set by a signal to its number, read and cleared at the next loop back edge
+// or ?. Set while ? waits for input.
+volatile std::sig_atomic_t snapshot_request = 0, reading_input = 0;
+
+bool stops(std::sig_atomic_t request)
+{
+    return request != 0 && request != SIGUSR1;
+}
+
+// A request to stop that can not wait for a back edge, as it is the second
+// one or ? waits for input, stops the run as the signal does by default.
+void stop_now(int sig)
+{
+    std::signal(sig, SIG_DFL);
+    std::raise(sig);
+}
+
+void request_snapshot(int sig)
+{
+    if (stops(sig) && (reading_input || stops(snapshot_request)))
+        stop_now(sig);
+    else
+        snapshot_request = sig;
+}
+
+// SIGUSR1 saves the state of the run, SIGTERM and SIGINT save it and stop
+// the run. A new checkpoint replaces the old one only once it is complete.
+AST::run_snapshots_t make_snapshots(const OptionsPCL::options_t &options,
+                                    const AST::checkpoint_t &checkpoint)
+{
+    std::signal(SIGUSR1, request_snapshot);
+    std::signal(SIGTERM, request_snapshot);
+    std::signal(SIGINT, request_snapshot);
+
+    AST::run_snapshots_t snapshots;
+    snapshots.every = options.checkpoint_every;
+    snapshots.requested = &snapshot_request;
+    snapshots.reading = &reading_input;
+    snapshots.save = [&checkpoint, file = options.checkpoint_file](
+                         const AST::ast_machine_t &m) {
+        std::sig_atomic_t request = snapshot_request;
+        snapshot_request = 0;
+        // What is printed before the checkpoint is not printed again.
+        std::cout.flush();
+        std::string tmp = file + ".tmp";
+        std::ofstream os(tmp, std::ios::binary);
+        checkpoint.save(os, m);
+        os.close();
+        if (os.fail() || std::rename(tmp.c_str(), file.c_str()) != 0)
+            throw ExceptsPCL::checkpoint_error("Can not write " + file);
+        if (stops(request))
+            throw ExceptsPCL::interrupted_error(
+                "Stopped, the state is saved to " + file);
+    };
+    return snapshots;
+}
+
+AST::run_budget_t make_budget(const OptionsPCL::options_t &options)
+{
+    AST::run_budget_t budget;
+    budget.max_steps = options.max_steps.value_or(budget.max_steps);
+    budget.max_output = options.max_output.value_or(budget.max_output);
+    budget.max_vars = options.max_vars.value_or(budget.max_vars);
+    budget.max_time_ms = options.max_time_ms.value_or(budget.max_time_ms);
+    return budget;
+}
+
+// Parses the program again from its tokens and optimizes the copy in the
+// background, while the program runs as it was parsed. Each loop goes on as
+// its optimized copy once that is made.
+class background_optimizer_t final {
+    AST::ast_representation_t copy_;
+    std::thread thread_;
+
+public:
+    background_optimizer_t(const OptionsPCL::options_t &options,
+                           yy::token_array_t &tokens,
+                           const AST::ast_representation_t &astr)
+    {
+        if (options.memo)
+            copy_.memoize();
+        if (options.check_overflow)
+            copy_.check_overflow();
+        std::unordered_map<std::size_t, const AST::ast_while_t *> loops;
+        for (auto loop : AST::outer_loops(astr.get_ast().root()))
+        {
+            auto *whilest = static_cast<const AST::ast_while_t *>(loop->get());
+            loops.emplace(whilest->offset, whilest);
+        }
+        tokens.rewind();
+        thread_ = std::thread([this, &tokens, &options,
+                               loops = std::move(loops)] {
+            // The program was parsed once, so it is parsed again as well,
+            // and the run goes on as it is if it can not be optimized.
+            try
+            {
+                yy::module_loader_t modules(copy_, false);
+                yy::DriverPCL driver(&tokens, options.file_name);
+                driver.use_modules(&modules);
+                driver.parse(&copy_);
+                copy_.optimize_loops(
+                    [&loops](std::size_t offset, const AST::ast_node_t &form) {
+                        loops.at(offset)->tier.store(
+                            &form, std::memory_order_release);
+                    });
+            }
+            catch (const std::exception &)
+            {}
+        });
+    }
+    ~background_optimizer_t() { thread_.join(); }
+};
+
+// Prefix of the run saved to the file of options if it is of the program,
+// else runs it and saves it there. A prefix that can not be saved is run
+// again next time.
+AST::run_prefix_t prefix(AST::ast_representation_t &astr,
+                         const AST::checkpoint_t &checkpoint,
+                         const OptionsPCL::options_t &options,
+                         std::uint64_t program)
+{
+    const std::string &file = options.prefix_file;
+    std::ifstream is(file, std::ios::binary);
+    if (auto prefix = AST::load_prefix(is, program, options.check_overflow))
+        return *prefix;
+    AST::run_prefix_t prefix =
+        astr.run_prefix(checkpoint, options.prefix_steps);
+    std::string tmp = file + ".tmp";
+    std::ofstream os(tmp, std::ios::binary);
+    AST::save_prefix(os, prefix, program, options.check_overflow);
+    os.close();
+    if (os.fail() || std::rename(tmp.c_str(), file.c_str()) != 0)
+        std::remove(tmp.c_str());
+    return prefix;
+}
+
+void dump(const AST::ast_representation_t &astr,
+          const OptionsPCL::options_t &options, StatsPCL::stopwatch_t &watch)
+{
+    if (!options.dump)
+        return;
+    std::ofstream asts("./AST_dump"), sts("./ST_dump"), opts("./OPT_dump");
+    AST::astr_dumper dumper(&asts, &sts, &opts, *options.dump);
+    dumper(astr);
+    watch.lap(StatsPCL::phase_t::dump);
+}
+
+void report_run_error(const yy::DriverPCL &driver,
+                      const ExceptsPCL::run_error &re)
+{
+    if (auto offset = re.offset())
+        driver.report_error(re.what(), {*offset, *offset});
+    else
+        driver.report_error(re.what());
+}
+
+// Runs the part of the program that executes it, reporting an exceeded
+// limit at the loop or scope where it was noticed and a failed operation
+// where it is.
+template <typename F> int run_in_budget(const yy::DriverPCL &driver, F &&run)
 {
     try
     {
-        if (argc < 2 || argc > 2)
+        run();
+    }
+    catch (const ExceptsPCL::budget_error &be)
+    {
+        driver.report_error(be.what(), {be.offset(), be.offset()});
+        return budget_exit_code;
+    }
+    catch (const ExceptsPCL::run_error &re)
+    {
+        report_run_error(driver, re);
+        return run_error_exit_code;
+    }
+    catch (const ExceptsPCL::interrupted_error &ie)
+    {
+        std::cerr << ie.what() << ".\n";
+        return interrupted_exit_code;
+    }
+    return 0;
+}
+
+// Runs the statements of the standard input as they come. One that does
+// not compile or fails as it runs is reported and dropped with the rest of
+// its line, what ran and was defined before it stays.
+int repl(AST::ast_representation_t &astr, yy::LexerPCL &lexer,
+         yy::DriverPCL &driver)
+{
+    astr.interact();
+    if (isatty(STDIN_FILENO))
+        lexer.prompt(&std::cout);
+    return run_in_budget(driver, [&] {
+        for (;;)
         {
-            std::cerr << "Error. Please use: " << argv[0] << " *src_file*.\n";
-            return 1;
+            try
+            {
+                driver.parse(&astr);
+                return;
+            }
+            catch (const ExceptsPCL::compilation_error &)
+            {}
+            catch (const ExceptsPCL::run_error &re)
+            {
+                report_run_error(driver, re);
+            }
+            astr.recover();
+            lexer.skip_line();
         }
-        std::string ifile_name(argv[1]);
-        std::ifstream file_stream(ifile_name);
-        if (file_stream.fail())
+    });
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        auto options = OptionsPCL::parse_options(argc, argv);
+        if (!options)
         {
-            std::cerr << "File " << ifile_name << " is not exhisting.\n";
+            std::cerr << "Error. Please use: " << argv[0]
+                      << " [--stream] [--lex-threads=N] [--lexer=flex|simd]"
+                         " [--tokens] [--tiered] [--parallel[=N]] [--memo]"
+                         " [--check-overflow]"
+                         " [--dump[=dot|json]]"
+                         " [--stats=file.json] [--checkpoint=file]"
+                         " [--checkpoint-every=N] [--restore=file]"
+                         " [--record=file] [--replay=file]"
+                         " [--prefix=file] [--prefix-steps=N]"
+                         " [--max-steps=N] [--max-output=BYTES] [--max-vars=N]"
+                         " [--max-time=MS] *src_file*, or --repl without it.\n";
             return 1;
         }
-        std::stringstream buffer;
-        buffer << file_stream.rdbuf();
+        std::optional<StatsPCL::stats_t> stats;
+        if (!options->stats_file.empty())
+            stats.emplace();
+        StatsPCL::stopwatch_t watch(stats ? &*stats : nullptr);
 
-        yy::LexerPCL lexer(&buffer);
-        yy::DriverPCL driver(&lexer, ifile_name);
-        AST::ast_representation_t astr;
-        driver.parse(&astr);
+        AST::ast_representation_t astr(options->stream || options->repl);
+        if (stats)
+            astr.count_runs();
+        if (options->memo)
+            astr.memoize();
+        if (options->check_overflow)
+            astr.check_overflow();
+        if (options->max_steps || options->max_output || options->max_vars ||
+            options->max_time_ms)
+            astr.limit(make_budget(*options));
+        // A streamed function is optimized as soon as it is defined, so the
+        // modules of a streamed program are not saved.
+        yy::module_loader_t modules(astr, !options->stream && !options->repl);
 
-#ifndef NDEBUG
-        std::ofstream asts("./AST_dump"), sts("./ST_dump");
-        AST::astr_dumper dumper(&asts, &sts); 
-        dumper(astr);
-#endif
-        astr.execute();
+        int res = 0;
+        if (options->stream || options->repl)
+        {
+            std::ifstream file_stream;
+            if (!options->repl)
+            {
+                file_stream.open(options->file_name);
+                if (file_stream.fail())
+                {
+                    std::cerr << "File " << options->file_name
+                              << " is not exhisting.\n";
+                    return 1;
+                }
+            }
+            watch.lap(StatsPCL::phase_t::read);
+            // Statements are lexed, parsed and run in turn: it is all
+            // execution time.
+            std::istream &input = options->repl ? std::cin : file_stream;
+            yy::LexerPCL lexer(&input, yy::input_t::stream);
+            yy::DriverPCL driver(&lexer, options->repl ? "<stdin>"
+                                                       : options->file_name);
+            driver.use_modules(&modules);
+            res = options->repl
+                      ? repl(astr, lexer, driver)
+                      : run_in_budget(driver, [&] { driver.parse(&astr); });
+            watch.lap(StatsPCL::phase_t::execute);
+            // A stopped program was not parsed to its end.
+            if (res == 0)
+                dump(astr, *options, watch);
+        }
+        else
+        {
+            yy::mapped_file_t file(options->file_name);
+            if (file.fail())
+            {
+                std::cerr << "File " << options->file_name
+                          << " is not exhisting.\n";
+                return 1;
+            }
+            watch.lap(StatsPCL::phase_t::read);
+            unsigned threads = options->lex_threads
+                                   ? options->lex_threads
+                                   : std::thread::hardware_concurrency();
+            yy::token_array_t tokens(file.text(), threads,
+                                     options->simd_lexer ? yy::scanner_t::simd
+                                                         : yy::scanner_t::flex);
+            watch.lap(StatsPCL::phase_t::lex);
+            if (options->tokens)
+            {
+                yy::dump_tokens(tokens, std::cout);
+                return 0;
+            }
+            yy::DriverPCL driver(&tokens, options->file_name);
+            driver.use_modules(&modules);
+            driver.parse(&astr);
+            watch.lap(StatsPCL::phase_t::parse);
+            std::optional<background_optimizer_t> optimizer;
+            if (options->tiered)
+                optimizer.emplace(*options, tokens, astr);
+            else
+                astr.optimize();
+            if (options->parallel)
+                astr.parallelize(*options->parallel
+                                     ? *options->parallel
+                                     : std::thread::hardware_concurrency());
+            watch.lap(StatsPCL::phase_t::optimize);
+            dump(astr, *options, watch);
+            std::uint64_t program =
+                modules.hash(AST::program_hash(file.text()));
+            AST::checkpoint_t checkpoint(astr.get_ast(), program);
+            if (!options->checkpoint_file.empty())
+                astr.snapshot(make_snapshots(*options, checkpoint));
+            std::ifstream restore_stream;
+            if (!options->restore_file.empty())
+            {
+                restore_stream.open(options->restore_file, std::ios::binary);
+                if (restore_stream.fail())
+                {
+                    std::cerr << "File " << options->restore_file
+                              << " is not exhisting.\n";
+                    return 1;
+                }
+            }
+            if (!options->record_file.empty())
+                astr.record();
+            if (!options->replay_file.empty())
+            {
+                std::ifstream replay_stream(options->replay_file,
+                                            std::ios::binary);
+                if (replay_stream.fail())
+                {
+                    std::cerr << "File " << options->replay_file
+                              << " is not exhisting.\n";
+                    return 1;
+                }
+                astr.record(AST::load_trace(replay_stream, program));
+            }
+            std::optional<AST::run_prefix_t> run_prefix;
+            if (!options->prefix_file.empty())
+                run_prefix = prefix(astr, checkpoint, *options, program);
+            res = run_in_budget(driver, [&] {
+                if (restore_stream.is_open())
+                    astr.resume(checkpoint, restore_stream);
+                else if (run_prefix)
+                    astr.resume(checkpoint, *run_prefix);
+                else
+                    astr.execute();
+                if (!options->replay_file.empty())
+                    AST::check_replayed(*astr.get_trace());
+            });
+            watch.lap(StatsPCL::phase_t::execute);
+            // No back edge was left to handle the request.
+            if (stops(snapshot_request))
+                stop_now(snapshot_request);
+            // A stopped run is recorded up to where it stopped, so that its
+            // replay stops there too.
+            if (!options->record_file.empty())
+            {
+                std::ofstream trace_stream(options->record_file,
+                                           std::ios::binary);
+                AST::save_trace(trace_stream, *astr.get_trace(), program);
+                if (trace_stream.fail())
+                {
+                    std::cerr << "Can not write " << options->record_file
+                              << ".\n";
+                    return 1;
+                }
+            }
+        }
+
+        if (stats)
+        {
+            std::ofstream stats_stream(options->stats_file);
+            stats->write(stats_stream, astr);
+            if (stats_stream.fail())
+            {
+                std::cerr << "Can not write " << options->stats_file
+                          << ".\n";
+                return 1;
+            }
+        }
+        return res;
     }
     catch (const ExceptsPCL::compilation_error& ce)
     {
@@ -49,6 +435,6 @@ int main(int argc, char **argv)
         std::cerr << e.what() << '\n';
         return 1;
     }
-    
+
     return 0;
-}
\ No newline at end of file
+}
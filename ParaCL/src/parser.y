@@ -50,16 +50,13 @@
     }                                                     \
     else                                                  \
     {                                                     \
-      (Cur).first_line   = (Cur).last_line   =            \
-        YYRHSLOC(Rhs, 0).last_line;                       \
-      (Cur).first_column = (Cur).last_column =            \
-        YYRHSLOC(Rhs, 0).last_column;                     \
+      (Cur).begin = (Cur).end = YYRHSLOC(Rhs, 0).end;     \
     }                                                     \
     while (0)
 
     std::ostream& operator<<(std::ostream& stream, const location_t& loc) 
     {
-        return stream << loc.first_line << " " << loc.first_column << " " << loc.last_line << " " << loc.last_column;
+        return stream << loc.begin << " " << loc.end;
     }
 }
 
@@ -89,12 +86,21 @@
     LOR             "||"
     LNO             "!"
     MODDIV          "%"
+    FUNC            "func"
+    RETURN          "return"
+    COMMA           ","
     ERROR
 ;
 
 %token <number_tt> NUMBER
 %token <ident_tt> IDENT
+%token
+    IMPORT          "import"
+    MODULE
+;
+%token <ident_tt> STRING
 
+%nterm <nterm_nt> top_stmts
 %nterm <nterm_nt>     stmts
 %nterm <nterm_nt>      stmt
 %nterm <nterm_nt>     scope
@@ -113,17 +119,74 @@
 %nterm <nterm_nt>      body
 %nterm <nterm_nt>      logics
 %nterm <nterm_nt>      comp
+%nterm <params_nt>   params
+%nterm <params_nt>   param_list
+%nterm <args_nt>     args
+%nterm <args_nt>     arg_list
 
 %nterm scope_entry
 %nterm scope_exit
+%nterm program_exit
+%nterm funcdef
+%nterm funchead
+%nterm import
+%nterm module_defs
 
 %start program
 
 %%
-program: scope_entry stmts scope_exit { astr->set_root(astr->make_node<ast_scope_t>($2)); }
+program: top_stmts program_exit { astr->set_root(astr->make_node<ast_scope_t>($1)); }
+       | MODULE module_defs
+;
+
+program_exit: %empty                  { astr->end_program(); }
+;
+
+top_stmts: top_stmts stmt   { $$ = $1; astr->add_top_statement($$, $2); }
+         | top_stmts funcdef { $$ = $1; }
+         | top_stmts import { $$ = $1; }
+         | %empty           { $$ = astr->begin_program(); }
+;
+
+module_defs: module_defs funcdef
+           | module_defs import
+           | %empty
+;
+
+import: IMPORT STRING SEMICOLON {
+                              try {
+                                driver->import($2, @2);
+                              } catch (ExceptsPCL::compilation_error &ce)
+                              {
+                                throw yy::parser::syntax_error
+                                  (@2, ce.what());
+                              }
+                            }
+;
+
+funcdef: funchead scope     { astr->end_function($2); }
+;
+
+funchead: FUNC IDENT LPAR params RPAR {
+                              try {
+                                astr->begin_function($2, $4);
+                              } catch (ExceptsPCL::compilation_error &ce)
+                              {
+                                throw yy::parser::syntax_error
+                                  (@2, ce.what());
+                              }
+                            }
+;
+
+params: param_list          { $$ = std::move($1); }
+      | %empty              {}
+;
+
+param_list: param_list COMMA IDENT { $$ = std::move($1); $$.push_back($3); }
+          | IDENT                  { $$.push_back($1); }
 ;
 
-scope: LCURLY scope_entry stmts scope_exit RCURLY { $$ = astr->make_node<ast_scope_t>($3); }
+scope: LCURLY scope_entry stmts scope_exit RCURLY { $$ = astr->make_scope($3, @1.begin); }
 ;
 
 scope_entry: %empty                   { astr->emplace_scope(); }
@@ -132,13 +195,21 @@ scope_entry: %empty                   { astr->emplace_scope(); }
 scope_exit: %empty                    { astr->pop_scope(); }
 ;
 
-stmts: stmt stmts           { $$ = astr->make_node<ast_statements_t>($1, $2); }
+stmts: stmts stmt           { $$ = $1; astr->add_statement($$, $2); }
      | %empty               { $$ = astr->make_node<ast_statements_t>(); }
 
 stmt: expr SEMICOLON { $$ = $1; }
     | cndtl          { $$ = $1; }
     | scope          { $$ = $1; }
     | SEMICOLON      { $$ = astr->make_node<ast_empty_op_t>(); }
+    | RETURN expr SEMICOLON {
+                       try {
+                         $$ = astr->make_return($2);
+                       } catch (ExceptsPCL::compilation_error &ce)
+                       {
+                         throw yy::parser::syntax_error(@1, ce.what());
+                       }
+                     }
 ;
 
 expr: decl                  { $$ = $1; }
@@ -157,7 +228,7 @@ ifelsest: ifst ELSE ifelsest  { $$ = astr->make_node<ast_ifelse_t>($1, $3); }
 ifst: IF cond body          { $$ = astr->make_node<ast_if_t>($2, $3); }
 ;
 
-whilest: WHILE cond body    { $$ = astr->make_node<ast_while_t>($2, $3); }
+whilest: WHILE cond body    { $$ = astr->make_node<ast_while_t>($2, $3, @1.begin); }
 ;
 
 cond: LPAR expr RPAR        { $$ = $2; }
@@ -166,11 +237,11 @@ cond: LPAR expr RPAR        { $$ = $2; }
 body: stmt                  { $$ = $1; }
 ;
 
-decl: lval ASSIGNMENT expr  { $$ = astr->make_node<ast_assign_op>($1, $3); }
+decl: lval ASSIGNMENT expr  { $$ = astr->make_assign($1, $3, @2.begin); }
 ;
 
 lval: IDENT                 { 
-                              $$ = astr->make_node_st<ast_lval_t>($1);
+                              $$ = astr->make_lval($1);
                             }
 ;
 
@@ -191,14 +262,14 @@ comp: comp EQUAL     epn      { $$ = astr->make_node<ast_equal_op>($1, $3); }
     | epn                     { $$ = $1; }
 ;
 
-epn: epn PLUS      tpn      { $$ = astr->make_node<ast_plus_op>($1, $3); }
-   | epn MINUS     tpn      { $$ = astr->make_node<ast_minus_op>($1, $3); }
+epn: epn PLUS      tpn      { $$ = astr->make_arith<ast_plus_op>($1, $3, @2.begin); }
+   | epn MINUS     tpn      { $$ = astr->make_arith<ast_minus_op>($1, $3, @2.begin); }
    | tpn                    { $$ = $1; }
 ;
 
-tpn: tpn MULTIPLICATION fn  { $$ = astr->make_node<ast_mul_op>($1, $3); }
-   | tpn DIVISION       fn  { $$ = astr->make_node<ast_div_op>($1, $3); }
-   | tpn MODDIV         fn  { $$ = astr->make_node<ast_modular_division_op>($1, $3); }
+tpn: tpn MULTIPLICATION fn  { $$ = astr->make_arith<ast_mul_op>($1, $3, @2.begin); }
+   | tpn DIVISION       fn  { $$ = astr->make_arith<ast_div_op>($1, $3, @2.begin); }
+   | tpn MODDIV         fn  { $$ = astr->make_arith<ast_modular_division_op>($1, $3, @2.begin); }
    | fn
 ;
 
@@ -206,20 +277,38 @@ fn: LPAR expr RPAR          { $$ = $2; }
   | NUMBER                  { $$ = astr->make_node<ast_num_t>($1); }
   | IDENT                   { 
                               try {
-                                $$ = astr->make_node_st<ast_var_t>($1); 
+                                $$ = astr->make_var($1); 
                               } catch (ExceptsPCL::compilation_error &ce)
                               {
                                 throw yy::parser::syntax_error
                                   (@$, ce.what());
                               }
                             }
+  | IDENT LPAR args RPAR    {
+                              try {
+                                $$ = astr->make_call($1, std::move($3),
+                                                     @1.begin);
+                              } catch (ExceptsPCL::compilation_error &ce)
+                              {
+                                throw yy::parser::syntax_error
+                                  (@1, ce.what());
+                              }
+                            }
   | WRITE                   { $$ = astr->make_node<ast_write_t>(); }
-  | PRINT expr              { $$ = astr->make_node<ast_print_op>($2); }
-  | MINUS fn                { $$ = astr->make_node<ast_unminus_op>($2); }
+  | PRINT expr              { $$ = astr->make_node<ast_print_op>($2, @1.begin); }
+  | MINUS fn                { $$ = astr->make_arith<ast_unminus_op>($2, @1.begin); }
   | PLUS  fn                { $$ = astr->make_node<ast_unplus_op>($2); }
   | LNO   fn                { $$ = astr->make_node<ast_logical_no_op>($2); }
 ;
 
+args: arg_list              { $$ = std::move($1); }
+    | %empty                {}
+;
+
+arg_list: arg_list COMMA expr { $$ = std::move($1); $$.push_back($3); }
+        | expr                { $$.push_back($1); }
+;
+
 %%
 
 namespace yy {
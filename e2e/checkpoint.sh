@@ -0,0 +1,27 @@
+TEST=$1
+TESTER=$2
+
+ANS=${TEST%.*}.ans
+TESTDAT=${TEST%.*}.dat
+NAME=$(basename $TEST)
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
+
+# The first run saves every few loop iterations until the step limit stops
+# it, the second one goes on from the last state saved.
+eval ${TESTER} --checkpoint=$DIR/$NAME.ck --checkpoint-every=4 --max-steps=40 \
+  ${TEST} < $TESTDAT > /dev/null 2>&1
+eval ${TESTER} --restore=$DIR/$NAME.ck ${TEST} < $TESTDAT > $DIR/$NAME.log 2>&1
+
+DIFF=$(diff -w $DIR/$NAME.log ${ANS})
+
+if [ $? -ne 0 ]; then
+  echo "" >> $DIR/$NAME.log
+  echo "Diff is:" >> $DIR/$NAME.log
+  echo "$DIFF" >> $DIR/$NAME.log
+  echo "Test ${NAME} failed, see $DIR/${NAME}.log"
+  exit 1
+else
+  rm -r $DIR
+  echo "Test ${NAME} passed"
+fi
@@ -0,0 +1,17 @@
+TEST=$1
+TESTER=$2
+
+NAME=$(basename $TEST)
+
+FLEX=$(eval ${TESTER} --tokens --lexer=flex ${TEST}) || exit 1
+SIMD=$(eval ${TESTER} --tokens --lexer=simd ${TEST}) || exit 1
+
+DIFF=$(diff <(echo "$FLEX") <(echo "$SIMD"))
+
+if [ $? -ne 0 ]; then
+  echo "Scanners differ on ${NAME}:"
+  echo "$DIFF"
+  exit 1
+else
+  echo "Scanners agree on ${NAME}"
+fi
@@ -0,0 +1,20 @@
+TEST=$1
+TESTER=$2
+
+ANS=${TEST%.*}.ans
+TESTDAT=${TEST%.*}.dat
+NAME=$(basename $TEST)
+DIR=$(mktemp -d)
+
+# The dumps are written to the working directory.
+(cd $DIR && eval ${TESTER} --dump=json ${TEST} < $TESTDAT > /dev/null) || exit 1
+DIFF=$(cat $DIR/AST_dump $DIR/ST_dump $DIR/OPT_dump | diff -w - ${ANS})
+
+if [ $? -ne 0 ]; then
+  echo "Dumps of ${NAME} differ:"
+  echo "$DIFF"
+  exit 1
+else
+  rm -r $DIR
+  echo "Dumps of ${NAME} match"
+fi
@@ -0,0 +1,30 @@
+TESTER=$1
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
+
+# A text of several megabytes, lexed in chunks that end at all kinds of
+# lines.
+awk 'BEGIN {
+  srand(1)
+  n = split("x alpha_beta1 _ if else while print ? 0 007 2147483648 " \
+            "== != <= >= && || ! = + - * / % ; ( ) { } // \t @ iff", words)
+  for (size = 0; size < 4500000; size += length(line) + 1) {
+    line = ""
+    for (k = int(rand() * 12); k > 0; --k)
+      line = line (rand() < 0.7 ? " " : "") words[1 + int(rand() * n)]
+    print line
+  }
+}' > $DIR/big.pcl
+
+for LEXER in flex simd; do
+  for THREADS in 1 4; do
+    eval ${TESTER} --tokens --lexer=$LEXER --lex-threads=$THREADS \
+      $DIR/big.pcl > $DIR/$LEXER$THREADS.tokens || exit 1
+  done
+  if ! cmp -s $DIR/${LEXER}1.tokens $DIR/${LEXER}4.tokens; then
+    echo "Chunks of the $LEXER scanner differ from one chunk, see $DIR"
+    exit 1
+  fi
+done
+rm -r $DIR
+echo "Chunks agree with one chunk"
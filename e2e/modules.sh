@@ -0,0 +1,38 @@
+TEST=$1
+TESTER=$2
+
+ANS=${TEST%.*}.ans
+CHANGED_ANS=${TEST%.*}.changed.ans
+TESTDAT=${TEST%.*}.dat
+NAME=$(basename $TEST)
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
+
+# The program and its modules are copied, so that their artifacts are saved
+# next to the copies. The first run compiles the modules, the second one
+# reads their artifacts and the third one compiles again the modules that
+# the .sed file of the test changed since, which then print the changed
+# answer. The modules are touched as well, as the sizes may stay the same.
+cp -r $(dirname $TEST)/lib ${TEST} $DIR
+for RUN in cold warm changed; do
+  if [ $RUN = changed ]; then
+    sed -i -f ${TEST%.*}.sed $DIR/lib/*.pcl
+    touch -d "+1 minute" $DIR/lib/*.pcl
+    ANS=$CHANGED_ANS
+  fi
+  eval ${TESTER} $DIR/$NAME < $TESTDAT > $DIR/$NAME.log
+  DIFF=$(diff -w $DIR/$NAME.log ${ANS})
+  if [ $? -ne 0 ]; then
+    echo "" >> $DIR/$NAME.log
+    echo "Diff of the $RUN run is:" >> $DIR/$NAME.log
+    echo "$DIFF" >> $DIR/$NAME.log
+    echo "Test ${NAME} failed, see $DIR/${NAME}.log"
+    exit 1
+  fi
+  if [ $RUN = cold ] && [ -z "$(ls $DIR/lib | grep '\.pclm$')" ]; then
+    echo "Test ${NAME} failed, no module artifact is saved"
+    exit 1
+  fi
+done
+rm -r $DIR
+echo "Test ${NAME} passed"
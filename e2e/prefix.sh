@@ -0,0 +1,24 @@
+TEST=$1
+TESTER=$2
+
+ANS=${TEST%.*}.ans
+TESTDAT=${TEST%.*}.dat
+NAME=$(basename $TEST)
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
+
+# The first run saves the prefix of the program before its first ?, the
+# second one goes on from it. Both must print the answer.
+for RUN in first second; do
+  eval ${TESTER} --prefix=$DIR/$NAME.prefix ${TEST} < $TESTDAT > $DIR/$NAME.log
+  DIFF=$(diff -w $DIR/$NAME.log ${ANS})
+  if [ $? -ne 0 ]; then
+    echo "" >> $DIR/$NAME.log
+    echo "Diff of the $RUN run is:" >> $DIR/$NAME.log
+    echo "$DIFF" >> $DIR/$NAME.log
+    echo "Test ${NAME} failed, see $DIR/${NAME}.log"
+    exit 1
+  fi
+done
+rm -r $DIR
+echo "Test ${NAME} passed"
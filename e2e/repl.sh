@@ -0,0 +1,23 @@
+TEST=$1
+TESTER=$2
+
+ANS=${TEST%.*}.ans
+NAME=$(basename $TEST)
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
+
+# The session is the standard input, errors are part of the answer.
+eval ${TESTER} --repl < ${TEST} > $DIR/$NAME.log 2>&1
+
+DIFF=$(diff -w $DIR/$NAME.log ${ANS})
+
+if [ $? -ne 0 ]; then
+  echo "" >> $DIR/$NAME.log
+  echo "Diff is:" >> $DIR/$NAME.log
+  echo "$DIFF" >> $DIR/$NAME.log
+  echo "Test ${NAME} failed, see $DIR/${NAME}.log"
+  exit 1
+else
+  rm -r $DIR
+  echo "Test ${NAME} passed"
+fi
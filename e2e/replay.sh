@@ -0,0 +1,28 @@
+TEST=$1
+TESTER=$2
+
+ANS=${TEST%.*}.ans
+TESTDAT=${TEST%.*}.dat
+NAME=$(basename $TEST)
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
+
+# The first run records its input and output, the second one replays them
+# with no input at all and must stop the same way.
+eval ${TESTER} --record=$DIR/$NAME.trace ${TEST} < $TESTDAT > /dev/null 2>&1
+RECORDED=$?
+eval ${TESTER} --replay=$DIR/$NAME.trace ${TEST} < /dev/null > $DIR/$NAME.log
+REPLAYED=$?
+
+DIFF=$(diff -w $DIR/$NAME.log ${ANS})
+
+if [ $? -ne 0 ] || [ $RECORDED -ne $REPLAYED ]; then
+  echo "" >> $DIR/$NAME.log
+  echo "Exit codes are $RECORDED and $REPLAYED, diff is:" >> $DIR/$NAME.log
+  echo "$DIFF" >> $DIR/$NAME.log
+  echo "Test ${NAME} failed, see $DIR/${NAME}.log"
+  exit 1
+else
+  rm -r $DIR
+  echo "Test ${NAME} passed"
+fi
@@ -0,0 +1,28 @@
+TESTER=$1
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
+
+# The quarantine of a sanitized build keeps the freed nodes resident.
+export ASAN_OPTIONS=detect_leaks=0:quarantine_size_mb=0
+
+# Sessions of the REPL ten times as long must not take more memory, as the
+# nodes of a statement are freed once it has run.
+for STATEMENTS in 1000 10000; do
+  awk -v n=$STATEMENTS 'BEGIN {
+    print "y = 3;"
+    for (i = 1; i < n; ++i)
+      print "x" i % 10 " = " i " + " i " * y;"
+    print "print x1;"
+  }' > $DIR/$STATEMENTS.pcl
+  eval ${TESTER} --repl --stats=$DIR/$STATEMENTS.json \
+    < $DIR/$STATEMENTS.pcl > /dev/null || exit 1
+done
+SHORT=$(grep -o '"peak_rss_kb": [0-9]*' $DIR/1000.json | grep -o '[0-9]*$')
+LONG=$(grep -o '"peak_rss_kb": [0-9]*' $DIR/10000.json | grep -o '[0-9]*$')
+
+echo "The REPL took $SHORT kB for 1000 statements, $LONG kB for 10000"
+# Allocators may keep a few blocks more.
+if [ $LONG -gt $((SHORT + 8192)) ]; then
+  exit 1
+fi
+rm -r $DIR
@@ -0,0 +1,26 @@
+TESTER=$1
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
+
+# A statement of the REPL takes as long however many variables the session
+# has, so a session with four times the variables takes about four times
+# as long.
+TIMEFORMAT=%3U
+for VARIABLES in 5000 20000; do
+  awk -v n=$VARIABLES 'BEGIN {
+    for (i = 0; i < n; ++i)
+      print "v" i " = " i ";"
+    print "print v1;"
+  }' > $DIR/$VARIABLES.pcl
+  { time eval ${TESTER} --repl < $DIR/$VARIABLES.pcl > /dev/null ; } \
+    2> $DIR/$VARIABLES.time || exit 1
+done
+SHORT=$(tr -d . < $DIR/5000.time)
+LONG=$(tr -d . < $DIR/20000.time)
+
+echo "The REPL took $SHORT ms for 5000 variables, $LONG ms for 20000"
+# Timers are coarse for short runs.
+if [ $((10#$LONG)) -gt $((8 * 10#$SHORT + 100)) ]; then
+  exit 1
+fi
+rm -r $DIR
@@ -4,18 +4,20 @@ TESTER=$2
 ANS=${TEST%.*}.ans
 TESTDAT=${TEST%.*}.dat
 NAME=$(basename $TEST)
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
 
-eval ${TESTER} ${TEST} < $TESTDAT > $NAME.log
+eval ${TESTER} ${TEST} < $TESTDAT > $DIR/$NAME.log
 
-DIFF=$(diff -w $NAME.log ${ANS})
+DIFF=$(diff -w $DIR/$NAME.log ${ANS})
 
 if [ $? -ne 0 ]; then
-  echo "" >> $NAME.log
-  echo "Diff is:" >> $NAME.log
-  echo "$DIFF" >> $NAME.log
-  echo "Test ${NAME} failed, see ${NAME}.log"
+  echo "" >> $DIR/$NAME.log
+  echo "Diff is:" >> $DIR/$NAME.log
+  echo "$DIFF" >> $DIR/$NAME.log
+  echo "Test ${NAME} failed, see $DIR/${NAME}.log"
   exit 1
 else
-  rm $NAME.log
+  rm -r $DIR
   echo "Test ${NAME} passed"
 fi
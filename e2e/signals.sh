@@ -0,0 +1,44 @@
+TEST=$1
+TESTER=$2
+
+ANS=${TEST%.*}.ans
+SIGNALS=${TEST%.*}.sig
+NAME=$(basename $TEST)
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
+
+# The run saves its state to a checkpoint and gets the signals of the .sig
+# file half a second apart, while it runs on or waits for input that never
+# comes. It must stop within seconds, with a checkpoint if a loop could save
+# one.
+mkfifo $DIR/input
+${TESTER} --checkpoint=$DIR/$NAME.ck ${TEST} < $DIR/input > $DIR/$NAME.log 2>&1 &
+PID=$!
+exec 3> $DIR/input
+for SIGNAL in $(cat $SIGNALS); do
+  sleep 0.5
+  kill -$SIGNAL $PID
+done
+for i in $(seq 50); do
+  kill -0 $PID 2> /dev/null || break
+  sleep 0.1
+done
+kill -KILL $PID 2> /dev/null
+wait $PID
+echo "Exit code $?" >> $DIR/$NAME.log
+exec 3>&-
+[ -f $DIR/$NAME.ck ] && echo "Checkpoint saved" >> $DIR/$NAME.log
+sed -i "s|$DIR/||" $DIR/$NAME.log
+
+DIFF=$(diff -w $DIR/$NAME.log ${ANS})
+
+if [ $? -ne 0 ]; then
+  echo "" >> $DIR/$NAME.log
+  echo "Diff is:" >> $DIR/$NAME.log
+  echo "$DIFF" >> $DIR/$NAME.log
+  echo "Test ${NAME} failed, see $DIR/${NAME}.log"
+  exit 1
+else
+  rm -r $DIR
+  echo "Test ${NAME} passed"
+fi
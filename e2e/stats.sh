@@ -0,0 +1,22 @@
+TEST=$1
+TESTER=$2
+
+ANS=${TEST%.*}.ans
+TESTDAT=${TEST%.*}.dat
+NAME=$(basename $TEST)
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
+
+# Timings and memory differ from run to run, and the bytes allocated from
+# one standard library to another, the counters do not.
+eval ${TESTER} --stats=$DIR/$NAME.json ${TEST} < $TESTDAT > /dev/null || exit 1
+DIFF=$(grep -v -e wall_ms -e peak_rss -e '"bytes"' $DIR/$NAME.json | diff -w - ${ANS})
+
+if [ $? -ne 0 ]; then
+  echo "Statistics of ${NAME} differ:"
+  echo "$DIFF"
+  exit 1
+else
+  rm -r $DIR
+  echo "Statistics of ${NAME} match"
+fi
@@ -0,0 +1,30 @@
+TEST=$1
+TESTER=$2
+
+ANS=${TEST%.*}.ans
+TESTDAT=${TEST%.*}.dat
+OPT=${TEST%.*}.opt
+NAME=$(basename $TEST)
+# Tests run at the same time, so each one writes to a directory of its own.
+DIR=$(mktemp -d)
+
+# The run stops early: what it prints, its error report and its exit code are
+# the answer. The report names the program by the path it is given, which is
+# cut to its name. Options of the test alone are in its .opt file.
+OPTIONS=$([ -f $OPT ] && cat $OPT)
+eval ${TESTER} ${OPTIONS} ${TEST} < $TESTDAT > $DIR/$NAME.log 2>&1
+echo "Exit code $?" >> $DIR/$NAME.log
+sed -i "s|${TEST}|${NAME}|" $DIR/$NAME.log
+
+DIFF=$(diff -w $DIR/$NAME.log ${ANS})
+
+if [ $? -ne 0 ]; then
+  echo "" >> $DIR/$NAME.log
+  echo "Diff is:" >> $DIR/$NAME.log
+  echo "$DIFF" >> $DIR/$NAME.log
+  echo "Test ${NAME} failed, see $DIR/${NAME}.log"
+  exit 1
+else
+  rm -r $DIR
+  echo "Test ${NAME} passed"
+fi